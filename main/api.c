@@ -2,8 +2,15 @@
 
 #include <errno.h>
 #include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
+#include "battery_self_test.h"
+#include "display.h"
+#include "input_current_probe.h"
+#include "load_shedding.h"
 #include "power_path.h"
 
 static esp_err_t http_get_set_input_current_limit(struct httpd_request_ctx* ctx, void* priv) {
@@ -28,6 +35,243 @@ static esp_err_t http_get_set_input_current_limit(struct httpd_request_ctx* ctx,
 	return ESP_OK;
 }
 
+static esp_err_t http_get_set_charge_control_interval(struct httpd_request_ctx* ctx, void* priv) {
+	char *interval_str;
+	unsigned long interval_ms;
+
+	if (httpd_query_string_get_param(ctx, "interval_ms", &interval_str) <= 0) {
+		return httpd_send_error(ctx, HTTPD_400);
+	}
+
+	errno = 0;
+	interval_ms = strtoul(interval_str, NULL, 10);
+	if (interval_ms > UINT16_MAX || errno) {
+		return httpd_send_error(ctx, HTTPD_400);
+	}
+
+	power_path_set_charge_control_interval_ms(interval_ms);
+
+	httpd_finalize_response(ctx);
+	return ESP_OK;
+}
+
+static esp_err_t http_get_probe_input_current(struct httpd_request_ctx* ctx, void* priv) {
+	if (input_current_probe_start()) {
+		return httpd_send_error_msg(ctx, HTTPD_400, "Probing requires mains power and no running probe");
+	}
+
+	httpd_finalize_response(ctx);
+	return ESP_OK;
+}
+
+static esp_err_t http_get_input_current_probe(struct httpd_request_ctx* ctx, void* priv) {
+	input_current_probe_status_t status;
+	char strbuf[256];
+
+	input_current_probe_get_status(&status);
+	httpd_resp_set_type(ctx->req, "application/json");
+	snprintf(strbuf, sizeof(strbuf),
+		 "{\"state\":\"%s\",\"reason\":\"%s\",\"probe_current_ma\":%u,\"result_current_ma\":%u,"
+		 "\"baseline_voltage_mv\":%u,\"voltage_mv\":%u,\"input_current_limit_ma\":%u}",
+		 input_current_probe_state_to_name(status.state), status.reason, status.probe_current_ma,
+		 status.result_current_ma, status.baseline_voltage_mv, status.voltage_mv,
+		 power_path_get_input_current_limit_ma());
+	httpd_response_write_string(ctx, strbuf);
+
+	httpd_finalize_response(ctx);
+	return ESP_OK;
+}
+
+static int find_output(const char *name) {
+	int i;
+
+	for (i = 0; i <= POWER_PATH_OUTPUT_MAX_; i++) {
+		if (!strcmp(name, power_path_output_to_name(i))) {
+			return i;
+		}
+	}
+
+	return -1;
+}
+
+static esp_err_t http_get_set_output_priority(struct httpd_request_ctx* ctx, void* priv) {
+	char *output_str, *priority_str;
+	unsigned long priority;
+	int output;
+
+	if (httpd_query_string_get_param(ctx, "output", &output_str) <= 0 ||
+	    httpd_query_string_get_param(ctx, "priority", &priority_str) <= 0) {
+		return httpd_send_error(ctx, HTTPD_400);
+	}
+
+	output = find_output(output_str);
+	if (output < 0) {
+		return httpd_send_error(ctx, HTTPD_400);
+	}
+
+	errno = 0;
+	priority = strtoul(priority_str, NULL, 10);
+	if (priority > UINT16_MAX || errno) {
+		return httpd_send_error(ctx, HTTPD_400);
+	}
+
+	load_shedding_set_output_priority(output, priority);
+
+	httpd_finalize_response(ctx);
+	return ESP_OK;
+}
+
+static esp_err_t http_get_set_shed_target_runtime(struct httpd_request_ctx* ctx, void* priv) {
+	char *runtime_str;
+	unsigned long runtime_min;
+
+	if (httpd_query_string_get_param(ctx, "runtime_min", &runtime_str) <= 0) {
+		return httpd_send_error(ctx, HTTPD_400);
+	}
+
+	errno = 0;
+	runtime_min = strtoul(runtime_str, NULL, 10);
+	if (runtime_min > UINT16_MAX || errno) {
+		return httpd_send_error(ctx, HTTPD_400);
+	}
+
+	load_shedding_set_target_runtime_min(runtime_min);
+
+	httpd_finalize_response(ctx);
+	return ESP_OK;
+}
+
+static esp_err_t http_get_load_shedding(struct httpd_request_ctx* ctx, void* priv) {
+	load_shedding_log_entry_t entry;
+	unsigned int i;
+	char strbuf[160];
+
+	httpd_resp_set_type(ctx->req, "application/json");
+	snprintf(strbuf, sizeof(strbuf), "{\"target_runtime_min\":%u,\"outputs\":[",
+		 load_shedding_get_target_runtime_min());
+	httpd_response_write_string(ctx, strbuf);
+	for (i = 0; i <= POWER_PATH_OUTPUT_MAX_; i++) {
+		snprintf(strbuf, sizeof(strbuf), "%s{\"output\":\"%s\",\"priority\":%u,\"enabled\":%s,\"shed\":%s}",
+			 i ? "," : "", power_path_output_to_name(i), load_shedding_get_output_priority(i),
+			 power_path_is_output_enabled(i) ? "true" : "false",
+			 load_shedding_is_output_shed(i) ? "true" : "false");
+		httpd_response_write_string(ctx, strbuf);
+	}
+	httpd_response_write_string(ctx, "],\"log\":[");
+	for (i = 0; load_shedding_get_log_entry(i, &entry); i++) {
+		snprintf(strbuf, sizeof(strbuf),
+			 "%s{\"uptime_s\":%lu,\"output\":\"%s\",\"action\":\"%s\",\"runtime_min\":%u,\"target_runtime_min\":%u}",
+			 i ? "," : "", (unsigned long)(entry.timestamp_us / 1000000LL), power_path_output_to_name(entry.output),
+			 load_shedding_action_to_name(entry.action), entry.runtime_min, entry.target_runtime_min);
+		httpd_response_write_string(ctx, strbuf);
+	}
+	httpd_response_write_string(ctx, "]}");
+
+	httpd_finalize_response(ctx);
+	return ESP_OK;
+}
+
+static esp_err_t http_get_start_battery_self_test(struct httpd_request_ctx* ctx, void* priv) {
+	battery_self_test_reason_t reason;
+
+	if (battery_self_test_start(&reason)) {
+		return httpd_send_error_msg(ctx, HTTPD_400, battery_self_test_reason_to_name(reason));
+	}
+
+	httpd_finalize_response(ctx);
+	return ESP_OK;
+}
+
+static esp_err_t http_get_set_battery_self_test_interval(struct httpd_request_ctx* ctx, void* priv) {
+	char *interval_str;
+	unsigned long interval_h;
+
+	if (httpd_query_string_get_param(ctx, "interval_h", &interval_str) <= 0) {
+		return httpd_send_error(ctx, HTTPD_400);
+	}
+
+	errno = 0;
+	interval_h = strtoul(interval_str, NULL, 10);
+	if (interval_h > UINT16_MAX || errno) {
+		return httpd_send_error(ctx, HTTPD_400);
+	}
+
+	battery_self_test_set_interval_h(interval_h);
+
+	httpd_finalize_response(ctx);
+	return ESP_OK;
+}
+
+static esp_err_t http_get_set_display_max_fps(struct httpd_request_ctx* ctx, void* priv) {
+	char *fps_str;
+	unsigned long fps;
+
+	if (httpd_query_string_get_param(ctx, "fps", &fps_str) <= 0) {
+		return httpd_send_error(ctx, HTTPD_400);
+	}
+
+	errno = 0;
+	fps = strtoul(fps_str, NULL, 10);
+	if (!fps || fps > DISPLAY_MAX_FPS_LIMIT || errno) {
+		return httpd_send_error(ctx, HTTPD_400);
+	}
+
+	display_set_max_fps(fps);
+
+	httpd_finalize_response(ctx);
+	return ESP_OK;
+}
+
+static esp_err_t http_get_battery_self_test(struct httpd_request_ctx* ctx, void* priv) {
+	battery_self_test_status_t status;
+	battery_self_test_result_t result;
+	unsigned int i, j;
+	char strbuf[256];
+
+	battery_self_test_get_status(&status);
+	httpd_resp_set_type(ctx->req, "application/json");
+	snprintf(strbuf, sizeof(strbuf),
+		 "{\"state\":\"%s\",\"reason\":\"%s\",\"interval_h\":%u,\"max_sample_interval_ms\":%u,"
+		 "\"recovery_points_ms\":[",
+		 battery_self_test_state_to_name(status.state), status.reason, battery_self_test_get_interval_h(),
+		 status.max_sample_interval_ms);
+	httpd_response_write_string(ctx, strbuf);
+	for (i = 0; i < BATTERY_SELF_TEST_RECOVERY_POINTS; i++) {
+		snprintf(strbuf, sizeof(strbuf), "%s%u", i ? "," : "", battery_self_test_get_recovery_point_ms(i));
+		httpd_response_write_string(ctx, strbuf);
+	}
+	httpd_response_write_string(ctx, "],\"results\":[");
+	for (i = 0; battery_self_test_get_result(i, &result); i++) {
+		snprintf(strbuf, sizeof(strbuf),
+			 "%s{\"test_number\":%u,\"resistance_mohm\":%u,\"resistance_ohmic_mohm\":%u,"
+			 "\"baseline_voltage_mv\":%u,\"step_current_ma\":%u,\"temperature_cdegc\":%d,"
+			 "\"soc_percent\":%u,\"soh_percent\":%u,\"recovery_mv\":[",
+			 i ? "," : "", (unsigned int)result.test_number, result.resistance_mohm,
+			 result.resistance_ohmic_mohm, result.baseline_voltage_mv, result.step_current_ma,
+			 result.temperature_cdegc, result.soc_percent, result.soh_percent);
+		httpd_response_write_string(ctx, strbuf);
+		for (j = 0; j < BATTERY_SELF_TEST_RECOVERY_POINTS; j++) {
+			snprintf(strbuf, sizeof(strbuf), "%s%u", j ? "," : "", result.recovery_mv[j]);
+			httpd_response_write_string(ctx, strbuf);
+		}
+		httpd_response_write_string(ctx, "]}");
+	}
+	httpd_response_write_string(ctx, "]}");
+
+	httpd_finalize_response(ctx);
+	return ESP_OK;
+}
+
 void api_init(httpd_t *httpd) {
 	ESP_ERROR_CHECK(httpd_add_get_handler(httpd, "/api/v1/set_input_current_limit", http_get_set_input_current_limit, NULL, 1, "current_ma"));
+	ESP_ERROR_CHECK(httpd_add_get_handler(httpd, "/api/v1/set_charge_control_interval", http_get_set_charge_control_interval, NULL, 1, "interval_ms"));
+	ESP_ERROR_CHECK(httpd_add_get_handler(httpd, "/api/v1/probe_input_current", http_get_probe_input_current, NULL, 0));
+	ESP_ERROR_CHECK(httpd_add_get_handler(httpd, "/api/v1/input_current_probe", http_get_input_current_probe, NULL, 0));
+	ESP_ERROR_CHECK(httpd_add_get_handler(httpd, "/api/v1/set_output_priority", http_get_set_output_priority, NULL, 2, "output", "priority"));
+	ESP_ERROR_CHECK(httpd_add_get_handler(httpd, "/api/v1/set_shed_target_runtime", http_get_set_shed_target_runtime, NULL, 1, "runtime_min"));
+	ESP_ERROR_CHECK(httpd_add_get_handler(httpd, "/api/v1/load_shedding", http_get_load_shedding, NULL, 0));
+	ESP_ERROR_CHECK(httpd_add_get_handler(httpd, "/api/v1/start_battery_self_test", http_get_start_battery_self_test, NULL, 0));
+	ESP_ERROR_CHECK(httpd_add_get_handler(httpd, "/api/v1/set_battery_self_test_interval", http_get_set_battery_self_test_interval, NULL, 1, "interval_h"));
+	ESP_ERROR_CHECK(httpd_add_get_handler(httpd, "/api/v1/battery_self_test", http_get_battery_self_test, NULL, 0));
+	ESP_ERROR_CHECK(httpd_add_get_handler(httpd, "/api/v1/set_display_max_fps", http_get_set_display_max_fps, NULL, 1, "fps"));
 }
@@ -3,92 +3,354 @@
 #include <errno.h>
 
 #include <esp_log.h>
+#include <esp_timer.h>
 
 #include "event_bus.h"
+#include "power_path.h"
 #include "scheduler.h"
+#include "seqlock.h"
 #include "util.h"
 
-#define GAUGE_UPDATE_INTERVAL_MS	2000
+
+#define AT_RATE_RESOLUTION_MA		10
+// Rewrite AtRate periodically, the gauge drops it on reset
+#define AT_RATE_REFRESH_INTERVAL_US	(60LL * 1000000LL)
+// Longest runtime the displays can show (99:59)
+#define RUNTIME_MAX_MIN			(99 * 60 + 59)
+
+typedef struct param_poll_def {
+	unsigned int period_mains_ms;
+	unsigned int period_battery_ms;
+} param_poll_def_t;
 
 static const char *TAG = "gauge";
 
-static int32_t battery_params[BATTERY_PARAM_MAX_ + 1] = { 0 };
+// Period 0 means never polled
+static const param_poll_def_t param_poll_defs[BATTERY_PARAM_MAX_ + 1] = {
+	[BATTERY_VOLTAGE_MV] =			{  10000,   2000 },
+	[BATTERY_VOLTAGE_CELL1_MV] =		{  10000,    500 },
+	[BATTERY_VOLTAGE_CELL2_MV] =		{  10000,    500 },
+	[BATTERY_SOC_PERCENT] =			{  10000,  10000 },
+	[BATTERY_SOH_PERCENT] =			{ 600000, 600000 },
+	[BATTERY_CURRENT_MA] =			{   2000,    500 },
+	[BATTERY_TIME_TO_EMPTY_MIN] =		{  30000,  10000 },
+	[BATTERY_AT_RATE_TIME_TO_EMPTY_MIN] =	{  10000,  30000 },
+	[BATTERY_AT_RATE_MA] =			{      0,      0 },
+	[BATTERY_TEMPERATURE_MDEG_C] =		{  30000,  10000 },
+	[BATTERY_FULL_CHARGE_CAPACITY_MAH] =	{ 600000, 600000 },
+	[BATTERY_REMAINING_CAPACITY_MAH] =	{  30000,  10000 },
+};
+
+static const charge_profile_point_t runtime_temperature_derating_points[] = {
+	{ -20000,  60 },
+	{ -10000,  75 },
+	{      0,  88 },
+	{  10000,  96 },
+	{  20000, 100 },
+};
+
+static const runtime_estimator_cfg_t runtime_estimator_cfg = {
+	.load_time_constant_ms = 60000,
+	.temperature_derating = {
+		.points = runtime_temperature_derating_points,
+		.num_points = ARRAY_SIZE(runtime_temperature_derating_points),
+	},
+	.efficiency_percent = 90,
+	.capacity_uncertainty_percent = 5,
+	.nominal_voltage_mv = 7400,
+	.min_load_mw = 100,
+	.max_runtime_min = RUNTIME_MAX_MIN,
+};
+
+// Working copy, only accessed from gauge update
+static battery_gauge_params_t params_next = { 0 };
+// Published copy for readers
+static battery_gauge_params_t params = { 0 };
+static seqlock_t params_lock;
 static battery_gauge_t *gauge;
 
+static int at_rate_shadow_ma;
+static bool at_rate_shadow_valid = false;
+static int64_t at_rate_last_write_us;
+
 static scheduler_task_t gauge_update_task;
+static event_bus_handler_t power_source_event_handler;
+static event_bus_handler_t power_path_event_handler;
+
+// Only accessed from the scheduler task
+static runtime_estimator_t runtime_estimator;
+static runtime_estimate_t runtime_estimate_next = { 0 };
+static int64_t runtime_last_sample_us = 0;
+// Published copy for readers, protected by params_lock
+static runtime_estimate_t runtime_estimate = { 0 };
+
+// Only accessed from gauge update
+static int64_t param_last_poll_us[BATTERY_PARAM_MAX_ + 1] = { 0 };
+static bool param_polled[BATTERY_PARAM_MAX_ + 1] = { false };
+static bool polling_on_battery = false;
+
+static unsigned int get_poll_period_ms(battery_param_t param) {
+	const param_poll_def_t *def = &param_poll_defs[param];
+
+	return polling_on_battery ? def->period_battery_ms : def->period_mains_ms;
+}
+
+static int64_t get_poll_deadline_us(battery_param_t param) {
+	if (!param_polled[param]) {
+		return 0;
+	}
+
+	return param_last_poll_us[param] + MS_TO_US((int64_t)get_poll_period_ms(param));
+}
+
+static bool is_cell_sample_param(battery_param_t param) {
+	return param == BATTERY_VOLTAGE_CELL1_MV ||
+	       param == BATTERY_VOLTAGE_CELL2_MV ||
+	       param == BATTERY_CURRENT_MA;
+}
+
+static void mark_polled(battery_param_t param, int64_t now) {
+	param_last_poll_us[param] = now;
+	param_polled[param] = true;
+}
+
+static bool update_param(battery_param_t param, int32_t val) {
+	if (val == params_next.values[param]) {
+		return false;
+	}
+
+	params_next.values[param] = val;
+	return true;
+}
+
+/*
+ * Cell voltages and current come from a single block read if the gauge
+ * supports it. Polling any of them refreshes all three, keeping the current
+ * consistent with the cell voltages.
+ */
+static int poll_cell_sample(battery_gauge_t *gauge, int64_t now, bool *changed) {
+	battery_gauge_cell_sample_t sample;
+	int err;
+
+	mark_polled(BATTERY_VOLTAGE_CELL1_MV, now);
+	mark_polled(BATTERY_VOLTAGE_CELL2_MV, now);
+	mark_polled(BATTERY_CURRENT_MA, now);
+
+	err = gauge->ops->get_cell_sample(gauge, &sample);
+	if (!err) {
+		*changed |= update_param(BATTERY_VOLTAGE_CELL1_MV, sample.cell1_mv);
+		*changed |= update_param(BATTERY_VOLTAGE_CELL2_MV, sample.cell2_mv);
+		*changed |= update_param(BATTERY_CURRENT_MA, sample.current_ma);
+	}
+
+	return err;
+}
 
 static void gauge_update(void *ctx);
 static void gauge_update(void *ctx) {
 	battery_gauge_t *gauge = ctx;
 	battery_param_t param;
 	bool changed = false;
+	int64_t now = esp_timer_get_time();
+	int64_t next_deadline_us = INT64_MAX;
 
-	for (param = BATTERY_VOLTAGE_MV; param < ARRAY_SIZE(battery_params); param++) {
+	// Deadlines are derived from the current period, switching tightens them right away
+	polling_on_battery = power_path_is_running_on_battery();
+
+	for (param = BATTERY_VOLTAGE_MV; param < ARRAY_SIZE(params_next.values); param++) {
 		int err;
 		int32_t val;
 
-		err = gauge->ops->get_param(gauge, param, &val);
+		if (!get_poll_period_ms(param) || now < get_poll_deadline_us(param)) {
+			continue;
+		}
+
+		if (gauge->ops->get_cell_sample && is_cell_sample_param(param)) {
+			err = poll_cell_sample(gauge, now, &changed);
+		} else {
+			mark_polled(param, now);
+			err = gauge->ops->get_param(gauge, param, &val);
+			if (!err) {
+				changed |= update_param(param, val);
+			}
+		}
+
 		if (err) {
 			if (err == ENOTSUP) {
 				ESP_LOGD(TAG, "Gauge does not support parameter %d", param);
 			} else {
 				ESP_LOGE(TAG, "Failed to get parameter %d from gauge: %d", param, err);
 			}
-		} else if (val != battery_params[param]) {
-			battery_params[param] = val;
-			changed = true;
+		}
+	}
+
+	// Separate pass, a combined read may have moved deadlines of parameters already visited
+	for (param = BATTERY_VOLTAGE_MV; param < ARRAY_SIZE(params_next.values); param++) {
+		if (get_poll_period_ms(param)) {
+			next_deadline_us = MIN(next_deadline_us, get_poll_deadline_us(param));
 		}
 	}
 
 	if (changed) {
+		seqlock_write_begin(&params_lock);
+		params = params_next;
+		seqlock_write_end(&params_lock);
+
 		event_bus_notify("battery_gauge", NULL);
 	}
-	scheduler_schedule_task_relative(&gauge_update_task, gauge_update, gauge, MS_TO_US(GAUGE_UPDATE_INTERVAL_MS));
+	scheduler_schedule_task(&gauge_update_task, gauge_update, gauge, next_deadline_us);
+}
+
+static void on_power_source_changed(void *priv, void *data) {
+	// Reevaluate poll deadlines immediately
+	scheduler_schedule_task_relative(&gauge_update_task, gauge_update, gauge, 0);
+}
+
+// Power path updates are delivered from the scheduler task, same as gauge updates
+static void on_power_path_update(void *priv, void *data) {
+	int64_t now = esp_timer_get_time();
+	power_path_snapshot_t power;
+	runtime_estimator_inputs_t inputs;
+	runtime_estimate_t estimate;
+
+	power_path_get_snapshot(&power);
+	runtime_estimator_add_load_sample(&runtime_estimator, power.output_power_mw,
+					  runtime_last_sample_us ? now - runtime_last_sample_us : 0);
+	runtime_last_sample_us = now;
+
+	inputs.remaining_capacity_mah = MAX(params_next.values[BATTERY_REMAINING_CAPACITY_MAH], 0);
+	inputs.voltage_mv = MAX(params_next.values[BATTERY_VOLTAGE_MV], 0);
+	inputs.temperature_mdegc = params_next.values[BATTERY_TEMPERATURE_MDEG_C];
+	runtime_estimator_get_estimate(&runtime_estimator, &inputs, &estimate);
+
+	// Load power drifts continuously, only notify if a displayed value changed
+	if (estimate.valid != runtime_estimate_next.valid ||
+	    estimate.runtime_min != runtime_estimate_next.runtime_min ||
+	    estimate.runtime_low_min != runtime_estimate_next.runtime_low_min ||
+	    estimate.runtime_high_min != runtime_estimate_next.runtime_high_min) {
+		runtime_estimate_next = estimate;
+		seqlock_write_begin(&params_lock);
+		runtime_estimate = runtime_estimate_next;
+		seqlock_write_end(&params_lock);
+
+		event_bus_notify("battery_gauge", NULL);
+	} else {
+		runtime_estimate_next = estimate;
+	}
 }
 
 void battery_gauge_init(battery_gauge_t *gauge_) {
 	gauge = gauge_;
+	seqlock_init(&params_lock);
 
 	scheduler_task_init(&gauge_update_task);
 	scheduler_schedule_task_relative(&gauge_update_task, gauge_update, gauge, 0);
+	event_bus_subscribe(&power_source_event_handler, "power_source", on_power_source_changed, NULL);
+
+	runtime_estimator_init(&runtime_estimator, &runtime_estimator_cfg);
+	event_bus_subscribe(&power_path_event_handler, "power_path", on_power_path_update, NULL);
+}
+
+static int32_t get_param(battery_param_t param) {
+	int32_t val;
+	uint32_t sequence;
+
+	do {
+		sequence = seqlock_read_begin(&params_lock);
+		val = params.values[param];
+	} while (seqlock_read_retry(&params_lock, sequence));
+
+	return val;
+}
+
+void battery_gauge_get_params(battery_gauge_params_t *params_) {
+	uint32_t sequence;
+
+	do {
+		sequence = seqlock_read_begin(&params_lock);
+		*params_ = params;
+	} while (seqlock_read_retry(&params_lock, sequence));
+}
+
+unsigned int battery_gauge_get_voltage_mv(void) {
+	int32_t val = get_param(BATTERY_VOLTAGE_MV);
+
+	return MAX(val, 0);
 }
 
 unsigned int battery_gauge_get_soc_percent(void) {
-	return CLAMP(battery_params[BATTERY_SOC_PERCENT], 0, 100);
+	int32_t val = get_param(BATTERY_SOC_PERCENT);
+
+	return CLAMP(val, 0, 100);
 }
 
 unsigned int battery_gauge_get_soh_percent(void) {
-	return CLAMP(battery_params[BATTERY_SOH_PERCENT], 0, 100);
+	int32_t val = get_param(BATTERY_SOH_PERCENT);
+
+	return CLAMP(val, 0, 100);
 }
 
 long battery_gauge_get_current_ma(void) {
-	return battery_params[BATTERY_CURRENT_MA];
+	return get_param(BATTERY_CURRENT_MA);
 }
 
 unsigned int battery_gauge_get_time_to_empty_min(void) {
-	return MAX(battery_params[BATTERY_TIME_TO_EMPTY_MIN], 0);
+	int32_t val = get_param(BATTERY_TIME_TO_EMPTY_MIN);
+
+	return MAX(val, 0);
 }
 
 unsigned int battery_gauge_get_cell1_voltage_mv(void) {
-	return CLAMP(battery_params[BATTERY_VOLTAGE_CELL1_MV], 0, 5000);
+	int32_t val = get_param(BATTERY_VOLTAGE_CELL1_MV);
+
+	return CLAMP(val, 0, 5000);
 }
 
 unsigned int battery_gauge_get_cell2_voltage_mv(void) {
-	return CLAMP(battery_params[BATTERY_VOLTAGE_CELL2_MV], 0, 5000);
+	int32_t val = get_param(BATTERY_VOLTAGE_CELL2_MV);
+
+	return CLAMP(val, 0, 5000);
 }
 
 long battery_gauge_get_temperature_mdegc(void) {
-	return battery_params[BATTERY_TEMPERATURE_MDEG_C];
+	return get_param(BATTERY_TEMPERATURE_MDEG_C);
 }
 
 unsigned int battery_gauge_get_full_charge_capacity_mah(void) {
-	return battery_params[BATTERY_FULL_CHARGE_CAPACITY_MAH];
+	return get_param(BATTERY_FULL_CHARGE_CAPACITY_MAH);
+}
+
+unsigned int battery_gauge_get_remaining_capacity_mah(void) {
+	int32_t val = get_param(BATTERY_REMAINING_CAPACITY_MAH);
+
+	return MAX(val, 0);
 }
 
 unsigned int battery_gauge_get_at_rate_time_to_empty_min(void) {
-	return battery_params[BATTERY_AT_RATE_TIME_TO_EMPTY_MIN];
+	return get_param(BATTERY_AT_RATE_TIME_TO_EMPTY_MIN);
 }
 
 void battery_gauge_set_at_rate(int rate_ma) {
-	gauge->ops->set_param(gauge, BATTERY_AT_RATE_MA, rate_ma);
+	int64_t now = esp_timer_get_time();
+	int err;
+
+	rate_ma = rate_ma / AT_RATE_RESOLUTION_MA * AT_RATE_RESOLUTION_MA;
+	if (at_rate_shadow_valid && at_rate_shadow_ma == rate_ma &&
+	    now - at_rate_last_write_us < AT_RATE_REFRESH_INTERVAL_US) {
+		return;
+	}
+
+	err = gauge->ops->set_param(gauge, BATTERY_AT_RATE_MA, rate_ma);
+	at_rate_shadow_ma = rate_ma;
+	at_rate_shadow_valid = !err;
+	at_rate_last_write_us = now;
+}
+
+void battery_gauge_get_runtime_estimate(runtime_estimate_t *estimate) {
+	uint32_t sequence;
+
+	do {
+		sequence = seqlock_read_begin(&params_lock);
+		*estimate = runtime_estimate;
+	} while (seqlock_read_retry(&params_lock, sequence));
 }
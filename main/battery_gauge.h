@@ -2,6 +2,8 @@
 
 #include <stdint.h>
 
+#include "runtime_estimator.h"
+
 typedef enum battery_param {
 	BATTERY_VOLTAGE_MV,
 	BATTERY_VOLTAGE_CELL1_MV,
@@ -14,13 +16,26 @@ typedef enum battery_param {
 	BATTERY_AT_RATE_MA,
 	BATTERY_TEMPERATURE_MDEG_C,
 	BATTERY_FULL_CHARGE_CAPACITY_MAH,
-	BATTERY_PARAM_MAX_ = BATTERY_FULL_CHARGE_CAPACITY_MAH
+	BATTERY_REMAINING_CAPACITY_MAH,
+	BATTERY_PARAM_MAX_ = BATTERY_REMAINING_CAPACITY_MAH
 } battery_param_t;
 
+typedef struct battery_gauge_params {
+	int32_t values[BATTERY_PARAM_MAX_ + 1];
+} battery_gauge_params_t;
+
+
+typedef struct battery_gauge_cell_sample {
+	int32_t cell1_mv;
+	int32_t cell2_mv;
+	int32_t current_ma;
+} battery_gauge_cell_sample_t;
 
 typedef struct battery_gauge battery_gauge_t;
 typedef struct battery_gauge_ops {
 	int (*get_param)(battery_gauge_t *gauge, battery_param_t param, int32_t *retval);
+	// Optional, reads both cell voltages and the battery current in a single transaction
+	int (*get_cell_sample)(battery_gauge_t *gauge, battery_gauge_cell_sample_t *sample);
 	int (*set_param)(battery_gauge_t *gauge, battery_param_t param, int32_t val);
 } battery_gauge_ops_t;
 
@@ -31,7 +46,9 @@ struct battery_gauge {
 };
 
 void battery_gauge_init(battery_gauge_t *gauge);
+void battery_gauge_get_params(battery_gauge_params_t *params);
 
+unsigned int battery_gauge_get_voltage_mv(void);
 unsigned int battery_gauge_get_soc_percent(void);
 unsigned int battery_gauge_get_soh_percent(void);
 long battery_gauge_get_current_ma(void);
@@ -40,5 +57,7 @@ unsigned int battery_gauge_get_cell1_voltage_mv(void);
 unsigned int battery_gauge_get_cell2_voltage_mv(void);
 long battery_gauge_get_temperature_mdegc(void);
 unsigned int battery_gauge_get_full_charge_capacity_mah(void);
+unsigned int battery_gauge_get_remaining_capacity_mah(void);
 unsigned int battery_gauge_get_at_rate_time_to_empty_min(void);
 void battery_gauge_set_at_rate(int rate_ma);
+void battery_gauge_get_runtime_estimate(runtime_estimate_t *estimate);
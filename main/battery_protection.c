@@ -1,47 +1,302 @@
 #include "battery_protection.h"
 
+#include <stdio.h>
+
+#include <esp_log.h>
+#include <esp_timer.h>
+
 #include "battery_gauge.h"
+#include "energy.h"
+#include "event_bus.h"
+#include "event_log.h"
 #include "power_path.h"
 #include "scheduler.h"
+#include "settings.h"
+#include "util.h"
+
+#define MIN_CELL_VOLTAGE_MV		2800
+// Cells recover a little once load transients settle
+#define MIN_CELL_HYSTERESIS_MV		50
+// Below this cell voltages are polled directly at a high rate
+#define WARN_CELL_VOLTAGE_MV		3000
+#define WARN_CELL_HYSTERESIS_MV		100
+#define FAST_POLL_INTERVAL_MS		100
+// Consecutive undervoltage samples required, filters load transients
+#define UNDERVOLTAGE_CONFIRM_SAMPLES	5
+
+// Pack temperature excursions are logged, the gauge protects the pack itself
+#define TEMPERATURE_HIGH_MDEGC		55000
+#define TEMPERATURE_LOW_MDEGC		-10000
+#define TEMPERATURE_HYSTERESIS_MDEGC	5000
 
-#define MIN_CELL_VOLTAGE_MV 2800
-#define UNDERVOLTAGE_SHUTDOWN_SECONDS 10
+/*
+ * NORMAL -> WARN:	lowest cell below warn threshold while on battery
+ * WARN -> NORMAL:	lowest cell above warn threshold + hysteresis or on mains
+ * WARN -> CONFIRM:	lowest cell below min threshold
+ * CONFIRM -> WARN:	lowest cell above min threshold + hysteresis
+ * CONFIRM -> SHUTDOWN:	UNDERVOLTAGE_CONFIRM_SAMPLES consecutive samples below min threshold and
+ *			pack shutdown command accepted by the gauge
+ * SHUTDOWN -> NORMAL:	on mains (pack shutdown did not take us down)
+ */
+typedef enum protection_state {
+	PROTECTION_STATE_NORMAL,
+	PROTECTION_STATE_WARN,
+	PROTECTION_STATE_CONFIRM,
+	PROTECTION_STATE_SHUTDOWN,
+} protection_state_t;
+
+static const char *TAG = "battery_protection";
 
 static bq40z50_t *gauge;
-static unsigned int undervoltage_seconds = 0;
-static scheduler_task_t gauge_poll_task;
+static scheduler_task_t fast_poll_task;
+static event_bus_handler_t battery_gauge_event_handler;
+static event_bus_handler_t power_source_event_handler;
+
+// Only accessed from the scheduler task
+static protection_state_t state = PROTECTION_STATE_NORMAL;
+static unsigned int undervoltage_samples = 0;
+static int64_t undervoltage_detected_us;
+static int64_t last_sample_us = 0;
+static bool temperature_excursion = false;
+
+static unsigned int shutdown_latency_last_ms;
+static unsigned int shutdown_latency_max_ms;
+static int64_t sample_interval_max_us = 0;
+
+static prometheus_metric_t shutdown_latency_metric;
+static prometheus_metric_t sample_interval_metric;
+
+static const char *state_to_name(protection_state_t state_) {
+	switch (state_) {
+	case PROTECTION_STATE_NORMAL: return "normal";
+	case PROTECTION_STATE_WARN: return "warn";
+	case PROTECTION_STATE_CONFIRM: return "confirm";
+	case PROTECTION_STATE_SHUTDOWN: return "shutdown";
+	default: return "(unknown)";
+	}
+}
+
+static void set_state(protection_state_t new_state, unsigned int cell_voltage_mv) {
+	if (new_state == state) {
+		return;
+	}
+
+	ESP_LOGI(TAG, "%s -> %s, lowest cell %u mV", state_to_name(state), state_to_name(new_state), cell_voltage_mv);
+	state = new_state;
+}
 
-static bool is_undervoltage(unsigned int cell_voltage_mv) {
-	if (cell_voltage_mv == 0) {
+static void fast_poll_cb(void *ctx);
+
+// Returns false if the gauge did not take the shutdown command
+static bool shutdown(unsigned int cell_voltage_mv) {
+	int64_t latency_us;
+	esp_err_t err;
+
+	// Issue the command first, the gauge delays turning off the FETs long enough for the bookkeeping below
+	err = bq40z50_shutdown(gauge);
+	latency_us = esp_timer_get_time() - undervoltage_detected_us;
+	if (err) {
+		ESP_LOGE(TAG, "Failed to shut down battery pack, retrying on next sample: %d", err);
 		return false;
 	}
 
-	return cell_voltage_mv < MIN_CELL_VOLTAGE_MV;
+	shutdown_latency_last_ms = DIV_ROUND_UP(latency_us, 1000);
+	shutdown_latency_max_ms = MAX(shutdown_latency_max_ms, shutdown_latency_last_ms);
+	ESP_LOGW(TAG, "Undervoltage confirmed, shut down battery pack %u ms after detection",
+		 shutdown_latency_last_ms);
+	energy_persist();
+	// Pack shutdown takes us down, keep the latency for the next boot
+	settings_set_undervoltage_latency_ms(shutdown_latency_last_ms, shutdown_latency_max_ms);
+	event_log_append(EVENT_LOG_TYPE_UNDERVOLTAGE_SHUTDOWN, cell_voltage_mv, shutdown_latency_last_ms, 0, 0);
+	return true;
 }
 
-static void gauge_poll_voltage_cb(void *ctx);
-static void gauge_poll_voltage_cb(void *ctx) {
-	unsigned int voltage_cell1_mv = battery_gauge_get_cell1_voltage_mv();
-	unsigned int voltage_cell2_mv = battery_gauge_get_cell2_voltage_mv();
+static void evaluate(unsigned int cell1_mv, unsigned int cell2_mv) {
+	int64_t now = esp_timer_get_time();
+	unsigned int cell_mv;
+
+	if (state != PROTECTION_STATE_NORMAL && last_sample_us) {
+		sample_interval_max_us = MAX(sample_interval_max_us, now - last_sample_us);
+	}
+	last_sample_us = now;
 
-	if (power_path_is_running_on_battery() &&
-	    (is_undervoltage(voltage_cell1_mv) || is_undervoltage(voltage_cell2_mv))) {
-		undervoltage_seconds++;
+	if (!power_path_is_running_on_battery()) {
+		set_state(PROTECTION_STATE_NORMAL, 0);
+		undervoltage_samples = 0;
+		scheduler_abort_task(&fast_poll_task);
+		return;
+	}
+
+	// A reading of 0 means the cell voltage is not known (yet)
+	if (!cell1_mv || !cell2_mv) {
+		return;
+	}
+	cell_mv = MIN(cell1_mv, cell2_mv);
 
-		if (undervoltage_seconds >= UNDERVOLTAGE_SHUTDOWN_SECONDS) {
-			bq40z50_shutdown(gauge);
-			undervoltage_seconds = 0;
+	switch (state) {
+	case PROTECTION_STATE_NORMAL:
+		if (cell_mv < WARN_CELL_VOLTAGE_MV) {
+			set_state(PROTECTION_STATE_WARN, cell_mv);
+			event_log_append(EVENT_LOG_TYPE_DEEP_DISCHARGE, cell_mv, 0, 0, 0);
+			scheduler_schedule_task_relative(&fast_poll_task, fast_poll_cb, NULL, 0);
 		}
+		break;
+	case PROTECTION_STATE_WARN:
+		if (cell_mv >= WARN_CELL_VOLTAGE_MV + WARN_CELL_HYSTERESIS_MV) {
+			set_state(PROTECTION_STATE_NORMAL, cell_mv);
+			scheduler_abort_task(&fast_poll_task);
+		} else if (cell_mv < MIN_CELL_VOLTAGE_MV) {
+			undervoltage_detected_us = now;
+			undervoltage_samples = 1;
+			set_state(PROTECTION_STATE_CONFIRM, cell_mv);
+		}
+		break;
+	case PROTECTION_STATE_CONFIRM:
+		if (cell_mv >= MIN_CELL_VOLTAGE_MV + MIN_CELL_HYSTERESIS_MV) {
+			undervoltage_samples = 0;
+			set_state(PROTECTION_STATE_WARN, cell_mv);
+		} else if (cell_mv < MIN_CELL_VOLTAGE_MV) {
+			undervoltage_samples++;
+			// Stay in confirm until the gauge accepts the command, fast polling retries it
+			if (undervoltage_samples >= UNDERVOLTAGE_CONFIRM_SAMPLES && shutdown(cell_mv)) {
+				set_state(PROTECTION_STATE_SHUTDOWN, cell_mv);
+			}
+		}
+		break;
+	case PROTECTION_STATE_SHUTDOWN:
+		break;
+	}
+}
+
+static void fast_poll_cb(void *ctx) {
+	bq40z50_cell_sample_t cells;
+	esp_err_t err;
+
+	err = bq40z50_get_cell_sample(gauge, &cells);
+	if (err) {
+		ESP_LOGE(TAG, "Failed to read cell voltages: %d", err);
+	} else {
+		evaluate(cells.cell1_mv, cells.cell2_mv);
+	}
+
+	if (state == PROTECTION_STATE_WARN || state == PROTECTION_STATE_CONFIRM) {
+		scheduler_schedule_task_relative(&fast_poll_task, fast_poll_cb, NULL, MS_TO_US(FAST_POLL_INTERVAL_MS));
+	}
+}
+
+static void check_temperature(void) {
+	long temperature_mdegc = battery_gauge_get_temperature_mdegc();
+	bool excursion;
+
+	// 0 means the gauge has not reported yet
+	if (!temperature_mdegc) {
+		return;
+	}
+
+	if (temperature_excursion) {
+		excursion = temperature_mdegc > TEMPERATURE_HIGH_MDEGC - TEMPERATURE_HYSTERESIS_MDEGC ||
+			    temperature_mdegc < TEMPERATURE_LOW_MDEGC + TEMPERATURE_HYSTERESIS_MDEGC;
 	} else {
-		undervoltage_seconds = 0;
+		excursion = temperature_mdegc > TEMPERATURE_HIGH_MDEGC || temperature_mdegc < TEMPERATURE_LOW_MDEGC;
 	}
 
-	scheduler_schedule_task_relative(&gauge_poll_task, gauge_poll_voltage_cb, NULL, MS_TO_US(1000));
+	if (excursion != temperature_excursion) {
+		temperature_excursion = excursion;
+		ESP_LOGW(TAG, "Pack temperature %s excursion: %ld mdeg C", excursion ? "entered" : "left", temperature_mdegc);
+		event_log_append(EVENT_LOG_TYPE_TEMPERATURE_EXCURSION, temperature_mdegc, excursion, 0, 0);
+	}
+}
+
+// Gauge events are delivered from the scheduler task as well
+static void on_battery_gauge_event(void *priv, void *data) {
+	check_temperature();
+
+	// Fast polling supersedes the gauge's cached readings
+	if (state != PROTECTION_STATE_NORMAL) {
+		return;
+	}
+
+	evaluate(battery_gauge_get_cell1_voltage_mv(), battery_gauge_get_cell2_voltage_mv());
+}
+
+static void on_power_source_event(void *priv, void *data) {
+	// Delivered from the power path notify task, sample fresh cell voltages once it has returned
+	scheduler_schedule_task_relative(&fast_poll_task, fast_poll_cb, NULL, 0);
 }
 
 void battery_protection_init(bq40z50_t *gauge_) {
 	gauge = gauge_;
-	scheduler_task_init(&gauge_poll_task);
-	scheduler_schedule_task_relative(&gauge_poll_task, gauge_poll_voltage_cb, NULL, MS_TO_US(5000));
+	settings_get_undervoltage_latency_ms(&shutdown_latency_last_ms, &shutdown_latency_max_ms);
+	scheduler_task_init(&fast_poll_task);
+	event_bus_subscribe(&battery_gauge_event_handler, "battery_gauge", on_battery_gauge_event, NULL);
+	event_bus_subscribe(&power_source_event_handler, "power_source", on_power_source_event, NULL);
+}
+
+static void get_shutdown_latency_last(const prometheus_metric_value_t *val, prometheus_metric_t *metric, char *value) {
+	sprintf(value, "%f", shutdown_latency_last_ms / 1000.f);
+}
+
+static void get_shutdown_latency_max(const prometheus_metric_value_t *val, prometheus_metric_t *metric, char *value) {
+	sprintf(value, "%f", shutdown_latency_max_ms / 1000.f);
+}
+
+static const prometheus_label_t latency_last_labels[] = {
+	{ "stat", "last" },
+};
+
+static const prometheus_label_t latency_max_labels[] = {
+	{ "stat", "max" },
+};
+
+static const prometheus_metric_value_t shutdown_latency_values[] = {
+	{
+		.num_labels = ARRAY_SIZE(latency_last_labels),
+		.labels = latency_last_labels,
+		.get_num_labels = NULL,
+		.get_value = get_shutdown_latency_last,
+	},
+	{
+		.num_labels = ARRAY_SIZE(latency_max_labels),
+		.labels = latency_max_labels,
+		.get_num_labels = NULL,
+		.get_value = get_shutdown_latency_max,
+	},
+};
+
+static const prometheus_metric_def_t shutdown_latency_metric_def = {
+	.name = "battery_undervoltage_shutdown_latency_seconds",
+	.help = "Time from first undervoltage sample to battery pack shutdown command",
+	.type = PROMETHEUS_METRIC_TYPE_GAUGE,
+	.values = shutdown_latency_values,
+	.num_values = ARRAY_SIZE(shutdown_latency_values),
+	.get_num_values = NULL,
+};
+
+static void get_sample_interval_max(const prometheus_metric_value_t *val, prometheus_metric_t *metric, char *value) {
+	sprintf(value, "%f", sample_interval_max_us / 1000000.f);
 }
 
+static const prometheus_metric_value_t sample_interval_values[] = {
+	{
+		.num_labels = ARRAY_SIZE(latency_max_labels),
+		.labels = latency_max_labels,
+		.get_num_labels = NULL,
+		.get_value = get_sample_interval_max,
+	},
+};
+
+static const prometheus_metric_def_t sample_interval_metric_def = {
+	.name = "battery_undervoltage_sample_interval_seconds",
+	.help = "Longest gap between cell voltage samples while undervoltage protection was armed",
+	.type = PROMETHEUS_METRIC_TYPE_GAUGE,
+	.values = sample_interval_values,
+	.num_values = ARRAY_SIZE(sample_interval_values),
+	.get_num_values = NULL,
+};
+
+void battery_protection_install_metrics(prometheus_t *prometheus) {
+	prometheus_metric_init(&shutdown_latency_metric, &shutdown_latency_metric_def, NULL);
+	prometheus_add_metric(prometheus, &shutdown_latency_metric);
+	prometheus_metric_init(&sample_interval_metric, &sample_interval_metric_def, NULL);
+	prometheus_add_metric(prometheus, &sample_interval_metric);
+}
@@ -1,5 +1,7 @@
 #pragma once
 
 #include "bq40z50_gauge.h"
+#include "prometheus.h"
 
 void battery_protection_init(bq40z50_t *gauge);
+void battery_protection_install_metrics(prometheus_t *prometheus);
@@ -0,0 +1,486 @@
+#include "battery_self_test.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+
+#include <esp_log.h>
+#include <esp_timer.h>
+
+#include "battery_gauge.h"
+#include "event_log.h"
+#include "power_path.h"
+#include "scheduler.h"
+#include "settings.h"
+#include "util.h"
+
+#define SAMPLE_INTERVAL_MS		100
+// Charger off, lets the pack relax to its open circuit voltage
+#define REST_MS				60000
+#define BASELINE_MS			2000
+#define LOAD_MS				10000
+// Loaded voltage is averaged over the end of the load phase
+#define LOAD_AVERAGE_MS			2000
+#define RECOVERY_MS			30000
+#define SCHEDULE_CHECK_INTERVAL_US	(60LL * 60LL * 1000000LL)
+
+// Preconditions
+#define MIN_SOC_PERCENT			50
+#define MIN_TEMPERATURE_MDEGC		10000
+#define MAX_TEMPERATURE_MDEGC		45000
+// Safety aborts
+#define ABORT_TEMPERATURE_MDEGC		50000
+#define ABORT_PACK_VOLTAGE_MV		6600
+#define ABORT_CELL_VOLTAGE_MV		3300
+#define ABORT_DISCHARGE_CURRENT_MA	3000
+#define MAX_READ_ERRORS			3
+
+#define MIN_STEP_CURRENT_MA		200
+
+typedef struct sample {
+	unsigned int voltage_mv;
+	int current_ma;
+} sample_t;
+
+typedef struct sample_average {
+	int64_t voltage_sum_mv;
+	int64_t current_sum_ma;
+	unsigned int num_samples;
+} sample_average_t;
+
+// Stored in NVS, keep layout stable
+typedef struct trend {
+	uint32_t num_results;
+	battery_self_test_result_t results[BATTERY_SELF_TEST_TREND_SIZE];
+} trend_t;
+
+static const char *TAG = "battery_self_test";
+
+static const unsigned int recovery_points_ms[BATTERY_SELF_TEST_RECOVERY_POINTS] = {
+	100, 500, 1000, 2000, 5000, 10000, 30000
+};
+
+static bq40z50_t *gauge;
+
+static battery_self_test_status_t status = {
+	.state = BATTERY_SELF_TEST_IDLE,
+	.reason = "",
+};
+
+static trend_t trend = { 0 };
+static battery_self_test_result_t result;
+
+static int64_t phase_start_us;
+static int64_t last_sample_us;
+static unsigned int read_errors;
+static sample_average_t baseline;
+static sample_average_t loaded;
+static bool ohmic_measured;
+static unsigned int num_recovery_points;
+
+static unsigned int interval_h;
+static unsigned int age_h;
+
+static SemaphoreHandle_t lock;
+static StaticSemaphore_t lock_buffer;
+
+static scheduler_task_t test_task;
+static scheduler_task_t schedule_task;
+
+static prometheus_metric_t resistance_metric;
+
+static void average_add(sample_average_t *avg, const sample_t *sample) {
+	avg->voltage_sum_mv += sample->voltage_mv;
+	avg->current_sum_ma += sample->current_ma;
+	avg->num_samples++;
+}
+
+static unsigned int average_voltage_mv(const sample_average_t *avg) {
+	return avg->voltage_sum_mv / avg->num_samples;
+}
+
+static int average_current_ma(const sample_average_t *avg) {
+	return avg->current_sum_ma / avg->num_samples;
+}
+
+static unsigned int calculate_resistance_mohm(unsigned int voltage_mv, int current_ma) {
+	unsigned int baseline_voltage_mv = average_voltage_mv(&baseline);
+	int step_current_ma = average_current_ma(&baseline) - current_ma;
+
+	if (voltage_mv >= baseline_voltage_mv) {
+		return 0;
+	}
+
+	return MIN((baseline_voltage_mv - voltage_mv) * 1000 / step_current_ma, UINT16_MAX);
+}
+
+static void finish(battery_self_test_state_t state, battery_self_test_reason_t reason) {
+	power_path_set_test_load_enabled(false);
+	power_path_set_charging_inhibited(false);
+	status.state = state;
+	status.reason = battery_self_test_reason_to_name(reason);
+
+	if (state == BATTERY_SELF_TEST_DONE) {
+		trend.results[trend.num_results % ARRAY_SIZE(trend.results)] = result;
+		trend.num_results++;
+		settings_set_battery_self_test_results(&trend, sizeof(trend));
+		ESP_LOGI(TAG, "Self-test #%u done, internal resistance %u mOhm (ohmic %u mOhm) at %u mA",
+			 (unsigned int)result.test_number, result.resistance_mohm, result.resistance_ohmic_mohm,
+			 result.step_current_ma);
+		age_h = 0;
+		settings_set_battery_self_test_age_h(age_h);
+		event_log_append(EVENT_LOG_TYPE_SELF_TEST, 1, result.resistance_mohm, result.resistance_ohmic_mohm,
+				 result.step_current_ma);
+	} else {
+		event_log_append(EVENT_LOG_TYPE_SELF_TEST, 0, reason, 0, 0);
+		// Age is kept, a scheduled test is retried with the next schedule check
+		ESP_LOGW(TAG, "Self-test aborted: %s", status.reason);
+	}
+}
+
+static battery_self_test_reason_t check_preconditions(void) {
+	int32_t temperature_mdegc = battery_gauge_get_temperature_mdegc();
+
+	if (power_path_is_running_on_battery()) {
+		return BATTERY_SELF_TEST_REASON_RUNNING_ON_BATTERY;
+	}
+	if (battery_gauge_get_soc_percent() < MIN_SOC_PERCENT) {
+		return BATTERY_SELF_TEST_REASON_SOC_TOO_LOW;
+	}
+	if (temperature_mdegc < MIN_TEMPERATURE_MDEGC || temperature_mdegc > MAX_TEMPERATURE_MDEGC) {
+		return BATTERY_SELF_TEST_REASON_TEMPERATURE_OUT_OF_RANGE;
+	}
+
+	return BATTERY_SELF_TEST_REASON_NONE;
+}
+
+static battery_self_test_reason_t read_sample(sample_t *sample) {
+	bq40z50_cell_sample_t cells;
+	esp_err_t err;
+
+	err = bq40z50_get_battery_voltage_mv(gauge, &sample->voltage_mv);
+	if (!err) {
+		err = bq40z50_get_cell_sample(gauge, &cells);
+	}
+	if (err) {
+		read_errors++;
+		return read_errors >= MAX_READ_ERRORS ? BATTERY_SELF_TEST_REASON_GAUGE_READ_ERRORS :
+							BATTERY_SELF_TEST_REASON_NONE;
+	}
+	read_errors = 0;
+	sample->current_ma = cells.current_ma;
+
+	if (power_path_is_running_on_battery()) {
+		return BATTERY_SELF_TEST_REASON_INPUT_LOST;
+	}
+	if (battery_gauge_get_temperature_mdegc() > ABORT_TEMPERATURE_MDEGC) {
+		return BATTERY_SELF_TEST_REASON_OVERTEMPERATURE;
+	}
+	if (sample->voltage_mv < ABORT_PACK_VOLTAGE_MV ||
+	    cells.cell1_mv < ABORT_CELL_VOLTAGE_MV || cells.cell2_mv < ABORT_CELL_VOLTAGE_MV) {
+		return BATTERY_SELF_TEST_REASON_UNDERVOLTAGE;
+	}
+	if (-sample->current_ma > ABORT_DISCHARGE_CURRENT_MA) {
+		return BATTERY_SELF_TEST_REASON_OVERCURRENT;
+	}
+
+	return BATTERY_SELF_TEST_REASON_NONE;
+}
+
+static void enter_phase(battery_self_test_state_t state, int64_t now) {
+	status.state = state;
+	phase_start_us = now;
+}
+
+static void test_step_cb(void *ctx);
+
+static void test_step(void) {
+	int64_t now = esp_timer_get_time();
+	unsigned int elapsed_ms = (now - phase_start_us) / 1000;
+	battery_self_test_reason_t abort_reason;
+	sample_t sample = { 0 };
+
+	if (status.state == BATTERY_SELF_TEST_REST) {
+		// Charging inhibited, nothing to sample yet
+		if (power_path_is_running_on_battery()) {
+			finish(BATTERY_SELF_TEST_ABORTED, BATTERY_SELF_TEST_REASON_INPUT_LOST);
+			return;
+		}
+		if (elapsed_ms >= REST_MS) {
+			enter_phase(BATTERY_SELF_TEST_BASELINE, now);
+			last_sample_us = 0;
+		}
+		scheduler_schedule_task_relative(&test_task, test_step_cb, NULL, MS_TO_US(SAMPLE_INTERVAL_MS));
+		return;
+	}
+
+	if (last_sample_us) {
+		status.max_sample_interval_ms = MAX(status.max_sample_interval_ms, (now - last_sample_us) / 1000);
+	}
+	last_sample_us = now;
+
+	abort_reason = read_sample(&sample);
+	if (abort_reason) {
+		finish(BATTERY_SELF_TEST_ABORTED, abort_reason);
+		return;
+	}
+	if (read_errors) {
+		scheduler_schedule_task_relative(&test_task, test_step_cb, NULL, MS_TO_US(SAMPLE_INTERVAL_MS));
+		return;
+	}
+
+	switch (status.state) {
+	case BATTERY_SELF_TEST_BASELINE:
+		average_add(&baseline, &sample);
+		if (elapsed_ms >= BASELINE_MS) {
+			result.baseline_voltage_mv = average_voltage_mv(&baseline);
+			power_path_set_test_load_enabled(true);
+			enter_phase(BATTERY_SELF_TEST_LOAD, now);
+		}
+		break;
+	case BATTERY_SELF_TEST_LOAD:
+		// The first reading reflecting the step shows the ohmic part only
+		if (!ohmic_measured && average_current_ma(&baseline) - sample.current_ma >= MIN_STEP_CURRENT_MA) {
+			result.resistance_ohmic_mohm = calculate_resistance_mohm(sample.voltage_mv, sample.current_ma);
+			ohmic_measured = true;
+		}
+		if (elapsed_ms >= LOAD_MS - LOAD_AVERAGE_MS) {
+			average_add(&loaded, &sample);
+		}
+		if (elapsed_ms >= LOAD_MS) {
+			int step_current_ma = average_current_ma(&baseline) - average_current_ma(&loaded);
+
+			power_path_set_test_load_enabled(false);
+			if (step_current_ma < MIN_STEP_CURRENT_MA) {
+				finish(BATTERY_SELF_TEST_ABORTED, BATTERY_SELF_TEST_REASON_INSUFFICIENT_LOAD_STEP);
+				return;
+			}
+			result.step_current_ma = step_current_ma;
+			result.resistance_mohm = calculate_resistance_mohm(average_voltage_mv(&loaded),
+									   average_current_ma(&loaded));
+			enter_phase(BATTERY_SELF_TEST_RECOVERY, now);
+		}
+		break;
+	case BATTERY_SELF_TEST_RECOVERY:
+		while (num_recovery_points < ARRAY_SIZE(recovery_points_ms) &&
+		       elapsed_ms >= recovery_points_ms[num_recovery_points]) {
+			unsigned int baseline_voltage_mv = average_voltage_mv(&baseline);
+
+			result.recovery_mv[num_recovery_points++] =
+				baseline_voltage_mv > sample.voltage_mv ? baseline_voltage_mv - sample.voltage_mv : 0;
+		}
+		if (elapsed_ms >= RECOVERY_MS) {
+			finish(BATTERY_SELF_TEST_DONE, BATTERY_SELF_TEST_REASON_NONE);
+			return;
+		}
+		break;
+	default:
+		return;
+	}
+
+	scheduler_schedule_task_relative(&test_task, test_step_cb, NULL, MS_TO_US(SAMPLE_INTERVAL_MS));
+}
+
+static void test_step_cb(void *ctx) {
+	xSemaphoreTake(lock, portMAX_DELAY);
+	test_step();
+	xSemaphoreGive(lock);
+}
+
+static battery_self_test_reason_t start(void) {
+	battery_self_test_reason_t reason;
+
+	if (status.state >= BATTERY_SELF_TEST_REST && status.state <= BATTERY_SELF_TEST_RECOVERY) {
+		return BATTERY_SELF_TEST_REASON_ALREADY_RUNNING;
+	}
+
+	reason = check_preconditions();
+	if (reason) {
+		return reason;
+	}
+
+	memset(&result, 0, sizeof(result));
+	memset(&baseline, 0, sizeof(baseline));
+	memset(&loaded, 0, sizeof(loaded));
+	ohmic_measured = false;
+	num_recovery_points = 0;
+	read_errors = 0;
+	status.reason = "";
+	status.max_sample_interval_ms = 0;
+
+	result.test_number = trend.num_results + 1;
+	result.temperature_cdegc = battery_gauge_get_temperature_mdegc() / 10;
+	result.soc_percent = battery_gauge_get_soc_percent();
+	result.soh_percent = battery_gauge_get_soh_percent();
+
+	ESP_LOGI(TAG, "Starting self-test #%u", (unsigned int)result.test_number);
+	power_path_set_charging_inhibited(true);
+	enter_phase(BATTERY_SELF_TEST_REST, esp_timer_get_time());
+	scheduler_schedule_task_relative(&test_task, test_step_cb, NULL, MS_TO_US(SAMPLE_INTERVAL_MS));
+
+	return BATTERY_SELF_TEST_REASON_NONE;
+}
+
+static void schedule_check_cb(void *ctx);
+static void schedule_check_cb(void *ctx) {
+	xSemaphoreTake(lock, portMAX_DELAY);
+	age_h++;
+	settings_set_battery_self_test_age_h(age_h);
+	if (interval_h && age_h >= interval_h) {
+		battery_self_test_reason_t reason = start();
+
+		if (reason) {
+			ESP_LOGI(TAG, "Scheduled self-test postponed: %s", battery_self_test_reason_to_name(reason));
+		}
+	}
+	xSemaphoreGive(lock);
+
+	scheduler_schedule_task_relative(&schedule_task, schedule_check_cb, NULL, SCHEDULE_CHECK_INTERVAL_US);
+}
+
+void battery_self_test_init(bq40z50_t *gauge_) {
+	gauge = gauge_;
+	lock = xSemaphoreCreateMutexStatic(&lock_buffer);
+
+	if (!settings_get_battery_self_test_results(&trend, sizeof(trend))) {
+		memset(&trend, 0, sizeof(trend));
+	}
+	interval_h = settings_get_battery_self_test_interval_h();
+	age_h = settings_get_battery_self_test_age_h();
+
+	scheduler_task_init(&test_task);
+	scheduler_task_init(&schedule_task);
+	scheduler_schedule_task_relative(&schedule_task, schedule_check_cb, NULL, SCHEDULE_CHECK_INTERVAL_US);
+}
+
+esp_err_t battery_self_test_start(battery_self_test_reason_t *reason_) {
+	battery_self_test_reason_t reason;
+
+	xSemaphoreTake(lock, portMAX_DELAY);
+	reason = start();
+	xSemaphoreGive(lock);
+	if (reason_) {
+		*reason_ = reason;
+	}
+	if (reason) {
+		ESP_LOGW(TAG, "Not starting self-test: %s", battery_self_test_reason_to_name(reason));
+		return ESP_ERR_INVALID_STATE;
+	}
+
+	return ESP_OK;
+}
+
+void battery_self_test_get_status(battery_self_test_status_t *status_) {
+	xSemaphoreTake(lock, portMAX_DELAY);
+	*status_ = status;
+	xSemaphoreGive(lock);
+}
+
+void battery_self_test_set_interval_h(unsigned int interval_h_) {
+	xSemaphoreTake(lock, portMAX_DELAY);
+	interval_h = interval_h_;
+	settings_set_battery_self_test_interval_h(interval_h);
+	xSemaphoreGive(lock);
+}
+
+unsigned int battery_self_test_get_interval_h(void) {
+	return interval_h;
+}
+
+unsigned int battery_self_test_get_recovery_point_ms(unsigned int point) {
+	return recovery_points_ms[point];
+}
+
+bool battery_self_test_get_result(unsigned int age, battery_self_test_result_t *result_) {
+	bool found = false;
+
+	xSemaphoreTake(lock, portMAX_DELAY);
+	if (age < MIN(trend.num_results, ARRAY_SIZE(trend.results))) {
+		*result_ = trend.results[(trend.num_results - 1 - age) % ARRAY_SIZE(trend.results)];
+		found = true;
+	}
+	xSemaphoreGive(lock);
+
+	return found;
+}
+
+const char *battery_self_test_state_to_name(battery_self_test_state_t state) {
+	switch (state) {
+	case BATTERY_SELF_TEST_IDLE: return "idle";
+	case BATTERY_SELF_TEST_REST: return "rest";
+	case BATTERY_SELF_TEST_BASELINE: return "baseline";
+	case BATTERY_SELF_TEST_LOAD: return "load";
+	case BATTERY_SELF_TEST_RECOVERY: return "recovery";
+	case BATTERY_SELF_TEST_DONE: return "done";
+	case BATTERY_SELF_TEST_ABORTED: return "aborted";
+	default: return "(unknown)";
+	}
+}
+
+const char *battery_self_test_reason_to_name(battery_self_test_reason_t reason) {
+	switch (reason) {
+	case BATTERY_SELF_TEST_REASON_NONE: return "";
+	case BATTERY_SELF_TEST_REASON_ALREADY_RUNNING: return "already running";
+	case BATTERY_SELF_TEST_REASON_RUNNING_ON_BATTERY: return "running on battery";
+	case BATTERY_SELF_TEST_REASON_SOC_TOO_LOW: return "state of charge too low";
+	case BATTERY_SELF_TEST_REASON_TEMPERATURE_OUT_OF_RANGE: return "temperature out of range";
+	case BATTERY_SELF_TEST_REASON_INPUT_LOST: return "input lost";
+	case BATTERY_SELF_TEST_REASON_OVERTEMPERATURE: return "overtemperature";
+	case BATTERY_SELF_TEST_REASON_UNDERVOLTAGE: return "undervoltage";
+	case BATTERY_SELF_TEST_REASON_OVERCURRENT: return "overcurrent";
+	case BATTERY_SELF_TEST_REASON_GAUGE_READ_ERRORS: return "gauge read errors";
+	case BATTERY_SELF_TEST_REASON_INSUFFICIENT_LOAD_STEP: return "insufficient load step";
+	default: return "(unknown)";
+	}
+}
+
+static const char *resistance_types[] = {
+	"total",
+	"ohmic",
+};
+
+static void get_resistance(const prometheus_metric_value_t *val, prometheus_metric_t *metric, char *value) {
+	battery_self_test_result_t latest;
+	unsigned int resistance_mohm;
+
+	battery_self_test_get_result(0, &latest);
+	resistance_mohm = val->priv ? latest.resistance_ohmic_mohm : latest.resistance_mohm;
+	sprintf(value, "%f", resistance_mohm / 1000.f);
+}
+
+static unsigned int get_num_labels(const prometheus_metric_value_t *val, prometheus_metric_t *metric) {
+	return 1;
+}
+
+static void get_label(const prometheus_metric_value_t *val, prometheus_metric_t *metric, unsigned int index, char *label, char *value) {
+	strcpy(label, "type");
+	strcpy(value, resistance_types[(unsigned int)val->priv]);
+}
+
+static unsigned int get_num_values(prometheus_metric_t *metric) {
+	battery_self_test_result_t latest;
+
+	return battery_self_test_get_result(0, &latest) ? ARRAY_SIZE(resistance_types) : 0;
+}
+
+static void get_metric_value(prometheus_metric_t *metric, unsigned int index, prometheus_metric_value_t *value) {
+	value->priv = (void *)index;
+	value->get_num_labels = get_num_labels;
+	value->get_label = get_label;
+	value->get_value = get_resistance;
+}
+
+static const prometheus_metric_def_t resistance_metric_def = {
+	.name = "battery_internal_resistance_ohms",
+	.help = "Battery internal resistance measured by the most recent self-test",
+	.type = PROMETHEUS_METRIC_TYPE_GAUGE,
+	.get_num_values = get_num_values,
+	.get_value = get_metric_value,
+};
+
+void battery_self_test_install_metrics(prometheus_t *prometheus) {
+	prometheus_metric_init(&resistance_metric, &resistance_metric_def, NULL);
+	prometheus_add_metric(prometheus, &resistance_metric);
+}
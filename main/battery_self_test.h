@@ -0,0 +1,71 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <esp_err.h>
+
+#include "bq40z50_gauge.h"
+#include "prometheus.h"
+
+#define BATTERY_SELF_TEST_RECOVERY_POINTS	7
+#define BATTERY_SELF_TEST_TREND_SIZE		16
+
+typedef enum battery_self_test_state {
+	BATTERY_SELF_TEST_IDLE,
+	BATTERY_SELF_TEST_REST,
+	BATTERY_SELF_TEST_BASELINE,
+	BATTERY_SELF_TEST_LOAD,
+	BATTERY_SELF_TEST_RECOVERY,
+	BATTERY_SELF_TEST_DONE,
+	BATTERY_SELF_TEST_ABORTED,
+} battery_self_test_state_t;
+
+// Stored in the event log, only ever append new reasons
+typedef enum battery_self_test_reason {
+	BATTERY_SELF_TEST_REASON_NONE			= 0,
+	BATTERY_SELF_TEST_REASON_ALREADY_RUNNING	= 1,
+	BATTERY_SELF_TEST_REASON_RUNNING_ON_BATTERY	= 2,
+	BATTERY_SELF_TEST_REASON_SOC_TOO_LOW		= 3,
+	BATTERY_SELF_TEST_REASON_TEMPERATURE_OUT_OF_RANGE = 4,
+	BATTERY_SELF_TEST_REASON_INPUT_LOST		= 5,
+	BATTERY_SELF_TEST_REASON_OVERTEMPERATURE	= 6,
+	BATTERY_SELF_TEST_REASON_UNDERVOLTAGE		= 7,
+	BATTERY_SELF_TEST_REASON_OVERCURRENT		= 8,
+	BATTERY_SELF_TEST_REASON_GAUGE_READ_ERRORS	= 9,
+	BATTERY_SELF_TEST_REASON_INSUFFICIENT_LOAD_STEP	= 10,
+} battery_self_test_reason_t;
+
+// Stored in NVS, keep layout stable
+typedef struct battery_self_test_result {
+	uint32_t test_number;
+	uint16_t resistance_ohmic_mohm;
+	uint16_t resistance_mohm;
+	uint16_t baseline_voltage_mv;
+	uint16_t step_current_ma;
+	int16_t temperature_cdegc;
+	uint8_t soc_percent;
+	uint8_t soh_percent;
+	// Voltage below baseline at each recovery point after removing the load
+	uint16_t recovery_mv[BATTERY_SELF_TEST_RECOVERY_POINTS];
+} battery_self_test_result_t;
+
+typedef struct battery_self_test_status {
+	battery_self_test_state_t state;
+	const char *reason;
+	unsigned int max_sample_interval_ms;
+} battery_self_test_status_t;
+
+void battery_self_test_init(bq40z50_t *gauge);
+// reason is set to why the test could not be started, may be NULL
+esp_err_t battery_self_test_start(battery_self_test_reason_t *reason);
+void battery_self_test_get_status(battery_self_test_status_t *status);
+void battery_self_test_set_interval_h(unsigned int interval_h);
+unsigned int battery_self_test_get_interval_h(void);
+// Offset of recovery point in ms after removing the load
+unsigned int battery_self_test_get_recovery_point_ms(unsigned int point);
+// age 0 is the most recent result
+bool battery_self_test_get_result(unsigned int age, battery_self_test_result_t *result);
+const char *battery_self_test_state_to_name(battery_self_test_state_t state);
+const char *battery_self_test_reason_to_name(battery_self_test_reason_t reason);
+void battery_self_test_install_metrics(prometheus_t *prometheus);
@@ -3,6 +3,8 @@
 
 #include <esp_log.h>
 
+#include "util.h"
+
 #define SMBUS_ADDRESS	0x09
 #define DEVICE_ID	0x10
 #define MANUFACTURER_ID	0x40
@@ -16,6 +18,28 @@
 
 static const char *TAG = "bq24715_charger";
 
+static const uint8_t reg_cmds[] = {
+	[BQ24715_REG_CHARGE_CURRENT] = CMD_CHARGE_CURRENT,
+	[BQ24715_REG_MAX_CHARGE_VOLTAGE] = CMD_MAX_CHARGE_VOLTAGE,
+	[BQ24715_REG_MIN_SYSTEM_VOLTAGE] = CMD_MIN_SYSTEM_VOLTAGE,
+	[BQ24715_REG_INPUT_CURRENT] = CMD_INPUT_CURRENT,
+};
+
+static esp_err_t write_reg(bq24715_t *charger, bq24715_reg_t reg, uint16_t value) {
+	bq24715_shadow_reg_t *shadow = &charger->shadow[reg];
+	uint8_t word[2] = { value & 0xff, value >> 8 };
+	esp_err_t err;
+
+	if (shadow->valid && shadow->value == value) {
+		return ESP_OK;
+	}
+
+	err = smbus_write_word(charger->bus, SMBUS_ADDRESS, reg_cmds[reg], word);
+	shadow->value = value;
+	shadow->valid = !err;
+	return err;
+}
+
 esp_err_t bq24715_init(bq24715_t *charger, smbus_t *smbus) {
 	uint8_t word[2];
 	esp_err_t err = smbus_read_word(smbus, SMBUS_ADDRESS, CMD_MANUFACTURER_ID, word);
@@ -40,6 +64,7 @@ esp_err_t bq24715_init(bq24715_t *charger, smbus_t *smbus) {
 	}
 
 	charger->bus = smbus;
+	bq24715_invalidate_registers(charger);
 	return ESP_OK;
 }
 
@@ -48,8 +73,7 @@ esp_err_t bq24715_set_charge_current(bq24715_t *charger, unsigned int current_ma
 		return ESP_ERR_INVALID_ARG;
 	}
 	current_ma &= ~((uint16_t)0xe03f);
-	uint8_t word[2] = { current_ma & 0xff, current_ma >> 8 };
-	return smbus_write_word(charger->bus, SMBUS_ADDRESS, CMD_CHARGE_CURRENT, word);
+	return write_reg(charger, BQ24715_REG_CHARGE_CURRENT, current_ma);
 }
 
 esp_err_t bq24715_set_max_charge_voltage(bq24715_t *charger, unsigned int voltage_mv) {
@@ -57,8 +81,7 @@ esp_err_t bq24715_set_max_charge_voltage(bq24715_t *charger, unsigned int voltag
 		return ESP_ERR_INVALID_ARG;
 	}
 	voltage_mv &= ~((uint16_t)0x0f);
-	uint8_t word[2] = { voltage_mv & 0xff, voltage_mv >> 8 };
-	return smbus_write_word(charger->bus, SMBUS_ADDRESS, CMD_MAX_CHARGE_VOLTAGE, word);
+	return write_reg(charger, BQ24715_REG_MAX_CHARGE_VOLTAGE, voltage_mv);
 }
 
 esp_err_t bq24715_set_min_system_voltage(bq24715_t *charger, unsigned int voltage_mv) {
@@ -66,8 +89,7 @@ esp_err_t bq24715_set_min_system_voltage(bq24715_t *charger, unsigned int voltag
 		return ESP_ERR_INVALID_ARG;
 	}
 	voltage_mv &= ~((uint16_t)0xff);
-	uint8_t word[2] = { voltage_mv & 0xff, voltage_mv >> 8 };
-	return smbus_write_word(charger->bus, SMBUS_ADDRESS, CMD_MIN_SYSTEM_VOLTAGE, word);
+	return write_reg(charger, BQ24715_REG_MIN_SYSTEM_VOLTAGE, voltage_mv);
 }
 
 esp_err_t bq24715_set_input_current(bq24715_t *charger, unsigned int current_ma) {
@@ -75,6 +97,52 @@ esp_err_t bq24715_set_input_current(bq24715_t *charger, unsigned int current_ma)
 		return ESP_ERR_INVALID_ARG;
 	}
 	current_ma &= ~((uint16_t)0x3f);
-	uint8_t word[2] = { current_ma & 0xff, current_ma >> 8 };
-	return smbus_write_word(charger->bus, SMBUS_ADDRESS, CMD_INPUT_CURRENT, word);
+	return write_reg(charger, BQ24715_REG_INPUT_CURRENT, current_ma);
+}
+
+/*
+ * Reads back all registers with a valid shadow value and rewrites those
+ * that do not match, e.g. after the charger has been reset.
+ */
+esp_err_t bq24715_verify_registers(bq24715_t *charger) {
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(charger->shadow); i++) {
+		bq24715_shadow_reg_t *shadow = &charger->shadow[i];
+		uint8_t word[2];
+		uint16_t value;
+		esp_err_t err;
+
+		if (!shadow->valid) {
+			continue;
+		}
+
+		err = smbus_read_word(charger->bus, SMBUS_ADDRESS, reg_cmds[i], word);
+		if (err) {
+			ESP_LOGE(TAG, "Failed to read back register 0x%02x: %d", reg_cmds[i], err);
+			return err;
+		}
+
+		value = word[0] | (word[1] << 8);
+		if (value != shadow->value) {
+			ESP_LOGW(TAG, "Register 0x%02x is 0x%04x, expected 0x%04x, rewriting",
+				 reg_cmds[i], value, shadow->value);
+			shadow->valid = false;
+			err = write_reg(charger, i, shadow->value);
+			if (err) {
+				return err;
+			}
+		}
+	}
+
+	return ESP_OK;
+}
+
+// Forces the next write of each register to go to the charger
+void bq24715_invalidate_registers(bq24715_t *charger) {
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(charger->shadow); i++) {
+		charger->shadow[i].valid = false;
+	}
 }
@@ -1,9 +1,27 @@
 #pragma once
 
+#include <stdbool.h>
+#include <stdint.h>
+
 #include "smbus.h"
 
+typedef enum bq24715_reg {
+	BQ24715_REG_CHARGE_CURRENT,
+	BQ24715_REG_MAX_CHARGE_VOLTAGE,
+	BQ24715_REG_MIN_SYSTEM_VOLTAGE,
+	BQ24715_REG_INPUT_CURRENT,
+	BQ24715_REG_MAX_ = BQ24715_REG_INPUT_CURRENT
+} bq24715_reg_t;
+
+// Last value written to a register, writes are skipped if unchanged
+typedef struct bq24715_shadow_reg {
+	uint16_t value;
+	bool valid;
+} bq24715_shadow_reg_t;
+
 typedef struct bq24715 {
 	smbus_t *bus;
+	bq24715_shadow_reg_t shadow[BQ24715_REG_MAX_ + 1];
 } bq24715_t;
 
 esp_err_t bq24715_init(bq24715_t *charger, smbus_t *smbus);
@@ -11,3 +29,5 @@ esp_err_t bq24715_set_charge_current(bq24715_t *charger, unsigned int current_ma
 esp_err_t bq24715_set_max_charge_voltage(bq24715_t *charger, unsigned int voltage_mv);
 esp_err_t bq24715_set_min_system_voltage(bq24715_t *charger, unsigned int voltage_mv);
 esp_err_t bq24715_set_input_current(bq24715_t *charger, unsigned int current_ma);
+esp_err_t bq24715_verify_registers(bq24715_t *charger);
+void bq24715_invalidate_registers(bq24715_t *charger);
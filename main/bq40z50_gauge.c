@@ -17,7 +17,7 @@
 #define CMD_CURRENT			0x0a
 #define CMD_AVERAGE_CURRENT		0x0b
 #define CMD_STATE_OF_CHARGE		0x0d
-#define CMD_REMAINING_ENERGY		0x0f
+#define CMD_REMAINING_CAPACITY		0x0f
 #define CMD_FULL_CHARGE_CAPACITY	0x10
 #define CMD_RUN_TIME_TO_EMPTY		0x11
 #define CMD_AVERAGE_TIME_TO_EMPTY	0x12
@@ -26,6 +26,13 @@
 #define CMD_CELL_VOLTAGE2		0x3e
 #define CMD_CELL_VOLTAGE1		0x3f
 #define CMD_STATE_OF_HEALTH		0x4f
+#define CMD_DA_STATUS1			0x71
+
+// Offsets into the DAStatus1 block, all values are little endian words
+#define DA_STATUS1_CELL_VOLTAGE1	0
+#define DA_STATUS1_CELL_VOLTAGE2	2
+#define DA_STATUS1_CELL_CURRENT1	12
+#define DA_STATUS1_READ_LEN		14
 
 #define CMD_MANUFACTURER_ACCESS		0x44
 #define CMD_MAC_DEVICE_TYPE		0x01
@@ -201,11 +208,29 @@ static int bq40z50_get_param(battery_gauge_t *gauge, battery_param_t param, int3
 		return bq40z50_get_battery_temperature_mdegc(bq40, retval);
 	case BATTERY_FULL_CHARGE_CAPACITY_MAH:
 		return bq40z50_get_full_charge_capacity_mah(bq40, (unsigned int *)retval);
+	case BATTERY_REMAINING_CAPACITY_MAH:
+		return bq40z50_get_remaining_capacity_mah(bq40, (unsigned int *)retval);
 	default:
 		return ENOTSUP;
 	}
 }
 
+static int bq40z50_gauge_get_cell_sample(battery_gauge_t *gauge, battery_gauge_cell_sample_t *sample) {
+	bq40z50_t *bq40 = gauge->priv;
+	bq40z50_cell_sample_t cells;
+	esp_err_t err;
+
+	err = bq40z50_get_cell_sample(bq40, &cells);
+	if (err) {
+		return err;
+	}
+
+	sample->cell1_mv = cells.cell1_mv;
+	sample->cell2_mv = cells.cell2_mv;
+	sample->current_ma = cells.current_ma;
+	return ESP_OK;
+}
+
 static int bq40z50_set_param(battery_gauge_t *gauge, battery_param_t param, int32_t val) {
 	bq40z50_t *bq40 = gauge->priv;
 
@@ -219,6 +244,7 @@ static int bq40z50_set_param(battery_gauge_t *gauge, battery_param_t param, int3
 
 static const battery_gauge_ops_t bq40z50_gauge_ops = {
 	.get_param = bq40z50_get_param,
+	.get_cell_sample = bq40z50_gauge_get_cell_sample,
 	.set_param = bq40z50_set_param,
 };
 
@@ -275,6 +301,31 @@ esp_err_t bq40z50_get_cell_voltage_mv(bq40z50_t *gauge, bq40z50_cell_t cell, uns
 	}
 }
 
+esp_err_t bq40z50_get_cell_sample(bq40z50_t *gauge, bq40z50_cell_sample_t *res) {
+	uint8_t block[DA_STATUS1_READ_LEN];
+	size_t block_len;
+	esp_err_t err;
+
+	// Only the leading part of the 32 byte block is needed, stop reading after it
+	err = smbus_read_block(gauge->bus, gauge->address, CMD_DA_STATUS1, block, sizeof(block), &block_len);
+	if (err) {
+		return err;
+	}
+	if (block_len < sizeof(block)) {
+		ESP_LOGE(TAG, "Short DAStatus1 block, expected at least %u bytes, got %u",
+			 (unsigned int)sizeof(block), (unsigned int)block_len);
+		return ESP_ERR_INVALID_RESPONSE;
+	}
+
+	res->cell1_mv = (unsigned int)block[DA_STATUS1_CELL_VOLTAGE1] |
+			(unsigned int)block[DA_STATUS1_CELL_VOLTAGE1 + 1] << 8;
+	res->cell2_mv = (unsigned int)block[DA_STATUS1_CELL_VOLTAGE2] |
+			(unsigned int)block[DA_STATUS1_CELL_VOLTAGE2 + 1] << 8;
+	res->current_ma = (int16_t)((int16_t)block[DA_STATUS1_CELL_CURRENT1] |
+				    (int16_t)block[DA_STATUS1_CELL_CURRENT1 + 1] << 8);
+	return ESP_OK;
+}
+
 esp_err_t bq40z50_get_state_of_charge_percent(bq40z50_t *gauge, unsigned int *res) {
 	return read_uword(gauge, CMD_STATE_OF_CHARGE, res);
 }
@@ -287,6 +338,10 @@ esp_err_t bq40z50_get_full_charge_capacity_mah(bq40z50_t *gauge, unsigned int *r
 	return read_uword(gauge, CMD_FULL_CHARGE_CAPACITY, res);
 }
 
+esp_err_t bq40z50_get_remaining_capacity_mah(bq40z50_t *gauge, unsigned int *res) {
+	return read_uword(gauge, CMD_REMAINING_CAPACITY, res);
+}
+
 esp_err_t bq40z50_get_current_ma(bq40z50_t *gauge, int *res) {
 	return read_sword(gauge, CMD_CURRENT, res);
 }
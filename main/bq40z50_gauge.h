@@ -18,14 +18,23 @@ typedef enum {
 	BQ40Z50_CELL_2
 } bq40z50_cell_t;
 
+// Cell voltages and the current measured along with them, from one DAStatus1 read
+typedef struct bq40z50_cell_sample {
+	unsigned int cell1_mv;
+	unsigned int cell2_mv;
+	int current_ma;
+} bq40z50_cell_sample_t;
+
 esp_err_t bq40z50_init(bq40z50_t *gauge, smbus_t *bus, int address);
 
 esp_err_t bq40z50_get_battery_voltage_mv(bq40z50_t *gauge, unsigned int *res);
 esp_err_t bq40z50_get_battery_temperature_mdegc(bq40z50_t *gauge, int32_t *res);
 esp_err_t bq40z50_get_cell_voltage_mv(bq40z50_t *gauge, bq40z50_cell_t cell, unsigned int *res);
+esp_err_t bq40z50_get_cell_sample(bq40z50_t *gauge, bq40z50_cell_sample_t *res);
 esp_err_t bq40z50_get_state_of_charge_percent(bq40z50_t *gauge, unsigned int *res);
 esp_err_t bq40z50_get_state_of_health_percent(bq40z50_t *gauge, unsigned int *res);
 esp_err_t bq40z50_get_full_charge_capacity_mah(bq40z50_t *gauge, unsigned int *res);
+esp_err_t bq40z50_get_remaining_capacity_mah(bq40z50_t *gauge, unsigned int *res);
 esp_err_t bq40z50_get_current_ma(bq40z50_t *gauge, int *res);
 esp_err_t bq40z50_get_charging_current_ma(bq40z50_t *gauge, unsigned int *res);
 esp_err_t bq40z50_get_charging_voltage_mv(bq40z50_t *gauge, unsigned int *res);
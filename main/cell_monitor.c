@@ -0,0 +1,269 @@
+#include "cell_monitor.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include <esp_log.h>
+
+#include "battery_gauge.h"
+#include "event_bus.h"
+#include "power_path.h"
+#include "resistance_estimator.h"
+#include "seqlock.h"
+#include "util.h"
+
+#define IMBALANCE_FILTER_PERMILLE	950
+// Resistance imbalance is only reported if both cells are estimated with this confidence
+#define MIN_IMBALANCE_CONFIDENCE_PERCENT	50
+
+static const char *TAG = "cell_monitor";
+
+static const battery_param_t cell_params[CELL_MONITOR_NUM_CELLS] = {
+	BATTERY_VOLTAGE_CELL1_MV,
+	BATTERY_VOLTAGE_CELL2_MV,
+};
+
+static const resistance_estimator_cfg_t resistance_estimator_cfg = {
+	.forgetting_permille = 980,
+	.min_step_ma = 100,
+	.full_confidence_steps = 10,
+};
+
+// Only accessed from the scheduler task
+static resistance_estimator_t estimators[CELL_MONITOR_NUM_CELLS];
+static bool previous_valid = false;
+static int previous_current_ma;
+static int32_t previous_cell_mv[CELL_MONITOR_NUM_CELLS];
+static int64_t voltage_imbalance_uv = 0;
+
+// Published copy for readers
+static cell_monitor_estimate_t estimate = { 0 };
+static seqlock_t estimate_lock;
+
+static event_bus_handler_t battery_gauge_event_handler;
+
+static prometheus_metric_t resistance_metric;
+static prometheus_metric_t confidence_metric;
+static prometheus_metric_t voltage_imbalance_metric;
+static prometheus_metric_t resistance_imbalance_metric;
+
+static void publish_estimate(void) {
+	cell_monitor_estimate_t next = { 0 };
+	unsigned int resistance_min_mohm = UINT32_MAX;
+	unsigned int resistance_max_mohm = 0;
+	bool confident = true;
+	int i;
+
+	for (i = 0; i < CELL_MONITOR_NUM_CELLS; i++) {
+		next.cells[i].resistance_mohm = resistance_estimator_get_resistance_mohm(&estimators[i]);
+		next.cells[i].confidence_percent = resistance_estimator_get_confidence_percent(&estimators[i]);
+		resistance_min_mohm = MIN(resistance_min_mohm, next.cells[i].resistance_mohm);
+		resistance_max_mohm = MAX(resistance_max_mohm, next.cells[i].resistance_mohm);
+		confident = confident && next.cells[i].confidence_percent >= MIN_IMBALANCE_CONFIDENCE_PERCENT;
+	}
+
+	next.voltage_imbalance_mv = DIV_ROUND(voltage_imbalance_uv, 1000);
+	if (confident && resistance_max_mohm) {
+		next.resistance_imbalance_percent = (resistance_max_mohm - resistance_min_mohm) * 100 / resistance_max_mohm;
+	}
+
+	seqlock_write_begin(&estimate_lock);
+	estimate = next;
+	seqlock_write_end(&estimate_lock);
+}
+
+// Gauge events are delivered from the scheduler task
+static void on_battery_gauge_event(void *priv, void *data) {
+	battery_gauge_params_t battery;
+	int32_t cell_min_mv = INT32_MAX, cell_max_mv = 0;
+	bool cells_updated = false;
+	bool on_battery;
+	int current_ma = 0;
+	int i;
+
+	battery_gauge_get_params(&battery);
+	for (i = 0; i < CELL_MONITOR_NUM_CELLS; i++) {
+		int32_t cell_mv = battery.values[cell_params[i]];
+
+		if (cell_mv <= 0) {
+			previous_valid = false;
+			return;
+		}
+		cell_min_mv = MIN(cell_min_mv, cell_mv);
+		cell_max_mv = MAX(cell_max_mv, cell_mv);
+		cells_updated = cells_updated || cell_mv != previous_cell_mv[i];
+	}
+
+	// Only correlate once the gauge published new cell readings, stale ones would bias towards 0
+	if (!cells_updated) {
+		return;
+	}
+
+	voltage_imbalance_uv += ((int64_t)(cell_max_mv - cell_min_mv) * 1000 - voltage_imbalance_uv) *
+				(1000 - IMBALANCE_FILTER_PERMILLE) / 1000;
+
+	/*
+	 * The gauge samples the current together with the cell voltages, so both
+	 * belong to the same instant. On mains the charger regulates cell voltage
+	 * in CV phase, current steps there are a consequence rather than a cause.
+	 */
+	on_battery = power_path_is_running_on_battery();
+	if (on_battery) {
+		// Gauge reports discharge current as negative
+		current_ma = -battery.values[BATTERY_CURRENT_MA];
+	}
+
+	if (on_battery && previous_valid) {
+		for (i = 0; i < CELL_MONITOR_NUM_CELLS; i++) {
+			// Cell voltage drops as discharge current rises
+			if (resistance_estimator_add_step(&estimators[i], current_ma - previous_current_ma,
+							  previous_cell_mv[i] - battery.values[cell_params[i]])) {
+				ESP_LOGD(TAG, "Cell %d: %d mA step, estimate %u mOhm", i + 1,
+					 current_ma - previous_current_ma,
+					 resistance_estimator_get_resistance_mohm(&estimators[i]));
+			}
+		}
+	}
+
+	previous_valid = on_battery;
+	previous_current_ma = current_ma;
+	for (i = 0; i < CELL_MONITOR_NUM_CELLS; i++) {
+		previous_cell_mv[i] = battery.values[cell_params[i]];
+	}
+
+	publish_estimate();
+}
+
+void cell_monitor_init(void) {
+	int i;
+
+	seqlock_init(&estimate_lock);
+	for (i = 0; i < CELL_MONITOR_NUM_CELLS; i++) {
+		resistance_estimator_init(&estimators[i], &resistance_estimator_cfg);
+	}
+
+	event_bus_subscribe(&battery_gauge_event_handler, "battery_gauge", on_battery_gauge_event, NULL);
+}
+
+void cell_monitor_get_estimate(cell_monitor_estimate_t *estimate_) {
+	uint32_t sequence;
+
+	do {
+		sequence = seqlock_read_begin(&estimate_lock);
+		*estimate_ = estimate;
+	} while (seqlock_read_retry(&estimate_lock, sequence));
+}
+
+static unsigned int get_num_values(prometheus_metric_t *metric) {
+	return CELL_MONITOR_NUM_CELLS;
+}
+
+static unsigned int get_num_labels(const prometheus_metric_value_t *val, prometheus_metric_t *metric) {
+	return 1;
+}
+
+static void get_label(const prometheus_metric_value_t *val, prometheus_metric_t *metric, unsigned int index, char *label, char *value) {
+	strcpy(label, "cell");
+	sprintf(value, "%u", (unsigned int)val->priv + 1);
+}
+
+static void get_resistance(const prometheus_metric_value_t *val, prometheus_metric_t *metric, char *value) {
+	cell_monitor_estimate_t estimate_;
+
+	cell_monitor_get_estimate(&estimate_);
+	sprintf(value, "%f", estimate_.cells[(unsigned int)val->priv].resistance_mohm / 1000.f);
+}
+
+static void get_confidence(const prometheus_metric_value_t *val, prometheus_metric_t *metric, char *value) {
+	cell_monitor_estimate_t estimate_;
+
+	cell_monitor_get_estimate(&estimate_);
+	sprintf(value, "%f", estimate_.cells[(unsigned int)val->priv].confidence_percent / 100.f);
+}
+
+static void get_resistance_value(prometheus_metric_t *metric, unsigned int index, prometheus_metric_value_t *value) {
+	value->priv = (void *)index;
+	value->get_num_labels = get_num_labels;
+	value->get_label = get_label;
+	value->get_value = get_resistance;
+}
+
+static void get_confidence_value(prometheus_metric_t *metric, unsigned int index, prometheus_metric_value_t *value) {
+	value->priv = (void *)index;
+	value->get_num_labels = get_num_labels;
+	value->get_label = get_label;
+	value->get_value = get_confidence;
+}
+
+static const prometheus_metric_def_t resistance_metric_def = {
+	.name = "battery_cell_resistance_ohms",
+	.help = "Passively estimated cell impedance from output load steps",
+	.type = PROMETHEUS_METRIC_TYPE_GAUGE,
+	.num_values = 0,
+	.get_num_values = get_num_values,
+	.get_value = get_resistance_value,
+};
+
+static const prometheus_metric_def_t confidence_metric_def = {
+	.name = "battery_cell_resistance_confidence",
+	.help = "Confidence of the passive cell impedance estimate from 0 to 1",
+	.type = PROMETHEUS_METRIC_TYPE_GAUGE,
+	.num_values = 0,
+	.get_num_values = get_num_values,
+	.get_value = get_confidence_value,
+};
+
+static void get_voltage_imbalance(const prometheus_metric_value_t *val, prometheus_metric_t *metric, char *value) {
+	cell_monitor_estimate_t estimate_;
+
+	cell_monitor_get_estimate(&estimate_);
+	sprintf(value, "%f", estimate_.voltage_imbalance_mv / 1000.f);
+}
+
+static void get_resistance_imbalance(const prometheus_metric_value_t *val, prometheus_metric_t *metric, char *value) {
+	cell_monitor_estimate_t estimate_;
+
+	cell_monitor_get_estimate(&estimate_);
+	sprintf(value, "%f", estimate_.resistance_imbalance_percent / 100.f);
+}
+
+static const prometheus_metric_value_t voltage_imbalance_value = {
+	.num_labels = 0,
+	.get_num_labels = NULL,
+	.get_value = get_voltage_imbalance,
+};
+
+static const prometheus_metric_def_t voltage_imbalance_metric_def = {
+	.name = "battery_cell_voltage_imbalance_volts",
+	.help = "Smoothed voltage difference between highest and lowest cell",
+	.type = PROMETHEUS_METRIC_TYPE_GAUGE,
+	.values = &voltage_imbalance_value,
+	.num_values = 1,
+	.get_num_values = NULL,
+};
+
+static const prometheus_metric_value_t resistance_imbalance_value = {
+	.num_labels = 0,
+	.get_num_labels = NULL,
+	.get_value = get_resistance_imbalance,
+};
+
+static const prometheus_metric_def_t resistance_imbalance_metric_def = {
+	.name = "battery_cell_resistance_imbalance_ratio",
+	.help = "Cell impedance difference relative to the higher impedance, 0 until both estimates are confident",
+	.type = PROMETHEUS_METRIC_TYPE_GAUGE,
+	.values = &resistance_imbalance_value,
+	.num_values = 1,
+	.get_num_values = NULL,
+};
+
+void cell_monitor_install_metrics(prometheus_t *prometheus) {
+	prometheus_metric_init(&resistance_metric, &resistance_metric_def, NULL);
+	prometheus_add_metric(prometheus, &resistance_metric);
+	prometheus_metric_init(&confidence_metric, &confidence_metric_def, NULL);
+	prometheus_add_metric(prometheus, &confidence_metric);
+	prometheus_metric_init(&voltage_imbalance_metric, &voltage_imbalance_metric_def, NULL);
+	prometheus_add_metric(prometheus, &voltage_imbalance_metric);
+	prometheus_metric_init(&resistance_imbalance_metric, &resistance_imbalance_metric_def, NULL);
+	prometheus_add_metric(prometheus, &resistance_imbalance_metric);
+}
@@ -0,0 +1,26 @@
+#pragma once
+
+#include "prometheus.h"
+
+#define CELL_MONITOR_NUM_CELLS	2
+
+typedef struct cell_monitor_cell_estimate {
+	unsigned int resistance_mohm;
+	unsigned int confidence_percent;
+} cell_monitor_cell_estimate_t;
+
+typedef struct cell_monitor_estimate {
+	cell_monitor_cell_estimate_t cells[CELL_MONITOR_NUM_CELLS];
+	// Smoothed voltage difference between highest and lowest cell
+	unsigned int voltage_imbalance_mv;
+	// Resistance difference relative to the higher resistance, 0 if not confident
+	unsigned int resistance_imbalance_percent;
+} cell_monitor_estimate_t;
+
+/*
+ * Passive per-cell impedance and imbalance estimation from natural output
+ * load steps while running on battery.
+ */
+void cell_monitor_init(void);
+void cell_monitor_get_estimate(cell_monitor_estimate_t *estimate);
+void cell_monitor_install_metrics(prometheus_t *prometheus);
@@ -0,0 +1,46 @@
+#include "charge_controller.h"
+
+#include "util.h"
+
+void charge_controller_init(charge_controller_t *ctrl, const charge_controller_cfg_t *cfg) {
+	ctrl->cfg = *cfg;
+	charge_controller_reset(ctrl, 0);
+}
+
+void charge_controller_reset(charge_controller_t *ctrl, unsigned int initial_output_ma) {
+	initial_output_ma = MIN(initial_output_ma, ctrl->cfg.max_output_ma);
+	ctrl->integral_uma = (int64_t)initial_output_ma * 1000;
+	ctrl->output_ma = initial_output_ma;
+	ctrl->saturated = false;
+}
+
+void charge_controller_set_max_output(charge_controller_t *ctrl, unsigned int max_output_ma) {
+	ctrl->cfg.max_output_ma = max_output_ma;
+}
+
+unsigned int charge_controller_update(charge_controller_t *ctrl, int setpoint_ma, int measured_ma, unsigned int dt_us) {
+	int64_t max_output_uma = (int64_t)ctrl->cfg.max_output_ma * 1000;
+	int64_t error_ma = setpoint_ma - measured_ma;
+	int64_t proportional_uma = error_ma * ctrl->cfg.kp_milli;
+	int64_t integral_step_uma = error_ma * ctrl->cfg.ki_milli_per_s * dt_us / 1000000LL;
+	int64_t integral_uma = ctrl->integral_uma + integral_step_uma;
+	int64_t output_uma;
+
+	/*
+	 * Anti-windup: only integrate if doing so does not push the output
+	 * further into saturation, additionally bound the integrator itself.
+	 */
+	output_uma = proportional_uma + integral_uma;
+	if ((output_uma > max_output_uma && integral_step_uma > 0) ||
+	    (output_uma < 0 && integral_step_uma < 0)) {
+		integral_uma = ctrl->integral_uma;
+	}
+	ctrl->integral_uma = CLAMP(integral_uma, -max_output_uma, max_output_uma);
+
+	output_uma = proportional_uma + ctrl->integral_uma;
+	ctrl->saturated = output_uma < 0 || output_uma > max_output_uma;
+	output_uma = CLAMP(output_uma, 0, max_output_uma);
+
+	ctrl->output_ma = output_uma / 1000;
+	return ctrl->output_ma;
+}
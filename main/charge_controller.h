@@ -0,0 +1,34 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * PI controller regulating charge current such that the measured input
+ * current tracks a setpoint below the input current limit. The output is
+ * clamped to [0, max_output_ma], the integrator does not accumulate further
+ * into either clamp.
+ *
+ * Gains are given in 1/1000 (mA charge current per mA input current error
+ * for kp, the same per second for ki).
+ */
+typedef struct charge_controller_cfg {
+	int32_t kp_milli;
+	int32_t ki_milli_per_s;
+	unsigned int max_output_ma;
+} charge_controller_cfg_t;
+
+typedef struct charge_controller {
+	charge_controller_cfg_t cfg;
+
+	// Managed properties
+	int64_t integral_uma;
+	unsigned int output_ma;
+	bool saturated;
+} charge_controller_t;
+
+void charge_controller_init(charge_controller_t *ctrl, const charge_controller_cfg_t *cfg);
+// Preloads the integrator for a bumpless start from an open-loop estimate
+void charge_controller_reset(charge_controller_t *ctrl, unsigned int initial_output_ma);
+void charge_controller_set_max_output(charge_controller_t *ctrl, unsigned int max_output_ma);
+unsigned int charge_controller_update(charge_controller_t *ctrl, int setpoint_ma, int measured_ma, unsigned int dt_us);
@@ -0,0 +1,42 @@
+#include "charge_profile.h"
+
+#include "util.h"
+
+int32_t charge_profile_curve_eval(const charge_profile_curve_t *curve, int32_t x) {
+	const charge_profile_point_t *points = curve->points;
+	unsigned int i;
+
+	if (x <= points[0].x) {
+		return points[0].y;
+	}
+
+	for (i = 1; i < curve->num_points; i++) {
+		const charge_profile_point_t *left = &points[i - 1];
+		const charge_profile_point_t *right = &points[i];
+
+		if (x <= right->x) {
+			return left->y + (int64_t)(right->y - left->y) * (x - left->x) / (right->x - left->x);
+		}
+	}
+
+	return points[curve->num_points - 1].y;
+}
+
+unsigned int charge_profile_get_current_ma(const charge_profile_t *profile, const charge_profile_inputs_t *inputs) {
+	unsigned int capacity_mah = COALESCE(inputs->full_charge_capacity_mah, profile->fallback_capacity_mah);
+	int32_t rate_milli_c = charge_profile_curve_eval(&profile->pack_temperature_rate, inputs->pack_temperature_mdegc);
+	int32_t percent = 100;
+	int64_t current_ma;
+
+	percent = MIN(percent, charge_profile_curve_eval(&profile->charger_temperature_derating,
+							 inputs->charger_temperature_mdegc));
+	percent = MIN(percent, charge_profile_curve_eval(&profile->cell_voltage_taper, inputs->max_cell_voltage_mv));
+	percent = MIN(percent, charge_profile_curve_eval(&profile->soc_taper, inputs->soc_percent));
+	percent = MAX(percent, 0);
+	rate_milli_c = MAX(rate_milli_c, 0);
+
+	current_ma = (int64_t)capacity_mah * rate_milli_c / 1000;
+	current_ma = MIN(current_ma, profile->max_current_ma);
+
+	return current_ma * percent / 100;
+}
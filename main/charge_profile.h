@@ -0,0 +1,49 @@
+#pragma once
+
+#include <stdint.h>
+
+/*
+ * Data driven charge current profile. The pack temperature curve gives a
+ * charge rate, scaled by capacity and capped at max_current_ma; the most
+ * restrictive of the derating curves then reduces it further.
+ *
+ * Each curve is a piecewise linear function given by points sorted by x.
+ * Values outside the curve are clamped to the first/last point.
+ */
+typedef struct charge_profile_point {
+	int32_t x;
+	int32_t y;
+} charge_profile_point_t;
+
+typedef struct charge_profile_curve {
+	const charge_profile_point_t *points;
+	unsigned int num_points;
+} charge_profile_curve_t;
+
+typedef struct charge_profile {
+	// Pack temperature in mdeg C to charge rate in 1/1000 C
+	charge_profile_curve_t pack_temperature_rate;
+	// Charger temperature in mdeg C to percentage of charge current
+	charge_profile_curve_t charger_temperature_derating;
+	// Highest cell voltage in mV to percentage of charge current
+	charge_profile_curve_t cell_voltage_taper;
+	// State of charge in percent to percentage of charge current
+	charge_profile_curve_t soc_taper;
+	// Used if the gauge does not know the full charge capacity yet
+	unsigned int fallback_capacity_mah;
+	unsigned int max_current_ma;
+} charge_profile_t;
+
+typedef struct charge_profile_inputs {
+	int32_t pack_temperature_mdegc;
+	int32_t charger_temperature_mdegc;
+	unsigned int max_cell_voltage_mv;
+	unsigned int soc_percent;
+	unsigned int full_charge_capacity_mah;
+} charge_profile_inputs_t;
+
+// Profile for the pack fitted to the UPS, see charge_profile_default.c
+extern const charge_profile_t charge_profile_default;
+
+int32_t charge_profile_curve_eval(const charge_profile_curve_t *curve, int32_t x);
+unsigned int charge_profile_get_current_ma(const charge_profile_t *profile, const charge_profile_inputs_t *inputs);
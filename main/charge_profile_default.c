@@ -0,0 +1,45 @@
+#include "charge_profile.h"
+
+#include "util.h"
+
+// 2S 18650 pack, rated for 1 A standard charge
+#define MAX_CHARGE_CURRENT_MA		1024
+#define FALLBACK_CAPACITY_MAH		2000
+
+// No charging below 0 deg C or above 55 deg C, 0.5 C between 15 and 45 deg C
+static const charge_profile_point_t pack_temperature_rate_points[] = {
+	{     0,   0 },
+	{  2000, 100 },
+	{ 10000, 300 },
+	{ 15000, 500 },
+	{ 45000, 500 },
+	{ 50000, 250 },
+	{ 55000,   0 },
+};
+
+static const charge_profile_point_t charger_temperature_derating_points[] = {
+	{ 70000, 100 },
+	{ 85000,  50 },
+	{ 95000,   0 },
+};
+
+// Soft taper ahead of the chargers CV phase
+static const charge_profile_point_t cell_voltage_taper_points[] = {
+	{ 4050, 100 },
+	{ 4150,  50 },
+	{ 4200,  10 },
+};
+
+static const charge_profile_point_t soc_taper_points[] = {
+	{  85, 100 },
+	{ 100,  25 },
+};
+
+const charge_profile_t charge_profile_default = {
+	.pack_temperature_rate = { pack_temperature_rate_points, ARRAY_SIZE(pack_temperature_rate_points) },
+	.charger_temperature_derating = { charger_temperature_derating_points, ARRAY_SIZE(charger_temperature_derating_points) },
+	.cell_voltage_taper = { cell_voltage_taper_points, ARRAY_SIZE(cell_voltage_taper_points) },
+	.soc_taper = { soc_taper_points, ARRAY_SIZE(soc_taper_points) },
+	.fallback_capacity_mah = FALLBACK_CAPACITY_MAH,
+	.max_current_ma = MAX_CHARGE_CURRENT_MA,
+};
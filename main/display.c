@@ -2,6 +2,8 @@
 
 #include <stddef.h>
 #include <stdint.h>
+#include <stdio.h>
+#include <string.h>
 
 #include <freertos/FreeRTOS.h>
 #include <freertos/semphr.h>
@@ -9,6 +11,7 @@
 
 #include <esp_err.h>
 #include <esp_log.h>
+#include <esp_timer.h>
 
 #include "buttons.h"
 #include "display_bms.h"
@@ -22,13 +25,18 @@
 #include "gui.h"
 #include "power_path.h"
 #include "scheduler.h"
+#include "seqlock.h"
+#include "settings.h"
 #include "ssd1306_oled.h"
+#include "util.h"
 
 #define DISPLAY_I2C_ADDRESS	0x3c
 #define GPIO_OLED_RESET		23
 
 #define SCREENSAVER_TIMEOUT_MS	30000
 
+#define FPS_WINDOW_US		1000000LL
+
 typedef enum display_screen_type {
 	DISPLAY_SCREEN_BMS,
 	DISPLAY_SCREEN_POWER,
@@ -51,6 +59,9 @@ static bool showing_screensaver = false;
 static scheduler_task_t screensaver_timeout_task;
 
 static gui_label_t title_label;
+// Title applied by the renderer at the start of the next frame, NULL hides it
+static const char *pending_title;
+static gui_update_t title_update;
 
 static ssd1306_oled_t oled;
 static bool display_initialized = false;
@@ -59,9 +70,34 @@ static gui_t gui;
 
 static TaskHandle_t render_task = NULL;
 
-static uint8_t gui_render_fb[64 * 48];
 static fb_t display_fb;
 
+static unsigned int max_fps;
+
+typedef struct display_stats {
+	uint64_t frames;
+	uint64_t render_us;
+	uint64_t transfer_us;
+	uint64_t transfer_bytes;
+	unsigned int render_last_us;
+	unsigned int render_max_us;
+	unsigned int transfer_last_us;
+	unsigned int transfer_max_us;
+	// Frame rate over the last completed window and the window in progress
+	float window_fps;
+	int64_t window_start_us;
+	unsigned int window_frames;
+} display_stats_t;
+
+static display_stats_t stats = { 0 };
+static seqlock_t stats_lock;
+
+static prometheus_metric_t frames_metric;
+static prometheus_metric_t fps_metric;
+static prometheus_metric_t frame_time_total_metric;
+static prometheus_metric_t frame_time_metric;
+static prometheus_metric_t transfer_bytes_metric;
+
 button_event_handler_t button_event_handler;
 event_bus_handler_t power_source_event_handler;
 
@@ -75,20 +111,31 @@ const gui_ops_t gui_ops = {
 	.request_render = gui_request_render
 };
 
-static void show_screen(const display_screen_t *screen) {
-	if (screen->name) {
-		gui_label_set_text(&title_label, screen->name);
+static void apply_title_update(gui_update_t *update) {
+	if (pending_title) {
+		gui_label_set_text(&title_label, pending_title);
 		gui_element_set_hidden(&title_label.element, false);
 		gui_element_show(&title_label.element);
 	} else {
 		gui_element_set_hidden(&title_label.element, true);
 	}
+}
+
+/*
+ * Screen switches run from button, scheduler and event bus context. They
+ * must not touch the GUI tree directly, title and screens queue updates
+ * applied by the renderer instead.
+ */
+static void show_screen(const display_screen_t *screen) {
+	gui_update_lock(&gui);
+	pending_title = screen->name;
+	gui_update_queue(&gui, &title_update);
+	gui_update_unlock(&gui);
 	screen->show();
 	active_screen = screen;
 }
 
 static void hide_screen(const display_screen_t *screen) {
-	gui_element_set_hidden(&title_label.element, false);
 	screen->hide();
 	active_screen = NULL;
 }
@@ -168,6 +215,8 @@ void display_init(i2c_bus_t *display_bus) {
 	esp_err_t err;
 
 	lock = xSemaphoreCreateMutexStatic(&lock_buffer);
+	seqlock_init(&stats_lock);
+	max_fps = CLAMP(settings_get_display_max_fps(), 1, DISPLAY_MAX_FPS_LIMIT);
 
 	err = ssd1306_oled_init(&oled, display_bus, DISPLAY_I2C_ADDRESS, GPIO_OLED_RESET);
 	if (err) {
@@ -186,6 +235,7 @@ void display_init(i2c_bus_t *display_bus) {
 	gui_element_set_size(&title_label.element, 64, 5);
 	gui_element_set_hidden(&title_label.element, true);
 	gui_element_add_child(&gui.container.element, &title_label.element);
+	gui_update_init(&title_update, apply_title_update);
 
 	screen_screensaver = display_screensaver_init(&gui);
 	screen_on_battery = display_on_battery_init(&gui);
@@ -198,18 +248,49 @@ void display_init(i2c_bus_t *display_bus) {
 	scheduler_task_init(&screensaver_timeout_task);
 }
 
-static void grayscale_to_monochrome(fb_t *display_fb, const uint8_t *gui_fb) {
-	unsigned int x, y;
+void display_set_max_fps(unsigned int fps) {
+	fps = CLAMP(fps, 1, DISPLAY_MAX_FPS_LIMIT);
+	max_fps = fps;
+	settings_set_display_max_fps(fps);
+}
 
-	for (y = 0; y < 48; y++) {
-		for (x = 0; x < 64; x++) {
-			fb_set_pixel(display_fb, x, y, !!gui_fb[y * 64 + x]);
-		}
+unsigned int display_get_max_fps(void) {
+	return max_fps;
+}
+
+static void update_stats(int64_t frame_start_us, unsigned int render_us, unsigned int transfer_us, unsigned int bytes_sent, bool frame_sent) {
+	seqlock_write_begin(&stats_lock);
+	stats.render_us += render_us;
+	stats.render_last_us = render_us;
+	stats.render_max_us = MAX(stats.render_max_us, render_us);
+	if (frame_sent) {
+		stats.frames++;
+		stats.transfer_us += transfer_us;
+		stats.transfer_bytes += bytes_sent;
+		stats.transfer_last_us = transfer_us;
+		stats.transfer_max_us = MAX(stats.transfer_max_us, transfer_us);
+		stats.window_frames++;
+	}
+	if (frame_start_us - stats.window_start_us >= FPS_WINDOW_US) {
+		stats.window_fps = stats.window_frames * 1000000.f / (frame_start_us - stats.window_start_us);
+		stats.window_start_us = frame_start_us;
+		stats.window_frames = 0;
 	}
+	seqlock_write_end(&stats_lock);
+}
+
+static void get_stats(display_stats_t *snapshot) {
+	uint32_t sequence;
+
+	do {
+		sequence = seqlock_read_begin(&stats_lock);
+		*snapshot = stats;
+	} while (seqlock_read_retry(&stats_lock, sequence));
 }
 
 void display_render_loop() {
 	int render_ret = 0;
+	int64_t last_frame_us = 0;
 
 	render_task = xTaskGetCurrentTaskHandle();
 
@@ -222,21 +303,310 @@ void display_render_loop() {
 			64,
 			48
 		};
+		gui_damage_t damage;
+		int64_t frame_interval_us = 1000000LL / max_fps;
+		int64_t frame_start_us, render_end_us, transfer_end_us;
+		unsigned int bytes_sent = 0;
+		int64_t now;
 
 		if (render_ret < 0) {
 			ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
-		} else if (!render_ret) {
-			ulTaskNotifyTake(pdTRUE, 0);
-		} else {
-			ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(render_ret));
+		} else if (render_ret > 0) {
+			// Round up, waking before the next animation step yields an empty frame
+			ulTaskNotifyTake(pdTRUE, DIV_ROUND_UP(render_ret, portTICK_PERIOD_MS));
 		}
+
+		// Wait for the next frame slot, invalidations arriving meanwhile end up in the same frame
+		now = esp_timer_get_time();
+		if (now < last_frame_us + frame_interval_us) {
+			vTaskDelay(MAX(pdMS_TO_TICKS(DIV_ROUND_UP(last_frame_us + frame_interval_us - now, 1000)), 1));
+		}
+		ulTaskNotifyTake(pdTRUE, 0);
+
+		frame_start_us = esp_timer_get_time();
+		last_frame_us = frame_start_us;
+		// Screens only take the update lock, queued updates are applied at the start of gui_render
 		gui_lock(&gui);
-		render_ret = gui_render(&gui, gui_render_fb, 64, &render_size);
+		// GUI renders straight into the display layout
+		render_ret = gui_render(&gui, display_fb.data, fb_width(&display_fb), &render_size, &damage);
 		gui_unlock(&gui);
+		render_end_us = esp_timer_get_time();
+
+		if (display_initialized && damage.num_areas) {
+			esp_err_t err = ssd1306_oled_render_fb(&oled, &display_fb, &bytes_sent);
+
+			if (err) {
+				ESP_LOGW(TAG, "Failed to update display: %d", err);
+			} else {
+				ESP_LOGD(TAG, "Display update sent %u bytes", bytes_sent);
+			}
+		}
+		transfer_end_us = esp_timer_get_time();
+
+		update_stats(frame_start_us, render_end_us - frame_start_us, transfer_end_us - render_end_us,
+			     bytes_sent, display_initialized && damage.num_areas);
+	}
+}
+
+static void get_frames(const prometheus_metric_value_t *val, prometheus_metric_t *metric, char *value) {
+	display_stats_t snapshot;
+
+	get_stats(&snapshot);
+	sprintf(value, "%llu", (unsigned long long)snapshot.frames);
+}
+
+static const prometheus_metric_value_t frames_values[] = {
+	{
+		.num_labels = 0,
+		.labels = NULL,
+		.get_num_labels = NULL,
+		.get_value = get_frames,
+	},
+};
+
+static const prometheus_metric_def_t frames_metric_def = {
+	.name = "display_frames_total",
+	.help = "Number of frames sent to the display",
+	.type = PROMETHEUS_METRIC_TYPE_COUNTER,
+	.values = frames_values,
+	.num_values = ARRAY_SIZE(frames_values),
+	.get_num_values = NULL,
+};
+
+static void get_fps(const prometheus_metric_value_t *val, prometheus_metric_t *metric, char *value) {
+	display_stats_t snapshot;
+	int64_t window_us;
+	float fps;
+
+	get_stats(&snapshot);
+	window_us = esp_timer_get_time() - snapshot.window_start_us;
+	if (window_us >= FPS_WINDOW_US) {
+		// No frame closed the window, display is idle
+		fps = snapshot.window_frames * 1000000.f / window_us;
+	} else {
+		fps = snapshot.window_fps;
+	}
+	sprintf(value, "%f", fps);
+}
+
+static const prometheus_metric_value_t fps_values[] = {
+	{
+		.num_labels = 0,
+		.labels = NULL,
+		.get_num_labels = NULL,
+		.get_value = get_fps,
+	},
+};
+
+static const prometheus_metric_def_t fps_metric_def = {
+	.name = "display_frames_per_second",
+	.help = "Frames sent to the display per second",
+	.type = PROMETHEUS_METRIC_TYPE_GAUGE,
+	.values = fps_values,
+	.num_values = ARRAY_SIZE(fps_values),
+	.get_num_values = NULL,
+};
+
+static const prometheus_label_t stage_render_labels[] = {
+	{ "stage", "render" },
+};
+
+static const prometheus_label_t stage_transfer_labels[] = {
+	{ "stage", "transfer" },
+};
+
+static void get_render_time_total(const prometheus_metric_value_t *val, prometheus_metric_t *metric, char *value) {
+	display_stats_t snapshot;
+
+	get_stats(&snapshot);
+	sprintf(value, "%f", snapshot.render_us / 1000000.f);
+}
+
+static void get_transfer_time_total(const prometheus_metric_value_t *val, prometheus_metric_t *metric, char *value) {
+	display_stats_t snapshot;
 
-		if (display_initialized) {
-			grayscale_to_monochrome(&display_fb, gui_render_fb);
-			ssd1306_oled_render_fb(&oled, &display_fb);
+	get_stats(&snapshot);
+	sprintf(value, "%f", snapshot.transfer_us / 1000000.f);
+}
+
+static const prometheus_metric_value_t frame_time_total_values[] = {
+	{
+		.num_labels = ARRAY_SIZE(stage_render_labels),
+		.labels = stage_render_labels,
+		.get_num_labels = NULL,
+		.get_value = get_render_time_total,
+	},
+	{
+		.num_labels = ARRAY_SIZE(stage_transfer_labels),
+		.labels = stage_transfer_labels,
+		.get_num_labels = NULL,
+		.get_value = get_transfer_time_total,
+	},
+};
+
+static const prometheus_metric_def_t frame_time_total_metric_def = {
+	.name = "display_frame_time_seconds_total",
+	.help = "Time spent rendering the GUI and transferring frames to the display",
+	.type = PROMETHEUS_METRIC_TYPE_COUNTER,
+	.values = frame_time_total_values,
+	.num_values = ARRAY_SIZE(frame_time_total_values),
+	.get_num_values = NULL,
+};
+
+static const prometheus_label_t render_last_labels[] = {
+	{ "stage", "render" },
+	{ "stat", "last" },
+};
+
+static const prometheus_label_t render_max_labels[] = {
+	{ "stage", "render" },
+	{ "stat", "max" },
+};
+
+static const prometheus_label_t transfer_last_labels[] = {
+	{ "stage", "transfer" },
+	{ "stat", "last" },
+};
+
+static const prometheus_label_t transfer_max_labels[] = {
+	{ "stage", "transfer" },
+	{ "stat", "max" },
+};
+
+static void get_render_time_last(const prometheus_metric_value_t *val, prometheus_metric_t *metric, char *value) {
+	display_stats_t snapshot;
+
+	get_stats(&snapshot);
+	sprintf(value, "%f", snapshot.render_last_us / 1000000.f);
+}
+
+static void get_render_time_max(const prometheus_metric_value_t *val, prometheus_metric_t *metric, char *value) {
+	display_stats_t snapshot;
+
+	get_stats(&snapshot);
+	sprintf(value, "%f", snapshot.render_max_us / 1000000.f);
+}
+
+static void get_transfer_time_last(const prometheus_metric_value_t *val, prometheus_metric_t *metric, char *value) {
+	display_stats_t snapshot;
+
+	get_stats(&snapshot);
+	sprintf(value, "%f", snapshot.transfer_last_us / 1000000.f);
+}
+
+static void get_transfer_time_max(const prometheus_metric_value_t *val, prometheus_metric_t *metric, char *value) {
+	display_stats_t snapshot;
+
+	get_stats(&snapshot);
+	sprintf(value, "%f", snapshot.transfer_max_us / 1000000.f);
+}
+
+static const prometheus_metric_value_t frame_time_values[] = {
+	{
+		.num_labels = ARRAY_SIZE(render_last_labels),
+		.labels = render_last_labels,
+		.get_num_labels = NULL,
+		.get_value = get_render_time_last,
+	},
+	{
+		.num_labels = ARRAY_SIZE(render_max_labels),
+		.labels = render_max_labels,
+		.get_num_labels = NULL,
+		.get_value = get_render_time_max,
+	},
+	{
+		.num_labels = ARRAY_SIZE(transfer_last_labels),
+		.labels = transfer_last_labels,
+		.get_num_labels = NULL,
+		.get_value = get_transfer_time_last,
+	},
+	{
+		.num_labels = ARRAY_SIZE(transfer_max_labels),
+		.labels = transfer_max_labels,
+		.get_num_labels = NULL,
+		.get_value = get_transfer_time_max,
+	},
+};
+
+static const prometheus_metric_def_t frame_time_metric_def = {
+	.name = "display_frame_time_seconds",
+	.help = "Time spent rendering the GUI and transferring a single frame to the display",
+	.type = PROMETHEUS_METRIC_TYPE_GAUGE,
+	.values = frame_time_values,
+	.num_values = ARRAY_SIZE(frame_time_values),
+	.get_num_values = NULL,
+};
+
+static void get_transfer_bytes(const prometheus_metric_value_t *val, prometheus_metric_t *metric, char *value) {
+	display_stats_t snapshot;
+
+	get_stats(&snapshot);
+	sprintf(value, "%llu", (unsigned long long)snapshot.transfer_bytes);
+}
+
+static const prometheus_metric_value_t transfer_bytes_values[] = {
+	{
+		.num_labels = 0,
+		.labels = NULL,
+		.get_num_labels = NULL,
+		.get_value = get_transfer_bytes,
+	},
+};
+
+static const prometheus_metric_def_t transfer_bytes_metric_def = {
+	.name = "display_transfer_bytes_total",
+	.help = "Bytes sent to the display over I2C",
+	.type = PROMETHEUS_METRIC_TYPE_COUNTER,
+	.values = transfer_bytes_values,
+	.num_values = ARRAY_SIZE(transfer_bytes_values),
+	.get_num_values = NULL,
+};
+
+/*
+ * Current frame as binary PBM. Lit OLED pixels are white, i.e. 0 in PBM.
+ * Used to capture reference images of the screens, see tools/display_screenshot.py.
+ */
+static esp_err_t http_get_screenshot(struct httpd_request_ctx* ctx, void* priv) {
+	fb_t snapshot;
+	char header[32];
+	uint8_t row[DIV_ROUND_UP(64, 8)];
+	unsigned int x, y;
+
+	// Frame is complete whenever the GUI is not locked
+	gui_lock(&gui);
+	snapshot = display_fb;
+	gui_unlock(&gui);
+
+	httpd_resp_set_type(ctx->req, "image/x-portable-bitmap");
+	snprintf(header, sizeof(header), "P4\n%u %u\n", fb_width(&snapshot), fb_height(&snapshot));
+	httpd_response_write_string(ctx, header);
+	for (y = 0; y < fb_height(&snapshot); y++) {
+		memset(row, 0, sizeof(row));
+		for (x = 0; x < fb_width(&snapshot); x++) {
+			if (!(snapshot.data[(y / 8) * fb_width(&snapshot) + x] & (1 << (y % 8)))) {
+				row[x / 8] |= 0x80 >> (x % 8);
+			}
 		}
+		httpd_response_write(ctx, (const char *)row, sizeof(row));
 	}
+
+	httpd_finalize_response(ctx);
+	return ESP_OK;
+}
+
+esp_err_t display_register_api(httpd_t *httpd, const char *path) {
+	return httpd_add_get_handler(httpd, path, http_get_screenshot, NULL, 0);
+}
+
+void display_install_metrics(prometheus_t *prometheus) {
+	prometheus_metric_init(&frames_metric, &frames_metric_def, NULL);
+	prometheus_add_metric(prometheus, &frames_metric);
+	prometheus_metric_init(&fps_metric, &fps_metric_def, NULL);
+	prometheus_add_metric(prometheus, &fps_metric);
+	prometheus_metric_init(&frame_time_total_metric, &frame_time_total_metric_def, NULL);
+	prometheus_add_metric(prometheus, &frame_time_total_metric);
+	prometheus_metric_init(&frame_time_metric, &frame_time_metric_def, NULL);
+	prometheus_add_metric(prometheus, &frame_time_metric);
+	prometheus_metric_init(&transfer_bytes_metric, &transfer_bytes_metric_def, NULL);
+	prometheus_add_metric(prometheus, &transfer_bytes_metric);
 }
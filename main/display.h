@@ -1,6 +1,12 @@
 #pragma once
 
+#include <esp_err.h>
+
+#include "httpd.h"
 #include "i2c_bus.h"
+#include "prometheus.h"
+
+#define DISPLAY_MAX_FPS_LIMIT	100
 
 typedef struct display_screen {
 	const char *name;
@@ -10,3 +16,7 @@ typedef struct display_screen {
 
 void display_init(i2c_bus_t *display_bus);
 void display_render_loop(void);
+void display_set_max_fps(unsigned int fps);
+unsigned int display_get_max_fps(void);
+void display_install_metrics(prometheus_t *prometheus);
+esp_err_t display_register_api(httpd_t *httpd, const char *path);
@@ -1,11 +1,16 @@
 #include "display_bms.h"
 
+#include <stdio.h>
+
 #include "event_bus.h"
 #include "battery_gauge.h"
 #include "scheduler.h"
 #include "util.h"
 
 static gui_container_t bms_container;
+// Static headings, rendered once into a cache
+static gui_container_t headings_container;
+static uint8_t headings_cache[GUI_CONTAINER_CACHE_SIZE(64, 48 - 8)];
 
 static gui_label_t soc_label;
 static gui_label_t soc_text_label;
@@ -35,55 +40,95 @@ static gui_label_t capacity_label;
 static gui_label_t capacity_text_label;
 static char capacity_text[10];
 
+typedef struct bms_values {
+	unsigned int soc;
+	unsigned int soh;
+	long temp;
+	unsigned int cell1;
+	unsigned int cell2;
+	long current;
+	unsigned int capacity;
+} bms_values_t;
+
+// Written by updaters, applied by the renderer at the start of the next frame
+static bms_values_t pending_values;
+static gui_update_t ui_update;
+static bool pending_shown;
+static gui_update_t visibility_update;
+
 static event_bus_handler_t battery_gauge_event_handler;
 
 static gui_t *gui;
 
-static void update_ui(void) {
-	unsigned int soc = battery_gauge_get_soc_percent();
-	unsigned int soh = battery_gauge_get_soh_percent();
-	long temp = battery_gauge_get_temperature_mdegc();
-	unsigned int cell1 = battery_gauge_get_cell1_voltage_mv();
-	unsigned int cell2 = battery_gauge_get_cell2_voltage_mv();
-	long current = battery_gauge_get_current_ma();
-	unsigned int capacity = battery_gauge_get_full_charge_capacity_mah();
-
-	gui_lock(gui);
-	snprintf(soc_text, sizeof(soc_text), "%u%%", soc);
+static void apply_ui_update(gui_update_t *update) {
+	const bms_values_t *values = &pending_values;
+
+	snprintf(soc_text, sizeof(soc_text), "%u%%", values->soc);
 	gui_label_set_text(&soc_text_label, soc_text);
 
-	snprintf(soh_text, sizeof(soh_text), "%u%%", soh);
+	snprintf(soh_text, sizeof(soh_text), "%u%%", values->soh);
 	gui_label_set_text(&soh_text_label, soh_text);
 
-	snprintf(temp_text, sizeof(temp_text), "%dC", (int)DIV_ROUND(temp, 1000));
+	snprintf(temp_text, sizeof(temp_text), "%dC", (int)DIV_ROUND(values->temp, 1000));
 	gui_label_set_text(&temp_text_label, temp_text);
 
-	snprintf(cell1_text, sizeof(cell1_text), "%umV", cell1);
+	snprintf(cell1_text, sizeof(cell1_text), "%umV", values->cell1);
 	gui_label_set_text(&cell1_text_label, cell1_text);
 
-	snprintf(cell2_text, sizeof(cell2_text), "%umV", cell2);
+	snprintf(cell2_text, sizeof(cell2_text), "%umV", values->cell2);
 	gui_label_set_text(&cell2_text_label, cell2_text);
 
-	snprintf(current_text, sizeof(current_text), "%ldmA", current);
+	snprintf(current_text, sizeof(current_text), "%ldmA", values->current);
 	gui_label_set_text(&current_text_label, current_text);
 
-	snprintf(capacity_text, sizeof(capacity_text), "%umAh", capacity);
+	snprintf(capacity_text, sizeof(capacity_text), "%umAh", values->capacity);
 	gui_label_set_text(&capacity_text_label, capacity_text);
-	gui_unlock(gui);
+}
+
+static void update_ui(void) {
+	bms_values_t values = {
+		.soc = battery_gauge_get_soc_percent(),
+		.soh = battery_gauge_get_soh_percent(),
+		.temp = battery_gauge_get_temperature_mdegc(),
+		.cell1 = battery_gauge_get_cell1_voltage_mv(),
+		.cell2 = battery_gauge_get_cell2_voltage_mv(),
+		.current = battery_gauge_get_current_ma(),
+		.capacity = battery_gauge_get_full_charge_capacity_mah(),
+	};
+
+	gui_update_lock(gui);
+	pending_values = values;
+	gui_update_queue(gui, &ui_update);
+	gui_update_unlock(gui);
 }
 
 static void on_battery_gauge_event(void *priv, void *data) {
 	update_ui();
 }
 
+static void apply_visibility_update(gui_update_t *update) {
+	if (pending_shown) {
+		gui_element_set_hidden(&bms_container.element, false);
+		gui_element_show(&bms_container.element);
+	} else {
+		gui_element_set_hidden(&bms_container.element, true);
+	}
+}
+
+static void set_shown(bool shown) {
+	gui_update_lock(gui);
+	pending_shown = shown;
+	gui_update_queue(gui, &visibility_update);
+	gui_update_unlock(gui);
+}
+
 static void display_bms_show(void) {
 	update_ui();
-	gui_element_set_hidden(&bms_container.element, false);
-	gui_element_show(&bms_container.element);
+	set_shown(true);
 }
 
 static void display_bms_hide(void) {
-	gui_element_set_hidden(&bms_container.element, true);
+	set_shown(false);
 }
 
 static const display_screen_t bms_screen = {
@@ -102,6 +147,12 @@ const display_screen_t *display_bms_init(gui_t *gui_) {
 	gui_element_set_hidden(&bms_container.element, true);
 	gui_element_add_child(&gui->container.element, &bms_container.element);
 
+	// Headings, added first so values are drawn on top
+	gui_container_init(&headings_container);
+	gui_element_set_size(&headings_container.element, 64, 48 - 8);
+	gui_container_set_cache(&headings_container, headings_cache, sizeof(headings_cache));
+	gui_element_add_child(&bms_container.element, &headings_container.element);
+
 	// Row 1
 	// SoC
 	// SoC label
@@ -109,7 +160,7 @@ const display_screen_t *display_bms_init(gui_t *gui_) {
 	gui_label_set_text_alignment(&soc_label, GUI_TEXT_ALIGN_CENTER);
 	gui_element_set_size(&soc_label.element, 20, 5);
 	gui_element_set_position(&soc_label.element, 0, 0);
-	gui_element_add_child(&bms_container.element, &soc_label.element);
+	gui_element_add_child(&headings_container.element, &soc_label.element);
 
 	// SoC text
 	gui_label_init(&soc_text_label, "???%");
@@ -124,7 +175,7 @@ const display_screen_t *display_bms_init(gui_t *gui_) {
 	gui_label_set_text_alignment(&soh_label, GUI_TEXT_ALIGN_CENTER);
 	gui_element_set_size(&soh_label.element, 20, 5);
 	gui_element_set_position(&soh_label.element, 22, 0);
-	gui_element_add_child(&bms_container.element, &soh_label.element);
+	gui_element_add_child(&headings_container.element, &soh_label.element);
 
 	// SoH text
 	gui_label_init(&soh_text_label, "???%");
@@ -139,7 +190,7 @@ const display_screen_t *display_bms_init(gui_t *gui_) {
 	gui_label_set_text_alignment(&temp_label, GUI_TEXT_ALIGN_CENTER);
 	gui_element_set_size(&temp_label.element, 20, 5);
 	gui_element_set_position(&temp_label.element, 44, 0);
-	gui_element_add_child(&bms_container.element, &temp_label.element);
+	gui_element_add_child(&headings_container.element, &temp_label.element);
 
 	// Temp text
 	gui_label_init(&temp_text_label, "??C");
@@ -155,7 +206,7 @@ const display_screen_t *display_bms_init(gui_t *gui_) {
 	gui_label_set_text_alignment(&cell1_label, GUI_TEXT_ALIGN_CENTER);
 	gui_element_set_size(&cell1_label.element, 32, 5);
 	gui_element_set_position(&cell1_label.element, 0, 14);
-	gui_element_add_child(&bms_container.element, &cell1_label.element);
+	gui_element_add_child(&headings_container.element, &cell1_label.element);
 
 	// Cell 1 text
 	gui_label_init(&cell1_text_label, "????mV");
@@ -170,7 +221,7 @@ const display_screen_t *display_bms_init(gui_t *gui_) {
 	gui_label_set_text_alignment(&cell2_label, GUI_TEXT_ALIGN_CENTER);
 	gui_element_set_size(&cell2_label.element, 32, 5);
 	gui_element_set_position(&cell2_label.element, 32, 14);
-	gui_element_add_child(&bms_container.element, &cell2_label.element);
+	gui_element_add_child(&headings_container.element, &cell2_label.element);
 
 	// Cell 2 text
 	gui_label_init(&cell2_text_label, "????mV");
@@ -186,7 +237,7 @@ const display_screen_t *display_bms_init(gui_t *gui_) {
 	gui_label_set_text_alignment(&current_label, GUI_TEXT_ALIGN_CENTER);
 	gui_element_set_size(&current_label.element, 32, 5);
 	gui_element_set_position(&current_label.element, 0, 28);
-	gui_element_add_child(&bms_container.element, &current_label.element);
+	gui_element_add_child(&headings_container.element, &current_label.element);
 
 	// Current text
 	gui_label_init(&current_text_label, "-????mA");
@@ -201,7 +252,7 @@ const display_screen_t *display_bms_init(gui_t *gui_) {
 	gui_label_set_text_alignment(&capacity_label, GUI_TEXT_ALIGN_CENTER);
 	gui_element_set_size(&capacity_label.element, 32, 5);
 	gui_element_set_position(&capacity_label.element, 32, 28);
-	gui_element_add_child(&bms_container.element, &capacity_label.element);
+	gui_element_add_child(&headings_container.element, &capacity_label.element);
 
 	// Capacity text
 	gui_label_init(&capacity_text_label, "????mAh");
@@ -210,6 +261,8 @@ const display_screen_t *display_bms_init(gui_t *gui_) {
 	gui_element_set_position(&capacity_text_label.element, 32, 34);
 	gui_element_add_child(&bms_container.element, &capacity_text_label.element);
 
+	gui_update_init(&ui_update, apply_ui_update);
+	gui_update_init(&visibility_update, apply_visibility_update);
 	event_bus_subscribe(&battery_gauge_event_handler, "battery_gauge", on_battery_gauge_event, NULL);
 
 	return &bms_screen;
@@ -1,5 +1,7 @@
 #include "display_network.h"
 
+#include <stdio.h>
+
 #include <esp_netif_ip_addr.h>
 
 #include "ethernet.h"
@@ -20,23 +22,32 @@ static label_text_pair_t link_status_label;
 
 static gui_t *gui;
 
-static event_bus_handler_t network_event_handler;
-
-static void update_ui(void) {
+typedef struct network_values {
 	esp_netif_ip_info_t ipv4_info;
+	bool link_up;
+	eth_speed_t link_speed;
+} network_values_t;
+
+// Written by updaters, applied by the renderer at the start of the next frame
+static network_values_t pending_values;
+static gui_update_t ui_update;
+static bool pending_shown;
+static gui_update_t visibility_update;
 
-	ethernet_get_ipv4_address(&ipv4_info);
+static event_bus_handler_t network_event_handler;
+
+static void apply_ui_update(gui_update_t *update) {
+	const network_values_t *values = &pending_values;
 
-	gui_lock(gui);
 	snprintf(ipv4_address_label.text,
 		 sizeof(ipv4_address_label.text),
-		 IPSTR, IP2STR(&ipv4_info.ip));
+		 IPSTR, IP2STR(&values->ipv4_info.ip));
 	gui_label_set_text(&ipv4_address_label.label, ipv4_address_label.text);
 
-	if (ethernet_is_link_up()) {
+	if (values->link_up) {
 		const char *speed;
 
-		switch (ethernet_get_link_speed()) {
+		switch (values->link_speed) {
 		case ETH_SPEED_10M:
 			speed = "10M";
 			break;
@@ -53,21 +64,48 @@ static void update_ui(void) {
 	} else {
 		gui_label_set_text(&link_status_label.label, "LINK DOWN");
 	}
-	gui_unlock(gui);
+}
+
+static void update_ui(void) {
+	network_values_t values;
+
+	ethernet_get_ipv4_address(&values.ipv4_info);
+	values.link_up = ethernet_is_link_up();
+	values.link_speed = values.link_up ? ethernet_get_link_speed() : ETH_SPEED_10M;
+
+	gui_update_lock(gui);
+	pending_values = values;
+	gui_update_queue(gui, &ui_update);
+	gui_update_unlock(gui);
 }
 
 static void on_network_event(void *priv, void *data) {
 	update_ui();
 }
 
+static void apply_visibility_update(gui_update_t *update) {
+	if (pending_shown) {
+		gui_element_set_hidden(&network_container.element, false);
+		gui_element_show(&network_container.element);
+	} else {
+		gui_element_set_hidden(&network_container.element, true);
+	}
+}
+
+static void set_shown(bool shown) {
+	gui_update_lock(gui);
+	pending_shown = shown;
+	gui_update_queue(gui, &visibility_update);
+	gui_update_unlock(gui);
+}
+
 static void display_network_show(void) {
 	update_ui();
-	gui_element_set_hidden(&network_container.element, false);
-	gui_element_show(&network_container.element);
+	set_shown(true);
 }
 
 static void display_network_hide(void) {
-	gui_element_set_hidden(&network_container.element, true);
+	set_shown(false);
 }
 
 static const display_screen_t network_screen = {
@@ -97,6 +135,8 @@ const display_screen_t *display_network_init(gui_t *gui_) {
 	setup_label(&link_status_label.label, "LINK UP/DONW", 0, 0);
 	setup_label(&ipv4_address_label.label, "???.???.???.???", 0, 6);
 
+	gui_update_init(&ui_update, apply_ui_update);
+	gui_update_init(&visibility_update, apply_visibility_update);
 	event_bus_subscribe(&network_event_handler, "network", on_network_event, NULL);
 
 	return &network_screen;
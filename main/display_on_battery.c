@@ -1,8 +1,10 @@
 #include "display_on_battery.h"
 
+#include <stdio.h>
+#include <string.h>
+
 #include "event_bus.h"
 #include "battery_gauge.h"
-#include "scheduler.h"
 #include "util.h"
 
 #define ON_BATTERY_BLINK_INTERVAL_MS	1000
@@ -19,33 +21,77 @@ static char soc_text[16];
 static gui_label_t remaining_label;
 static gui_label_t remaining_time_label;
 static char remaining_time_text[16];
+static gui_label_t remaining_band_label;
+static char remaining_band_text[16];
 
 static gui_label_t on_battery_label;
-static scheduler_task_t on_battery_blink_task;
+static gui_animation_t on_battery_blink;
 
 static event_bus_handler_t battery_gauge_event_handler;
 
 static gui_t *gui;
 
-static void update_ui(gui_t *gui) {
-	unsigned int soc = battery_gauge_get_soc_percent();
+typedef struct on_battery_values {
+	unsigned int soc;
+	runtime_estimate_t runtime;
+} on_battery_values_t;
+
+// Written by updaters, applied by the renderer at the start of the next frame
+static on_battery_values_t pending_values;
+static gui_update_t ui_update;
+static bool pending_shown;
+static gui_update_t visibility_update;
+
+static void apply_ui_update(gui_update_t *update) {
+	const on_battery_values_t *values = &pending_values;
 	unsigned int soc_full_height = battery_body_rect.element.area.size.y - 4;
-	unsigned int soc_height = soc_full_height * soc / 100;
+	unsigned int soc_height = soc_full_height * values->soc / 100;
 	unsigned int soc_width = battery_body_rect.element.area.size.x - 4;
-	unsigned int run_time_to_empty = battery_gauge_get_time_to_empty_min();
+	unsigned int band_min = (values->runtime.runtime_high_min - values->runtime.runtime_low_min + 1) / 2;
 
-	gui_lock(gui);
 	gui_element_set_position(&battery_soc_rect.element,
 		battery_body_rect.element.area.position.x + 2,
 		battery_body_rect.element.area.position.y + 2 + soc_full_height - soc_height);
 	gui_element_set_size(&battery_soc_rect.element, soc_width, soc_height);
 
-	snprintf(soc_text, sizeof(soc_text), "SoC %3u%%", soc);
+	snprintf(soc_text, sizeof(soc_text), "SoC %3u%%", values->soc);
 	gui_label_set_text(&soc_label, soc_text);
 
-	snprintf(remaining_time_text, sizeof(remaining_time_text), "%02u:%02u", run_time_to_empty / 60, run_time_to_empty % 60);
+	if (values->runtime.valid) {
+		snprintf(remaining_time_text, sizeof(remaining_time_text), "%02u:%02u",
+			 values->runtime.runtime_min / 60, values->runtime.runtime_min % 60);
+		snprintf(remaining_band_text, sizeof(remaining_band_text), "+-%u:%02u", band_min / 60, band_min % 60);
+	} else {
+		strcpy(remaining_time_text, "??:??");
+		remaining_band_text[0] = '\0';
+	}
 	gui_label_set_text(&remaining_time_label, remaining_time_text);
-	gui_unlock(gui);
+	gui_label_set_text(&remaining_band_label, remaining_band_text);
+}
+
+// Blinking is tied to the frame clock, start and stop it along with the screen
+static void apply_visibility_update(gui_update_t *update) {
+	if (pending_shown) {
+		gui_element_set_hidden(&on_battery_label.element, false);
+		gui_element_set_hidden(&on_battery.element, false);
+		gui_element_show(&on_battery.element);
+		gui_animation_start(gui, &on_battery_blink);
+	} else {
+		gui_element_set_hidden(&on_battery.element, true);
+		gui_animation_stop(gui, &on_battery_blink);
+	}
+}
+
+static void update_ui(gui_t *gui) {
+	on_battery_values_t values;
+
+	values.soc = battery_gauge_get_soc_percent();
+	battery_gauge_get_runtime_estimate(&values.runtime);
+
+	gui_update_lock(gui);
+	pending_values = values;
+	gui_update_queue(gui, &ui_update);
+	gui_update_unlock(gui);
 }
 
 static void on_battery_gauge_event(void *priv, void *data) {
@@ -54,6 +100,17 @@ static void on_battery_gauge_event(void *priv, void *data) {
 	update_ui(gui);
 }
 
+static int64_t on_battery_blink_tick(gui_animation_t *animation, int64_t now_us) {
+	int64_t interval_us = MS_TO_US(ON_BATTERY_BLINK_INTERVAL_MS);
+	int64_t phase = (now_us - animation->start_us) / interval_us;
+	bool hidden = phase % 2;
+
+	if (on_battery_label.element.hidden != hidden) {
+		gui_element_set_hidden(&on_battery_label.element, hidden);
+	}
+	return animation->start_us + (phase + 1) * interval_us;
+}
+
 static const display_screen_t on_battery_screen = {
 	.name = NULL,
 	.show = display_on_battery_show,
@@ -108,6 +165,12 @@ const display_screen_t *display_on_battery_init(gui_t *gui_) {
 	gui_element_set_position(&remaining_time_label.element, 24, 25);
 	gui_element_add_child(&on_battery.element, &remaining_time_label.element);
 
+	gui_label_init(&remaining_band_label, "");
+	gui_label_set_text_alignment(&remaining_band_label, GUI_TEXT_ALIGN_CENTER);
+	gui_element_set_size(&remaining_band_label.element, 64 - 24, 5);
+	gui_element_set_position(&remaining_band_label.element, 24, 32);
+	gui_element_add_child(&on_battery.element, &remaining_band_label.element);
+
 	// Binking "ON BATTERY" indicator
 	gui_label_init(&on_battery_label, "ON BATTERY");
 	gui_label_set_text_alignment(&on_battery_label, GUI_TEXT_ALIGN_CENTER);
@@ -115,32 +178,25 @@ const display_screen_t *display_on_battery_init(gui_t *gui_) {
 	gui_element_set_position(&on_battery_label.element, 0, 48 - 5);
 	gui_element_add_child(&on_battery.element, &on_battery_label.element);
 
-	scheduler_task_init(&on_battery_blink_task);
+	gui_animation_init(&on_battery_blink, on_battery_blink_tick);
+	gui_update_init(&ui_update, apply_ui_update);
+	gui_update_init(&visibility_update, apply_visibility_update);
 	event_bus_subscribe(&battery_gauge_event_handler, "battery_gauge", on_battery_gauge_event, gui);
 
 	return &on_battery_screen;
 }
 
-static void toggle_battery_blink_cb(void *ctx);
-static void toggle_battery_blink_cb(void *ctx) {
-	gui_t *gui = ctx;
-
-	gui_lock(gui);
-	gui_element_set_hidden(&on_battery_label.element, !on_battery_label.element.hidden);
-	gui_unlock(gui);
-	if (!on_battery.element.hidden) {
-		scheduler_schedule_task_relative(&on_battery_blink_task, toggle_battery_blink_cb, gui, MS_TO_US(ON_BATTERY_BLINK_INTERVAL_MS));
-	}
-}
-
 void display_on_battery_show() {
 	update_ui(gui);
-	gui_element_set_hidden(&on_battery.element, false);
-	gui_element_show(&on_battery.element);
-	scheduler_schedule_task_relative(&on_battery_blink_task, toggle_battery_blink_cb, gui, MS_TO_US(ON_BATTERY_BLINK_INTERVAL_MS));
+	gui_update_lock(gui);
+	pending_shown = true;
+	gui_update_queue(gui, &visibility_update);
+	gui_update_unlock(gui);
 }
 
 void display_on_battery_hide() {
-	gui_element_set_hidden(&on_battery.element, true);
-	scheduler_abort_task(&on_battery_blink_task);
+	gui_update_lock(gui);
+	pending_shown = false;
+	gui_update_queue(gui, &visibility_update);
+	gui_update_unlock(gui);
 }
@@ -1,11 +1,16 @@
 #include "display_power.h"
 
+#include <stdio.h>
+
 #include "event_bus.h"
 #include "power_path.h"
 #include "scheduler.h"
 #include "util.h"
 
 static gui_container_t power_container;
+// Static headings, rendered once into a cache
+static gui_container_t headings_container;
+static uint8_t headings_cache[GUI_CONTAINER_CACHE_SIZE(64, 48 - 8)];
 
 typedef struct label_text_pair {
 	gui_label_t label;
@@ -37,39 +42,76 @@ static event_bus_handler_t power_path_event_handler;
 		gui_label_set_text(&(pair)->label, (pair)->text); \
 	} while (0)
 
-static void populate_column_with_power_path_group_data(power_display_column_t *column, power_path_group_t group) {
-	power_path_group_data_t group_data;
+typedef struct power_values {
+	power_path_group_data_t in;
+	power_path_group_data_t dc;
+	power_path_group_data_t usb;
+	unsigned int input_current_limit_ma;
+} power_values_t;
+
+// Written by updaters, applied by the renderer at the start of the next frame
+static power_values_t pending_values;
+static gui_update_t ui_update;
+static bool pending_shown;
+static gui_update_t visibility_update;
+
+static void populate_column_with_power_path_group_data(power_display_column_t *column, const power_path_group_data_t *group_data) {
+	label_text_pair_printf(&column->voltage, "%.1fV", group_data->voltage_mv / 1000.f);
+	label_text_pair_printf(&column->current, "%.1fA", group_data->current_ma / 1000.f);
+	label_text_pair_printf(&column->power, "%.1fW", group_data->power_mw / 1000.f);
+	label_text_pair_printf(&column->temperature, "%dC", (int)DIV_ROUND(group_data->temperature_mdegc, 1000));
+}
+
+static void apply_ui_update(gui_update_t *update) {
+	populate_column_with_power_path_group_data(&column_in, &pending_values.in);
+	populate_column_with_power_path_group_data(&column_dc, &pending_values.dc);
+	populate_column_with_power_path_group_data(&column_usb, &pending_values.usb);
 
-	power_path_get_group_data(group, &group_data);
-	label_text_pair_printf(&column->voltage, "%.1fV", group_data.voltage_mv / 1000.f);
-	label_text_pair_printf(&column->current, "%.1fA", group_data.current_ma / 1000.f);
-	label_text_pair_printf(&column->power, "%.1fW", group_data.power_mw / 1000.f);
-	label_text_pair_printf(&column->temperature, "%dC", (int)DIV_ROUND(group_data.temperature_mdegc, 1000));
+	snprintf(current_limit_text, sizeof(current_limit_text), "IN limit: %.1fA", pending_values.input_current_limit_ma / 1000.f);
+	gui_label_set_text(&input_current_limit_label, current_limit_text);
 }
 
 static void update_ui(void) {
-	gui_lock(gui);
-	populate_column_with_power_path_group_data(&column_in, POWER_PATH_GROUP_IN);
-	populate_column_with_power_path_group_data(&column_dc, POWER_PATH_GROUP_DC);
-	populate_column_with_power_path_group_data(&column_usb, POWER_PATH_GROUP_USB);
+	power_values_t values;
 
-	snprintf(current_limit_text, sizeof(current_limit_text), "IN limit: %.1fA", power_path_get_input_current_limit_ma() / 1000.f);
-	gui_label_set_text(&input_current_limit_label, current_limit_text);
-	gui_unlock(gui);
+	power_path_get_group_data(POWER_PATH_GROUP_IN, &values.in);
+	power_path_get_group_data(POWER_PATH_GROUP_DC, &values.dc);
+	power_path_get_group_data(POWER_PATH_GROUP_USB, &values.usb);
+	values.input_current_limit_ma = power_path_get_input_current_limit_ma();
+
+	gui_update_lock(gui);
+	pending_values = values;
+	gui_update_queue(gui, &ui_update);
+	gui_update_unlock(gui);
 }
 
 static void on_power_path_event(void *priv, void *data) {
 	update_ui();
 }
 
+static void apply_visibility_update(gui_update_t *update) {
+	if (pending_shown) {
+		gui_element_set_hidden(&power_container.element, false);
+		gui_element_show(&power_container.element);
+	} else {
+		gui_element_set_hidden(&power_container.element, true);
+	}
+}
+
+static void set_shown(bool shown) {
+	gui_update_lock(gui);
+	pending_shown = shown;
+	gui_update_queue(gui, &visibility_update);
+	gui_update_unlock(gui);
+}
+
 static void display_power_show(void) {
 	update_ui();
-	gui_element_set_hidden(&power_container.element, false);
-	gui_element_show(&power_container.element);
+	set_shown(true);
 }
 
 static void display_power_hide(void) {
-	gui_element_set_hidden(&power_container.element, true);
+	set_shown(false);
 }
 
 static const display_screen_t power_screen = {
@@ -78,20 +120,20 @@ static const display_screen_t power_screen = {
 	.hide = display_power_hide
 };
 
-static void setup_label(gui_label_t *label, const char *text, unsigned int pos_x, unsigned int pos_y) {
+static void setup_label(gui_container_t *parent, gui_label_t *label, const char *text, unsigned int pos_x, unsigned int pos_y) {
 	gui_label_init(label, text);
 	gui_label_set_text_alignment(label, GUI_TEXT_ALIGN_CENTER);
 	gui_element_set_size(&label->element, 20, 5);
 	gui_element_set_position(&label->element, pos_x, pos_y);
-	gui_element_add_child(&power_container.element, &label->element);
+	gui_element_add_child(&parent->element, &label->element);
 }
 
 static void populate_column(power_display_column_t *column, const char *heading, unsigned int pos_x) {
-	setup_label(&column->heading, heading, pos_x, 0);
-	setup_label(&column->voltage.label, "??.?V", pos_x, 8);
-	setup_label(&column->current.label, "??.?A", pos_x, 14);
-	setup_label(&column->power.label, "??.?W", pos_x, 20);
-	setup_label(&column->temperature.label, "??C", pos_x, 26);
+	setup_label(&headings_container, &column->heading, heading, pos_x, 0);
+	setup_label(&power_container, &column->voltage.label, "??.?V", pos_x, 8);
+	setup_label(&power_container, &column->current.label, "??.?A", pos_x, 14);
+	setup_label(&power_container, &column->power.label, "??.?W", pos_x, 20);
+	setup_label(&power_container, &column->temperature.label, "??C", pos_x, 26);
 }
 
 const display_screen_t *display_power_init(gui_t *gui_) {
@@ -104,13 +146,21 @@ const display_screen_t *display_power_init(gui_t *gui_) {
 	gui_element_set_hidden(&power_container.element, true);
 	gui_element_add_child(&gui->container.element, &power_container.element);
 
+	// Headings, added first so values are drawn on top
+	gui_container_init(&headings_container);
+	gui_element_set_size(&headings_container.element, 64, 48 - 8);
+	gui_container_set_cache(&headings_container, headings_cache, sizeof(headings_cache));
+	gui_element_add_child(&power_container.element, &headings_container.element);
+
 	populate_column(&column_in, "IN", 0);
 	populate_column(&column_dc, "DC", 22);
 	populate_column(&column_usb, "USB", 44);
 
-	setup_label(&input_current_limit_label, "IN limit: ??.?A", 0, 35);
+	setup_label(&power_container, &input_current_limit_label, "IN limit: ??.?A", 0, 35);
 	gui_element_set_size(&input_current_limit_label.element, 64, 5);
 
+	gui_update_init(&ui_update, apply_ui_update);
+	gui_update_init(&visibility_update, apply_visibility_update);
 	event_bus_subscribe(&power_path_event_handler, "power_path", on_power_path_event, NULL);
 
 	return &power_screen;
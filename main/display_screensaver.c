@@ -1,6 +1,8 @@
 #include "display_screensaver.h"
 
 #include <stdint.h>
+#include <stdio.h>
+#include <string.h>
 
 #include <esp_random.h>
 
@@ -27,49 +29,93 @@ static label_text_pair_t runtime_label;
 
 static scheduler_task_t screensaver_move_task;
 
+// Written by updaters, applied by the renderer at the start of the next frame
+static unsigned int pending_soc;
+static runtime_estimate_t pending_runtime;
+static gui_update_t battery_gauge_update;
+static unsigned long pending_power_mw;
+static gui_update_t power_path_update;
+static gui_point_t pending_position;
+static gui_update_t move_update;
+static bool pending_shown;
+static gui_update_t visibility_update;
+
 static gui_t *gui;
 
 event_bus_handler_t event_hander_battery_gauge;
 event_bus_handler_t event_hander_power_path;
 
+static void apply_battery_gauge_update(gui_update_t *update) {
+	snprintf(screensaver_soc_text, sizeof(screensaver_soc_text), "%u%%", pending_soc);
+	gui_label_set_text(&screensaver_soc_label, screensaver_soc_text);
+
+	if (pending_runtime.valid) {
+		snprintf(runtime_label.text, sizeof(runtime_label.text), "%02u:%02u",
+			 pending_runtime.runtime_min / 60, pending_runtime.runtime_min % 60);
+	} else {
+		strcpy(runtime_label.text, "??:??");
+	}
+	gui_label_set_text(&runtime_label.label, runtime_label.text);
+}
+
 static void on_battery_gauge_event(void *priv, void *data) {
 	gui_t *gui = priv;
 	unsigned int soc;
-	unsigned int time_to_empty = battery_gauge_get_at_rate_time_to_empty_min();
+	runtime_estimate_t runtime;
 
-	gui_lock(gui);
+	battery_gauge_get_runtime_estimate(&runtime);
 	soc = battery_gauge_get_soc_percent();
-	snprintf(screensaver_soc_text, sizeof(screensaver_soc_text), "%u%%", soc);
-	gui_label_set_text(&screensaver_soc_label, screensaver_soc_text);
 
-	snprintf(runtime_label.text, sizeof(runtime_label.text), "%02u:%02u", time_to_empty / 60, time_to_empty % 60);
-	gui_label_set_text(&runtime_label.label, runtime_label.text);
-	gui_unlock(gui);
+	gui_update_lock(gui);
+	pending_soc = soc;
+	pending_runtime = runtime;
+	gui_update_queue(gui, &battery_gauge_update);
+	gui_update_unlock(gui);
+}
+
+static void apply_power_path_update(gui_update_t *update) {
+	snprintf(screensaver_power_text, sizeof(screensaver_power_text), "%.2fW", pending_power_mw / 1000.f);
+	gui_label_set_text(&screensaver_power_label, screensaver_power_text);
 }
 
 static void on_power_path_event(void *priv, void *data) {
 	gui_t *gui = priv;
 	unsigned long power_mw = power_path_get_output_power_consumption_mw();
 
-	gui_lock(gui);
-	snprintf(screensaver_power_text, sizeof(screensaver_power_text), "%.2fW", power_mw / 1000.f);
-	gui_label_set_text(&screensaver_power_label, screensaver_power_text);
-	gui_unlock(gui);
+	gui_update_lock(gui);
+	pending_power_mw = power_mw;
+	gui_update_queue(gui, &power_path_update);
+	gui_update_unlock(gui);
+}
+
+static void apply_move_update(gui_update_t *update) {
+	gui_element_set_position(&screensaver.element, pending_position.x, pending_position.y);
 }
 
 static void screensaver_move_cb(void *ctx);
 static void screensaver_move_cb(void *ctx) {
-	uint32_t x, y;
+	// Size is fixed after init, no need to wait for the renderer to read it
+	uint32_t x = esp_random() % (64 - screensaver.element.area.size.x);
+	uint32_t y = esp_random() % (48 - screensaver.element.area.size.y);
 
-	gui_lock(gui);
-	x = esp_random() % (64 - screensaver.element.area.size.x);
-	y = esp_random() % (48 - screensaver.element.area.size.y);
-	gui_element_set_position(&screensaver.element, x, y);
-	gui_unlock(gui);
+	gui_update_lock(gui);
+	pending_position.x = x;
+	pending_position.y = y;
+	gui_update_queue(gui, &move_update);
+	gui_update_unlock(gui);
 
 	scheduler_schedule_task_relative(&screensaver_move_task, screensaver_move_cb, NULL, MS_TO_US(MOVE_INTERVAL_MS));
 }
 
+static void apply_visibility_update(gui_update_t *update) {
+	if (pending_shown) {
+		gui_element_set_hidden(&screensaver.element, false);
+		gui_element_show(&screensaver.element);
+	} else {
+		gui_element_set_hidden(&screensaver.element, true);
+	}
+}
+
 static const display_screen_t screensaver_screen = {
 	.name = NULL,
 	.show = display_screensaver_show,
@@ -96,6 +142,10 @@ const display_screen_t *display_screensaver_init(gui_t *gui_root) {
 	setup_label(&screensaver_power_label, "??.??W", 0, 7);
 	setup_label(&runtime_label.label, "??:??", 0, 14);
 
+	gui_update_init(&battery_gauge_update, apply_battery_gauge_update);
+	gui_update_init(&power_path_update, apply_power_path_update);
+	gui_update_init(&move_update, apply_move_update);
+	gui_update_init(&visibility_update, apply_visibility_update);
 	scheduler_task_init(&screensaver_move_task);
 	scheduler_schedule_task_relative(&screensaver_move_task, screensaver_move_cb, NULL, MS_TO_US(MOVE_INTERVAL_MS));
 
@@ -105,10 +155,15 @@ const display_screen_t *display_screensaver_init(gui_t *gui_root) {
 }
 
 void display_screensaver_show() {
-	gui_element_set_hidden(&screensaver.element, false);
-	gui_element_show(&screensaver.element);
+	gui_update_lock(gui);
+	pending_shown = true;
+	gui_update_queue(gui, &visibility_update);
+	gui_update_unlock(gui);
 }
 
 void display_screensaver_hide() {
-	gui_element_set_hidden(&screensaver.element, true);
+	gui_update_lock(gui);
+	pending_shown = false;
+	gui_update_queue(gui, &visibility_update);
+	gui_update_unlock(gui);
 }
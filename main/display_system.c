@@ -1,5 +1,8 @@
 #include "display_system.h"
 
+#include <stdio.h>
+#include <string.h>
+
 #include "event_bus.h"
 #include "power_path.h"
 #include "scheduler.h"
@@ -12,6 +15,9 @@ typedef struct label_text_pair {
 } label_text_pair_t;
 
 static gui_container_t system_container;
+// Static headings and version, rendered once into a cache
+static gui_container_t static_container;
+static uint8_t static_cache[GUI_CONTAINER_CACHE_SIZE(64, 48 - 8)];
 
 static gui_label_t device_serial_header_label;
 static label_text_pair_t device_serial_label;
@@ -21,29 +27,55 @@ static gui_label_t app_version_label;
 
 static gui_t *gui;
 
+// Written by updaters, applied by the renderer at the start of the next frame
+static char pending_serial[sizeof(device_serial_label.text)];
+static gui_update_t ui_update;
+static bool pending_shown;
+static gui_update_t visibility_update;
+
 static event_bus_handler_t vendor_event_handler;
 
+static void apply_ui_update(gui_update_t *update) {
+	strcpy(device_serial_label.text, pending_serial);
+	gui_label_set_text(&device_serial_label.label, device_serial_label.text);
+}
+
 static void update_ui() {
-	gui_lock(gui);
+	gui_update_lock(gui);
 	vendor_lock();
-	snprintf(device_serial_label.text, sizeof(device_serial_label.text), "%s", vendor_get_serial_number_());
-	gui_label_set_text(&device_serial_label.label, device_serial_label.text);
+	snprintf(pending_serial, sizeof(pending_serial), "%s", vendor_get_serial_number_());
 	vendor_unlock();
-	gui_unlock(gui);
+	gui_update_queue(gui, &ui_update);
+	gui_update_unlock(gui);
 }
 
 static void on_vendor_event(void *priv, void *data) {
 	update_ui();
 }
 
+static void apply_visibility_update(gui_update_t *update) {
+	if (pending_shown) {
+		gui_element_set_hidden(&system_container.element, false);
+		gui_element_show(&system_container.element);
+	} else {
+		gui_element_set_hidden(&system_container.element, true);
+	}
+}
+
+static void set_shown(bool shown) {
+	gui_update_lock(gui);
+	pending_shown = shown;
+	gui_update_queue(gui, &visibility_update);
+	gui_update_unlock(gui);
+}
+
 static void display_system_show(void) {
 	update_ui();
-	gui_element_set_hidden(&system_container.element, false);
-	gui_element_show(&system_container.element);
+	set_shown(true);
 }
 
 static void display_system_hide(void) {
-	gui_element_set_hidden(&system_container.element, true);
+	set_shown(false);
 }
 
 static const display_screen_t system_screen = {
@@ -52,12 +84,12 @@ static const display_screen_t system_screen = {
 	.hide = display_system_hide
 };
 
-static void setup_label(gui_label_t *label, const char *text, unsigned int pos_x, unsigned int pos_y) {
+static void setup_label(gui_container_t *parent, gui_label_t *label, const char *text, unsigned int pos_x, unsigned int pos_y) {
 	gui_label_init(label, text);
 	gui_label_set_text_alignment(label, GUI_TEXT_ALIGN_CENTER);
 	gui_element_set_size(&label->element, 64, 5);
 	gui_element_set_position(&label->element, pos_x, pos_y);
-	gui_element_add_child(&system_container.element, &label->element);
+	gui_element_add_child(&parent->element, &label->element);
 }
 
 const display_screen_t *display_system_init(gui_t *gui_) {
@@ -70,12 +102,20 @@ const display_screen_t *display_system_init(gui_t *gui_) {
 	gui_element_set_hidden(&system_container.element, true);
 	gui_element_add_child(&gui->container.element, &system_container.element);
 
-	setup_label(&device_serial_header_label, "Serial", 0, 6);
-	setup_label(&device_serial_label.label, "000000", 0, 6 + 6);
+	// Static labels, added first so values are drawn on top
+	gui_container_init(&static_container);
+	gui_element_set_size(&static_container.element, 64, 48 - 8);
+	gui_container_set_cache(&static_container, static_cache, sizeof(static_cache));
+	gui_element_add_child(&system_container.element, &static_container.element);
+
+	setup_label(&static_container, &device_serial_header_label, "Serial", 0, 6);
+	setup_label(&system_container, &device_serial_label.label, "000000", 0, 6 + 6);
 
-	setup_label(&app_version_header_label, "Version", 0, 40 - 12 - 6);
-	setup_label(&app_version_label, XSTRINGIFY(UPS_APP_VERSION), 0, 40 - 12);
+	setup_label(&static_container, &app_version_header_label, "Version", 0, 40 - 12 - 6);
+	setup_label(&static_container, &app_version_label, XSTRINGIFY(UPS_APP_VERSION), 0, 40 - 12);
 
+	gui_update_init(&ui_update, apply_ui_update);
+	gui_update_init(&visibility_update, apply_visibility_update);
 	event_bus_subscribe(&vendor_event_handler, "vendor", on_vendor_event, NULL);
 
 	return &system_screen;
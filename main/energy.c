@@ -0,0 +1,201 @@
+#include "energy.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+
+#include <esp_log.h>
+#include <esp_timer.h>
+
+#include "battery_gauge.h"
+#include "event_bus.h"
+#include "power_path.h"
+#include "settings.h"
+#include "util.h"
+
+#define NUM_COUNTERS			(ENERGY_COUNTER_MAX_ + 1)
+
+// Power path updates once a second, anything much longer is a stall
+#define MAX_INTEGRATION_INTERVAL_US	MS_TO_US(5000)
+
+// Flash wear: write at most every 15 minutes and only if worth it
+#define PERSIST_INTERVAL_US		(15LL * 60LL * 1000000LL)
+#define PERSIST_MIN_DELTA_NJ		(100ULL * 3600ULL * 1000000ULL) // 0.1 Wh
+
+#define NJ_PER_MWH			(3600ULL * 1000000ULL)
+
+static const char *TAG = "energy";
+
+static const char *counter_names[NUM_COUNTERS] = {
+	[ENERGY_COUNTER_INPUT] = "input",
+	[ENERGY_COUNTER_DC_OUTPUT] = "dc_output",
+	[ENERGY_COUNTER_USB_OUTPUT] = "usb_output",
+	[ENERGY_COUNTER_BATTERY_CHARGE] = "battery_charge",
+	[ENERGY_COUNTER_BATTERY_DISCHARGE] = "battery_discharge",
+};
+
+// mW * us = nJ, 64 bit nJ wrap after more than 5 GWh
+static uint64_t counters_nj[NUM_COUNTERS] = { 0 };
+static uint64_t persisted_counters_nj[NUM_COUNTERS] = { 0 };
+static int64_t last_update_us = 0;
+static int64_t last_persist_us = 0;
+
+static SemaphoreHandle_t lock;
+static StaticSemaphore_t lock_buffer;
+
+static event_bus_handler_t power_path_event_handler;
+static event_bus_handler_t power_source_event_handler;
+
+static prometheus_metric_t energy_metric;
+
+static bool needs_persist(void) {
+	unsigned int i;
+
+	for (i = 0; i < NUM_COUNTERS; i++) {
+		if (counters_nj[i] - persisted_counters_nj[i] >= PERSIST_MIN_DELTA_NJ) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+static void persist(bool force) {
+	uint64_t counters_snapshot_nj[NUM_COUNTERS];
+
+	xSemaphoreTake(lock, portMAX_DELAY);
+	if (!force && !needs_persist()) {
+		xSemaphoreGive(lock);
+		return;
+	}
+	if (!memcmp(counters_nj, persisted_counters_nj, sizeof(counters_nj))) {
+		xSemaphoreGive(lock);
+		return;
+	}
+	memcpy(counters_snapshot_nj, counters_nj, sizeof(counters_nj));
+	xSemaphoreGive(lock);
+
+	settings_set_energy_counters(counters_snapshot_nj, NUM_COUNTERS);
+
+	xSemaphoreTake(lock, portMAX_DELAY);
+	memcpy(persisted_counters_nj, counters_snapshot_nj, sizeof(counters_snapshot_nj));
+	last_persist_us = esp_timer_get_time();
+	xSemaphoreGive(lock);
+}
+
+static void on_power_path_event(void *priv, void *data) {
+	int64_t now_us = esp_timer_get_time();
+	int64_t delta_us = now_us - last_update_us;
+	uint64_t power_mw[NUM_COUNTERS] = { 0 };
+	power_path_snapshot_t power_path;
+	battery_gauge_params_t battery;
+	int64_t battery_power_mw;
+	unsigned int i;
+
+	if (!last_update_us) {
+		last_update_us = now_us;
+		return;
+	}
+	last_update_us = now_us;
+	delta_us = MIN(delta_us, MAX_INTEGRATION_INTERVAL_US);
+
+	power_path_get_snapshot(&power_path);
+	battery_gauge_get_params(&battery);
+
+	power_mw[ENERGY_COUNTER_INPUT] = MAX(power_path.groups[POWER_PATH_GROUP_IN].power_mw, 0);
+	power_mw[ENERGY_COUNTER_DC_OUTPUT] = MAX(power_path.groups[POWER_PATH_GROUP_DC].power_mw, 0);
+	power_mw[ENERGY_COUNTER_USB_OUTPUT] = MAX(power_path.groups[POWER_PATH_GROUP_USB].power_mw, 0);
+	// Positive battery current is charging
+	battery_power_mw = (int64_t)battery.values[BATTERY_VOLTAGE_MV] * battery.values[BATTERY_CURRENT_MA] / 1000;
+	if (battery_power_mw >= 0) {
+		power_mw[ENERGY_COUNTER_BATTERY_CHARGE] = battery_power_mw;
+	} else {
+		power_mw[ENERGY_COUNTER_BATTERY_DISCHARGE] = -battery_power_mw;
+	}
+
+	xSemaphoreTake(lock, portMAX_DELAY);
+	for (i = 0; i < NUM_COUNTERS; i++) {
+		counters_nj[i] += power_mw[i] * (uint64_t)delta_us;
+	}
+	xSemaphoreGive(lock);
+
+	if (now_us - last_persist_us >= PERSIST_INTERVAL_US) {
+		persist(false);
+	}
+}
+
+static void on_power_source_changed(void *priv, void *data) {
+	// Might be the last chance to save energy counters for a while
+	persist(true);
+}
+
+uint64_t energy_get_counter_mwh(energy_counter_t counter) {
+	uint64_t energy_nj;
+
+	xSemaphoreTake(lock, portMAX_DELAY);
+	energy_nj = counters_nj[counter];
+	xSemaphoreGive(lock);
+
+	return energy_nj / NJ_PER_MWH;
+}
+
+void energy_persist(void) {
+	persist(true);
+}
+
+void energy_init(void) {
+	lock = xSemaphoreCreateMutexStatic(&lock_buffer);
+
+	if (settings_get_energy_counters(counters_nj, NUM_COUNTERS)) {
+		memcpy(persisted_counters_nj, counters_nj, sizeof(counters_nj));
+		ESP_LOGI(TAG, "Restored energy counters, input: %lu Wh",
+			 (unsigned long)(counters_nj[ENERGY_COUNTER_INPUT] / NJ_PER_MWH / 1000));
+	}
+	last_persist_us = esp_timer_get_time();
+
+	event_bus_subscribe(&power_path_event_handler, "power_path", on_power_path_event, NULL);
+	event_bus_subscribe(&power_source_event_handler, "power_source", on_power_source_changed, NULL);
+}
+
+static void get_energy(const prometheus_metric_value_t *val, prometheus_metric_t *metric, char *value) {
+	uint64_t energy_mwh = energy_get_counter_mwh((energy_counter_t)val->priv);
+
+	sprintf(value, "%lu.%03u", (unsigned long)(energy_mwh / 1000), (unsigned int)(energy_mwh % 1000));
+}
+
+static unsigned int get_num_values(prometheus_metric_t *metric) {
+	return NUM_COUNTERS;
+}
+
+static unsigned int get_num_labels(const prometheus_metric_value_t *val, prometheus_metric_t *metric) {
+	return 1;
+}
+
+static void get_label(const prometheus_metric_value_t *val, prometheus_metric_t *metric, unsigned int index, char *label, char *value) {
+	strcpy(label, "counter");
+	strcpy(value, counter_names[(energy_counter_t)val->priv]);
+}
+
+static void get_metric_value(prometheus_metric_t *metric, unsigned int index, prometheus_metric_value_t *value) {
+	value->priv = (void *)index;
+	value->get_num_labels = get_num_labels;
+	value->get_label = get_label;
+	value->get_value = get_energy;
+}
+
+static const prometheus_metric_def_t energy_metric_def = {
+	.name = "energy_total",
+	.help = "Accumulated energy in Wh",
+	.type = PROMETHEUS_METRIC_TYPE_COUNTER,
+	.num_values = 0,
+	.get_num_values = get_num_values,
+	.get_value = get_metric_value,
+};
+
+void energy_install_metrics(prometheus_t *prometheus) {
+	prometheus_metric_init(&energy_metric, &energy_metric_def, NULL);
+	prometheus_add_metric(prometheus, &energy_metric);
+}
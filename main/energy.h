@@ -0,0 +1,19 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "prometheus.h"
+
+typedef enum energy_counter {
+	ENERGY_COUNTER_INPUT,
+	ENERGY_COUNTER_DC_OUTPUT,
+	ENERGY_COUNTER_USB_OUTPUT,
+	ENERGY_COUNTER_BATTERY_CHARGE,
+	ENERGY_COUNTER_BATTERY_DISCHARGE,
+	ENERGY_COUNTER_MAX_ = ENERGY_COUNTER_BATTERY_DISCHARGE
+} energy_counter_t;
+
+void energy_init(void);
+void energy_install_metrics(prometheus_t *prometheus);
+uint64_t energy_get_counter_mwh(energy_counter_t counter);
+void energy_persist(void);
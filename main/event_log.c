@@ -0,0 +1,296 @@
+#include "event_log.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+
+#include <esp_log.h>
+#include <esp_partition.h>
+#include <esp_rom_crc.h>
+#include <esp_timer.h>
+
+#include "scheduler.h"
+#include "util.h"
+
+#define PARTITION_LABEL		"eventlog"
+#define SECTOR_SIZE		4096
+#define RECORDS_PER_SECTOR	(SECTOR_SIZE / sizeof(event_log_record_t))
+#define RECORD_VERSION		1
+#define SEQUENCE_ERASED		UINT32_MAX
+// Records read per chunk while scanning or streaming
+#define CHUNK_RECORDS		16
+// Records waiting to be written by the scheduler task
+#define QUEUE_LENGTH		8
+
+_Static_assert(sizeof(event_log_record_t) == 32, "Event log record must be 32 bytes");
+
+static const char *TAG = "event_log";
+
+static const esp_partition_t *partition = NULL;
+static unsigned int num_sectors;
+
+static unsigned int head_sector;
+static unsigned int head_slot;
+static uint32_t next_sequence = 0;
+static uint16_t boot_count = 0;
+static bool erase_ahead_pending = false;
+
+static SemaphoreHandle_t lock;
+static StaticSemaphore_t lock_buffer;
+
+static scheduler_task_t erase_ahead_task;
+
+/*
+ * Appends only queue the record, flash writes can stall for milliseconds
+ * and callers include the power source GPIO task.
+ */
+static event_log_record_t queue[QUEUE_LENGTH];
+static unsigned int queue_first = 0;
+static unsigned int queue_len = 0;
+static unsigned int queue_dropped = 0;
+static SemaphoreHandle_t queue_lock;
+static StaticSemaphore_t queue_lock_buffer;
+static scheduler_task_t flush_task;
+
+static size_t record_offset(unsigned int sector, unsigned int slot) {
+	return sector * SECTOR_SIZE + slot * sizeof(event_log_record_t);
+}
+
+static uint32_t record_crc(const event_log_record_t *record) {
+	return esp_rom_crc32_le(0, (const uint8_t *)record, offsetof(event_log_record_t, crc));
+}
+
+static uint32_t read_sequence(unsigned int sector, unsigned int slot) {
+	uint32_t sequence = SEQUENCE_ERASED;
+
+	esp_partition_read(partition, record_offset(sector, slot), &sequence, sizeof(sequence));
+	return sequence;
+}
+
+static esp_err_t erase_sector(unsigned int sector) {
+	esp_err_t err = esp_partition_erase_range(partition, sector * SECTOR_SIZE, SECTOR_SIZE);
+
+	if (err) {
+		ESP_LOGE(TAG, "Failed to erase sector %u: %d", sector, err);
+	}
+	return err;
+}
+
+static void erase_ahead_cb(void *ctx) {
+	xSemaphoreTake(lock, portMAX_DELAY);
+	if (erase_ahead_pending) {
+		erase_sector((head_sector + 1) % num_sectors);
+		erase_ahead_pending = false;
+	}
+	xSemaphoreGive(lock);
+}
+
+// Finds the first free slot in the head sector, restores sequence and boot count
+static void scan_head_sector(void) {
+	event_log_record_t records[CHUNK_RECORDS];
+	unsigned int slot, i;
+
+	for (slot = 0; slot < RECORDS_PER_SECTOR; slot += CHUNK_RECORDS) {
+		if (esp_partition_read(partition, record_offset(head_sector, slot), records, sizeof(records))) {
+			break;
+		}
+		for (i = 0; i < CHUNK_RECORDS; i++) {
+			if (records[i].sequence == SEQUENCE_ERASED) {
+				head_slot = slot + i;
+				return;
+			}
+			// Torn writes still consume their slot and sequence number
+			next_sequence = records[i].sequence + 1;
+			if (record_crc(&records[i]) == records[i].crc) {
+				boot_count = records[i].boot_count;
+			}
+		}
+	}
+
+	head_slot = RECORDS_PER_SECTOR;
+}
+
+esp_err_t event_log_init(void) {
+	uint32_t newest_sequence = 0;
+	bool found = false;
+	unsigned int sector;
+
+	lock = xSemaphoreCreateMutexStatic(&lock_buffer);
+	queue_lock = xSemaphoreCreateMutexStatic(&queue_lock_buffer);
+	scheduler_task_init(&erase_ahead_task);
+	scheduler_task_init(&flush_task);
+
+	partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, PARTITION_LABEL);
+	if (!partition) {
+		ESP_LOGE(TAG, "Partition '%s' not found, event log disabled", PARTITION_LABEL);
+		return ESP_ERR_NOT_FOUND;
+	}
+	num_sectors = partition->size / SECTOR_SIZE;
+	if (num_sectors < 2) {
+		ESP_LOGE(TAG, "Partition too small, event log disabled");
+		partition = NULL;
+		return ESP_ERR_INVALID_SIZE;
+	}
+
+	// The sector holding the newest record has the highest first sequence number
+	head_sector = 0;
+	for (sector = 0; sector < num_sectors; sector++) {
+		uint32_t sequence = read_sequence(sector, 0);
+
+		if (sequence != SEQUENCE_ERASED && (!found || sequence > newest_sequence)) {
+			newest_sequence = sequence;
+			head_sector = sector;
+			found = true;
+		}
+	}
+
+	if (found) {
+		scan_head_sector();
+	} else {
+		erase_sector(head_sector);
+		head_slot = 0;
+	}
+
+	if (head_slot >= RECORDS_PER_SECTOR) {
+		head_sector = (head_sector + 1) % num_sectors;
+		head_slot = 0;
+		erase_sector(head_sector);
+	}
+	// Establish erase ahead invariant, might not hold after a reset during erase
+	if (read_sequence((head_sector + 1) % num_sectors, 0) != SEQUENCE_ERASED) {
+		erase_sector((head_sector + 1) % num_sectors);
+	}
+
+	boot_count++;
+	ESP_LOGI(TAG, "Event log with %u sectors, head at %u/%u, sequence %lu, boot %u",
+		 num_sectors, head_sector, head_slot, (unsigned long)next_sequence, boot_count);
+	return ESP_OK;
+}
+
+static void write_record(event_log_record_t *record) {
+	esp_err_t err;
+
+	xSemaphoreTake(lock, portMAX_DELAY);
+	if (head_slot >= RECORDS_PER_SECTOR) {
+		head_sector = (head_sector + 1) % num_sectors;
+		head_slot = 0;
+		// Erase ahead has not caught up yet, the new head sector might still hold old records
+		if (erase_ahead_pending) {
+			erase_sector(head_sector);
+		}
+		erase_ahead_pending = true;
+		scheduler_schedule_task_relative(&erase_ahead_task, erase_ahead_cb, NULL, 0);
+	}
+
+	record->sequence = next_sequence++;
+	record->boot_count = boot_count;
+	record->crc = record_crc(record);
+	err = esp_partition_write(partition, record_offset(head_sector, head_slot), record, sizeof(*record));
+	head_slot++;
+	xSemaphoreGive(lock);
+
+	if (err) {
+		ESP_LOGE(TAG, "Failed to append record: %d", err);
+	}
+}
+
+static void flush_cb(void *ctx) {
+	event_log_record_t record;
+	unsigned int dropped;
+
+	for (;;) {
+		xSemaphoreTake(queue_lock, portMAX_DELAY);
+		if (!queue_len) {
+			dropped = queue_dropped;
+			queue_dropped = 0;
+			xSemaphoreGive(queue_lock);
+			break;
+		}
+		record = queue[queue_first];
+		queue_first = (queue_first + 1) % QUEUE_LENGTH;
+		queue_len--;
+		xSemaphoreGive(queue_lock);
+
+		write_record(&record);
+	}
+
+	if (dropped) {
+		ESP_LOGW(TAG, "Dropped %u records, queue full", dropped);
+	}
+}
+
+esp_err_t event_log_append(event_log_type_t type, int32_t data0, int32_t data1, int32_t data2, int32_t data3) {
+	event_log_record_t record = {
+		.uptime_s = esp_timer_get_time() / 1000000LL,
+		.type = type,
+		.version = RECORD_VERSION,
+		.data = { data0, data1, data2, data3 },
+	};
+
+	if (!partition) {
+		return ESP_ERR_INVALID_STATE;
+	}
+
+	xSemaphoreTake(queue_lock, portMAX_DELAY);
+	if (queue_len >= QUEUE_LENGTH) {
+		queue_dropped++;
+		xSemaphoreGive(queue_lock);
+		return ESP_ERR_NO_MEM;
+	}
+	queue[(queue_first + queue_len) % QUEUE_LENGTH] = record;
+	queue_len++;
+	xSemaphoreGive(queue_lock);
+
+	scheduler_schedule_task_relative(&flush_task, flush_cb, NULL, 0);
+	return ESP_OK;
+}
+
+static esp_err_t http_get_event_log(struct httpd_request_ctx* ctx, void* priv) {
+	event_log_record_t records[CHUNK_RECORDS];
+	unsigned int sector, start_sector, slot, i;
+
+	if (!partition) {
+		return httpd_send_error(ctx, HTTPD_500);
+	}
+
+	httpd_resp_set_type(ctx->req, "application/octet-stream");
+	// Oldest sector first, the one after the head is erased unless erase ahead is pending
+	xSemaphoreTake(lock, portMAX_DELAY);
+	start_sector = (head_sector + 1) % num_sectors;
+	xSemaphoreGive(lock);
+	for (i = 0; i < num_sectors; i++) {
+		sector = (start_sector + i) % num_sectors;
+		for (slot = 0; slot < RECORDS_PER_SECTOR; slot += CHUNK_RECORDS) {
+			unsigned int num_records = 0;
+			esp_err_t err;
+
+			// Lock is only held while reading a chunk, appends must not wait for the client
+			xSemaphoreTake(lock, portMAX_DELAY);
+			err = esp_partition_read(partition, record_offset(sector, slot), records, sizeof(records));
+			xSemaphoreGive(lock);
+			if (err) {
+				return err;
+			}
+
+			// Records are written in order, an erased slot ends the sector
+			while (num_records < CHUNK_RECORDS && records[num_records].sequence != SEQUENCE_ERASED) {
+				num_records++;
+			}
+			if (num_records) {
+				httpd_response_write(ctx, (const char *)records, num_records * sizeof(event_log_record_t));
+			}
+			if (num_records < CHUNK_RECORDS) {
+				break;
+			}
+		}
+	}
+
+	httpd_finalize_response(ctx);
+	return ESP_OK;
+}
+
+esp_err_t event_log_register_api(httpd_t *httpd, const char *path) {
+	return httpd_add_get_handler(httpd, path, http_get_event_log, NULL, 0);
+}
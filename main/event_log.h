@@ -0,0 +1,47 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <esp_err.h>
+
+#include "httpd.h"
+
+#define EVENT_LOG_NUM_DATA	4
+
+// Stored in flash, only ever append new types
+typedef enum event_log_type {
+	// reset reason
+	EVENT_LOG_TYPE_BOOT			= 1,
+	// dc output voltage mV, state of charge %
+	EVENT_LOG_TYPE_POWER_FAIL		= 2,
+	// outage duration s, state of charge %
+	EVENT_LOG_TYPE_POWER_RESTORED		= 3,
+	// lowest cell mV
+	EVENT_LOG_TYPE_DEEP_DISCHARGE		= 4,
+	// lowest cell mV, detection to shutdown latency ms
+	EVENT_LOG_TYPE_UNDERVOLTAGE_SHUTDOWN	= 5,
+	// pack temperature mdeg C, 1 entering / 0 leaving excursion
+	EVENT_LOG_TYPE_TEMPERATURE_EXCURSION	= 6,
+	// 1 done / 0 aborted, resistance mOhm or battery_self_test_reason_t if aborted, ohmic resistance mOhm, step current mA
+	EVENT_LOG_TYPE_SELF_TEST		= 7,
+} event_log_type_t;
+
+/*
+ * On-flash record, 32 bytes. Records are appended to a ring of erase
+ * sectors, the sector after the one being written is always kept erased.
+ * Erased slots read as all ones.
+ */
+typedef struct event_log_record {
+	uint32_t sequence;
+	uint32_t uptime_s;
+	uint16_t boot_count;
+	uint8_t type;
+	uint8_t version;
+	int32_t data[EVENT_LOG_NUM_DATA];
+	// CRC32 over all preceding fields
+	uint32_t crc;
+} event_log_record_t;
+
+esp_err_t event_log_init(void);
+esp_err_t event_log_append(event_log_type_t type, int32_t data0, int32_t data1, int32_t data2, int32_t data3);
+esp_err_t event_log_register_api(httpd_t *httpd, const char *path);
@@ -28,3 +28,51 @@ static inline void fb_set_pixel(fb_t *fb, unsigned int x, unsigned int y, bool v
 		fb->data[offset] &= ~(1 << (y % 8));
 	}
 }
+
+/*
+ * Helpers for page packed buffers in SSD1306 layout: each byte holds a
+ * column of 8 pixels, LSB at the top, stride bytes per page.
+ * Columns are handled as up to 56 bits at once, LSB at the top.
+ */
+#define FB_COLUMN_MAX_HEIGHT	56
+
+static inline uint64_t fb_column_mask(unsigned int height) {
+	return height >= 64 ? UINT64_MAX : (1ULL << height) - 1;
+}
+
+static inline void fb_pages_write_column(uint8_t *pages, unsigned int stride, unsigned int x, unsigned int y, uint64_t bits, unsigned int height) {
+	uint8_t *dst = &pages[(y / 8) * stride + x];
+	uint64_t mask = fb_column_mask(height) << (y % 8);
+
+	bits <<= y % 8;
+	while (mask) {
+		*dst = (*dst & ~mask) | (bits & mask);
+		dst += stride;
+		bits >>= 8;
+		mask >>= 8;
+	}
+}
+
+static inline void fb_pages_invert_column(uint8_t *pages, unsigned int stride, unsigned int x, unsigned int y, unsigned int height) {
+	uint8_t *dst = &pages[(y / 8) * stride + x];
+	uint64_t mask = fb_column_mask(height) << (y % 8);
+
+	while (mask) {
+		*dst ^= mask;
+		dst += stride;
+		mask >>= 8;
+	}
+}
+
+static inline uint64_t fb_pages_read_column(const uint8_t *pages, unsigned int stride, unsigned int x, unsigned int y, unsigned int height) {
+	const uint8_t *src = &pages[(y / 8) * stride + x];
+	unsigned int bits_read = 0;
+	uint64_t bits = 0;
+
+	while (bits_read < y % 8 + height) {
+		bits |= (uint64_t)*src << bits_read;
+		src += stride;
+		bits_read += 8;
+	}
+	return (bits >> (y % 8)) & fb_column_mask(height);
+}
@@ -5,41 +5,128 @@
 
 #include "util.h"
 
-#define GLYPH_BASE 33
-
-static const uint16_t glyphs[] = {
-	0x4124, 0x002D, 0x5F7D, 0x7DDF, 0x52A5, 0x73CB, 0x0024, 0x4494, 0x2922, 
-	0x0155, 0x05D0, 0x4C00, 0x01C0, 0x2000, 0x12A4, 0x2B6A, 0x749A, 0x72A3, 
-	0x79A7, 0x49ED, 0x39CF, 0x7BCE, 0x12A7, 0x7BEF, 0x39EF, 0x0410, 0x4C20, 
-	0x4454, 0x0E38, 0x1511, 0x21A7, 0x736F, 0x5BEF, 0x3AEB, 0x624E, 0x3B6B, 
-	0x73CF, 0x13CF, 0x6B4E, 0x5BED, 0x7497, 0x7B24, 0x5AED, 0x7249, 0x5B7D, 
-	0x5B6F, 0x7B6F, 0x13EF, 0x76DB, 0x5AEB, 0x388E, 0x2497, 0x7B6D, 0x3B6D, 
-	0x5F6D, 0x5AAD, 0x25ED, 0x72A7, 0x6496, 0x4889, 0x6926, 0x016A, 0x7000, 
-	0x0022, 0x7BE7, 0x7BC9, 0x73C0, 0x7BE4, 0x73EF, 0x25D6, 0x79FC, 0x5BC9, 
-	0x2482, 0x7904, 0x5749, 0x6493, 0x5FC0, 0x5BC0, 0x7BC0, 0x1F78, 0x4F78, 
-	0x13C0, 0x7CF8, 0x24BA, 0x7B40, 0x3B40, 0x7F40, 0x5540, 0x79ED, 0x77B8, 
-	0x6456, 0x4924, 0x3513, 0x001E, 
+#define GLYPH_BASE	33
+#define GLYPH_WIDTH	3
+#define GLYPH_HEIGHT	5
+#define GLYPH_ADVANCE	4
+
+/*
+ * Glyph atlas in display layout: one byte per column, top row in the LSB.
+ * Glyphs are blitted column by column without decoding individual pixels.
+ */
+static const uint8_t glyph_columns[][GLYPH_WIDTH] = {
+	{ 0x00, 0x00, 0x17 }, // !
+	{ 0x03, 0x00, 0x03 }, // "
+	{ 0x1f, 0x0a, 0x1f }, // #
+	{ 0x17, 0x1f, 0x1d }, // $
+	{ 0x19, 0x04, 0x13 }, // %
+	{ 0x1f, 0x15, 0x14 }, // &
+	{ 0x00, 0x00, 0x03 }, // '
+	{ 0x00, 0x0e, 0x11 }, // (
+	{ 0x00, 0x11, 0x0e }, // )
+	{ 0x05, 0x02, 0x05 }, // *
+	{ 0x04, 0x0e, 0x04 }, // +
+	{ 0x00, 0x08, 0x18 }, // ,
+	{ 0x04, 0x04, 0x04 }, // -
+	{ 0x00, 0x10, 0x00 }, // .
+	{ 0x18, 0x04, 0x03 }, // /
+	{ 0x0e, 0x11, 0x0e }, // 0
+	{ 0x12, 0x1f, 0x10 }, // 1
+	{ 0x19, 0x15, 0x12 }, // 2
+	{ 0x11, 0x15, 0x1f }, // 3
+	{ 0x07, 0x04, 0x1f }, // 4
+	{ 0x17, 0x15, 0x0d }, // 5
+	{ 0x1e, 0x15, 0x1d }, // 6
+	{ 0x19, 0x05, 0x03 }, // 7
+	{ 0x1f, 0x15, 0x1f }, // 8
+	{ 0x17, 0x15, 0x0f }, // 9
+	{ 0x00, 0x0a, 0x00 }, // :
+	{ 0x00, 0x08, 0x1a }, // ;
+	{ 0x04, 0x0a, 0x11 }, // <
+	{ 0x0a, 0x0a, 0x0a }, // =
+	{ 0x11, 0x0a, 0x04 }, // >
+	{ 0x01, 0x15, 0x07 }, // ?
+	{ 0x1f, 0x11, 0x17 }, // @
+	{ 0x1f, 0x05, 0x1f }, // A
+	{ 0x1f, 0x15, 0x0a }, // B
+	{ 0x0e, 0x11, 0x11 }, // C
+	{ 0x1f, 0x11, 0x0e }, // D
+	{ 0x1f, 0x15, 0x15 }, // E
+	{ 0x1f, 0x05, 0x05 }, // F
+	{ 0x0e, 0x11, 0x1d }, // G
+	{ 0x1f, 0x04, 0x1f }, // H
+	{ 0x11, 0x1f, 0x11 }, // I
+	{ 0x18, 0x10, 0x1f }, // J
+	{ 0x1f, 0x04, 0x1b }, // K
+	{ 0x1f, 0x10, 0x10 }, // L
+	{ 0x1f, 0x02, 0x1f }, // M
+	{ 0x1f, 0x01, 0x1f }, // N
+	{ 0x1f, 0x11, 0x1f }, // O
+	{ 0x1f, 0x05, 0x07 }, // P
+	{ 0x1f, 0x1f, 0x10 }, // Q
+	{ 0x1f, 0x05, 0x1a }, // R
+	{ 0x12, 0x15, 0x09 }, // S
+	{ 0x01, 0x1f, 0x01 }, // T
+	{ 0x1f, 0x10, 0x1f }, // U
+	{ 0x1f, 0x10, 0x0f }, // V
+	{ 0x1f, 0x08, 0x1f }, // W
+	{ 0x1b, 0x04, 0x1b }, // X
+	{ 0x07, 0x1c, 0x07 }, // Y
+	{ 0x19, 0x15, 0x13 }, // Z
+	{ 0x00, 0x1f, 0x11 }, // [
+	{ 0x03, 0x04, 0x18 }, // backslash
+	{ 0x00, 0x11, 0x1f }, // ]
+	{ 0x06, 0x01, 0x06 }, // ^
+	{ 0x10, 0x10, 0x10 }, // _
+	{ 0x00, 0x01, 0x02 }, // `
+	{ 0x1d, 0x15, 0x1f }, // a
+	{ 0x1f, 0x14, 0x1c }, // b
+	{ 0x1c, 0x14, 0x14 }, // c
+	{ 0x1c, 0x14, 0x1f }, // d
+	{ 0x1f, 0x15, 0x17 }, // e
+	{ 0x04, 0x1f, 0x05 }, // f
+	{ 0x16, 0x16, 0x1f }, // g
+	{ 0x1f, 0x04, 0x1c }, // h
+	{ 0x00, 0x1d, 0x00 }, // i
+	{ 0x10, 0x10, 0x1d }, // j
+	{ 0x1f, 0x08, 0x14 }, // k
+	{ 0x01, 0x1f, 0x10 }, // l
+	{ 0x1c, 0x0c, 0x1c }, // m
+	{ 0x1c, 0x04, 0x1c }, // n
+	{ 0x1c, 0x14, 0x1c }, // o
+	{ 0x1e, 0x0a, 0x0e }, // p
+	{ 0x0e, 0x0a, 0x1e }, // q
+	{ 0x1c, 0x04, 0x04 }, // r
+	{ 0x16, 0x1e, 0x1a }, // s
+	{ 0x02, 0x1f, 0x02 }, // t
+	{ 0x1c, 0x10, 0x1c }, // u
+	{ 0x1c, 0x10, 0x0c }, // v
+	{ 0x1c, 0x18, 0x1c }, // w
+	{ 0x14, 0x08, 0x14 }, // x
+	{ 0x17, 0x14, 0x1f }, // y
+	{ 0x1a, 0x1e, 0x16 }, // z
+	{ 0x04, 0x1b, 0x11 }, // {
+	{ 0x00, 0x00, 0x1f }, // |
+	{ 0x11, 0x1b, 0x04 }, // }
+	{ 0x02, 0x03, 0x01 }, // ~
 };
 
-static uint16_t get_glyph_data(char glyph) {
-	uint16_t glyph_data = 0;
+static const uint8_t glyph_blank[GLYPH_WIDTH] = { 0 };
 
-	if (glyph >= GLYPH_BASE && glyph - GLYPH_BASE < ARRAY_SIZE(glyphs)) {
-		unsigned int glyph_index = glyph - GLYPH_BASE;
-		glyph_data = glyphs[glyph_index];
+static const uint8_t *get_glyph_columns(char glyph) {
+	if (glyph >= GLYPH_BASE && (size_t)(glyph - GLYPH_BASE) < ARRAY_SIZE(glyph_columns)) {
+		return glyph_columns[glyph - GLYPH_BASE];
 	}
 
-	return glyph_data;
+	return glyph_blank;
 }
 
 static void font_3x5_render_glyph(char glyph, fb_t *fb, unsigned int x, unsigned int y) {
-	uint16_t glyph_data = get_glyph_data(glyph);
-	unsigned int bit = 0;
+	const uint8_t *columns = get_glyph_columns(glyph);
 
-	for (unsigned int off_y = 0; off_y < 5; off_y++) {
-		for (unsigned int off_x = 0; off_x < 3; off_x++) {
-			fb_set_pixel(fb, x + off_x, y + off_y, !!(glyph_data & (1 << bit)));
-			bit++;
+	for (unsigned int off_y = 0; off_y < GLYPH_HEIGHT; off_y++) {
+		for (unsigned int off_x = 0; off_x < GLYPH_WIDTH; off_x++) {
+			fb_set_pixel(fb, x + off_x, y + off_y, !!(columns[off_x] & (1 << off_y)));
 		}
 	}
 }
@@ -47,58 +134,71 @@ static void font_3x5_render_glyph(char glyph, fb_t *fb, unsigned int x, unsigned
 void font_3x5_render_string(const char *str, fb_t *fb, unsigned int x, unsigned int y) {
 	while (*str) {
 		font_3x5_render_glyph(*str++, fb, x, y);
-		x += 4;
+		x += GLYPH_ADVANCE;
 	}
 }
 
 void font_3x5_calculate_text_params(const char *str, font_text_params_t *params) {
-	unsigned int len = strlen(str) * 4;
+	unsigned int len = strlen(str) * GLYPH_ADVANCE;
 
 	if (len > 0) {
 		len--;
 	}
 
 	params->effective_size.x = len;
-	params->effective_size.y = 5;
+	params->effective_size.y = GLYPH_HEIGHT;
 }
 
+/*
+ * Renders a run of text. All glyphs share the same vertical position, thus
+ * the page masks are computed once and every column is a one or two byte
+ * read-modify-write.
+ */
 void font_3x5_render_string2(const char *str, const font_text_params_t *params, const font_vec_t *source_offset, const font_fb_t *fb) {
-	font_vec_t pos = { 0, 0 };
+	int dst_x = -source_offset->x;
+	int dst_y = -source_offset->y;
+	int end_x = MIN(fb->size.x, dst_x + params->effective_size.x);
+	unsigned int skip_y = 0;
+	unsigned int shift;
+	uint16_t mask;
+	uint8_t *column_ptr;
+	int height;
+
+	if (dst_y < 0) {
+		skip_y = -dst_y;
+		dst_y = 0;
+	}
+	height = MIN(GLYPH_HEIGHT - (int)skip_y, fb->size.y - dst_y);
+	if (height <= 0) {
+		return;
+	}
 
-	while (*str) {
-		char c = *str++;
-		int dst_x = pos.x - source_offset->x;
-		int dst_y = pos.y - source_offset->y;
-		unsigned int offset_x = 0;
-		uint16_t glyph_data = get_glyph_data(c);
-
-		if (dst_x < 0) {
-			offset_x += -dst_x;
-			dst_x = 0;
-		}
-		if (dst_x < fb->size.x && dst_y < fb->size.y && offset_x < 3) {
-			unsigned int draw_width = MIN(3, fb->size.x - dst_x);
-			unsigned int draw_height = MIN(5, fb->size.y - dst_y);
-			unsigned int y = 0;
+	shift = (fb->origin.y + dst_y) % 8;
+	mask = ((1U << height) - 1) << shift;
+	column_ptr = &fb->pages[((fb->origin.y + dst_y) / 8) * fb->stride + fb->origin.x];
 
-			if (dst_y < 0) {
-				y = -dst_y;
-			}
-			for (; y < draw_height; y++) {
-				unsigned int x = offset_x;
-
-				for (; x < draw_width - offset_x; x++) {
-					unsigned int bit = y * 3 + x;
-
-					if (glyph_data & (1 << bit)) {
-						fb->pixels[(dst_y + y) * fb->stride + dst_x + x] = 0xff;
-					} else {
-						fb->pixels[(dst_y + y) * fb->stride + dst_x + x] = 0;
-					}
-				}
+	// Skip glyphs left of the visible area
+	while (*str && dst_x + GLYPH_WIDTH <= 0) {
+		str++;
+		dst_x += GLYPH_ADVANCE;
+	}
+
+	while (*str && dst_x < end_x) {
+		const uint8_t *columns = get_glyph_columns(*str++);
+		int x = MAX(dst_x, 0);
+		int glyph_end_x = MIN(dst_x + GLYPH_WIDTH, end_x);
+
+		for (; x < glyph_end_x; x++) {
+			uint16_t bits = (uint16_t)(columns[x - dst_x] >> skip_y) << shift;
+			uint8_t *dst = &column_ptr[x];
+
+			*dst = (*dst & ~mask) | (bits & mask);
+			if (mask >> 8) {
+				dst += fb->stride;
+				*dst = (*dst & ~(mask >> 8)) | ((bits >> 8) & (mask >> 8));
 			}
 		}
 
-		pos.x += 4;
+		dst_x += GLYPH_ADVANCE;
 	}
 }
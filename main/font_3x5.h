@@ -7,9 +7,11 @@ typedef struct font_vec {
 	int y;
 } font_vec_t;
 
+// Page packed 1 bpp target, see fb.h
 typedef struct font_fb {
-	uint8_t *pixels;
+	uint8_t *pages;
 	unsigned int stride;
+	font_vec_t origin;
 	font_vec_t size;
 } font_fb_t;
 
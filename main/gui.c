@@ -1,15 +1,149 @@
 #include "gui.h"
 
+#include <limits.h>
 #include <stddef.h>
+#include <string.h>
 
 #include <esp_log.h>
+#include <esp_timer.h>
 
+#include "fb.h"
 #include "font_3x5.h"
 #include "gui_priv.h"
 #include "util.h"
 
 static const char *TAG = "gui";
 
+static const gui_element_ops_t gui_ops;
+
+static bool gui_area_overlaps(const gui_area_t *a, const gui_area_t *b) {
+	return a->position.x < b->position.x + b->size.x && b->position.x < a->position.x + a->size.x &&
+	       a->position.y < b->position.y + b->size.y && b->position.y < a->position.y + a->size.y;
+}
+
+static void gui_area_union(gui_area_t *dst, const gui_area_t *src) {
+	int end_x = MAX(dst->position.x + dst->size.x, src->position.x + src->size.x);
+	int end_y = MAX(dst->position.y + dst->size.y, src->position.y + src->size.y);
+
+	dst->position.x = MIN(dst->position.x, src->position.x);
+	dst->position.y = MIN(dst->position.y, src->position.y);
+	dst->size.x = end_x - dst->position.x;
+	dst->size.y = end_y - dst->position.y;
+}
+
+// Returns false if nothing of area is left after clipping
+static bool gui_area_clip(gui_area_t *area, const gui_area_t *bounds) {
+	int start_x = MAX(area->position.x, bounds->position.x);
+	int start_y = MAX(area->position.y, bounds->position.y);
+	int end_x = MIN(area->position.x + area->size.x, bounds->position.x + bounds->size.x);
+	int end_y = MIN(area->position.y + area->size.y, bounds->position.y + bounds->size.y);
+
+	area->position.x = start_x;
+	area->position.y = start_y;
+	area->size.x = MAX(end_x - start_x, 0);
+	area->size.y = MAX(end_y - start_y, 0);
+	return area->size.x && area->size.y;
+}
+
+static int gui_area_pixels(const gui_area_t *area) {
+	return area->size.x * area->size.y;
+}
+
+static void gui_damage_add(gui_damage_t *damage, const gui_area_t *area) {
+	unsigned int i, best = 0;
+	int best_growth = INT_MAX;
+
+	if (area->size.x <= 0 || area->size.y <= 0) {
+		return;
+	}
+
+	for (i = 0; i < damage->num_areas; i++) {
+		if (gui_area_overlaps(&damage->areas[i], area)) {
+			gui_area_union(&damage->areas[i], area);
+			return;
+		}
+	}
+
+	if (damage->num_areas < GUI_MAX_DAMAGE_AREAS) {
+		damage->areas[damage->num_areas++] = *area;
+		return;
+	}
+
+	// Out of slots, merge with the area that grows the least
+	for (i = 0; i < damage->num_areas; i++) {
+		gui_area_t merged = damage->areas[i];
+		int growth;
+
+		gui_area_union(&merged, area);
+		growth = gui_area_pixels(&merged) - gui_area_pixels(&damage->areas[i]);
+		if (growth < best_growth) {
+			best_growth = growth;
+			best = i;
+		}
+	}
+	gui_area_union(&damage->areas[best], area);
+}
+
+static gui_t *gui_element_get_gui(gui_element_t *elem) {
+	while (elem->parent) {
+		elem = elem->parent;
+	}
+
+	if (elem->ops != &gui_ops) {
+		return NULL;
+	}
+	return container_of(elem, gui_t, container.element);
+}
+
+// True if the element and all its parents are visible and it is attached to a GUI
+static bool gui_element_is_visible(gui_element_t *elem) {
+	for (; elem->parent; elem = elem->parent) {
+		if (elem->hidden || !elem->shown) {
+			return false;
+		}
+	}
+
+	return elem->ops == &gui_ops;
+}
+
+// Records the visible part of an element as damaged in the GUI it is attached to
+static void gui_element_damage(gui_element_t *elem) {
+	gui_area_t area = elem->area;
+	gui_element_t *parent = elem->parent;
+
+	while (parent) {
+		if (parent->hidden || !parent->shown) {
+			return;
+		}
+
+		if (parent->ops->translate_child_damage) {
+			parent->ops->translate_child_damage(parent, &area);
+		}
+
+		if (!parent->parent) {
+			// Root element, area is in screen coordinates now
+			if (parent->ops == &gui_ops) {
+				gui_t *gui = container_of(parent, gui_t, container.element);
+
+				gui_damage_add(&gui->damage, &area);
+			}
+			return;
+		}
+
+		// Children are clipped by their parent during rendering
+		gui_area_t bounds = {
+			.position = { 0, 0 },
+			.size = parent->area.size
+		};
+		if (!gui_area_clip(&area, &bounds)) {
+			return;
+		}
+		area.position.x += parent->area.position.x;
+		area.position.y += parent->area.position.y;
+		parent = parent->parent;
+	}
+}
+
 gui_element_t *gui_element_init(gui_element_t *elem, const gui_element_ops_t *ops) {
 	INIT_LIST_HEAD(elem->list);
 	elem->parent = NULL;
@@ -29,9 +163,11 @@ void gui_element_check_render(gui_element_t *elem) {
 }
 
 static void gui_element_invalidate_ignore_hidden_shown(gui_element_t *elem) {
+	gui_element_damage(elem);
+
 	elem->dirty = true;
-	if (elem->parent) {
-		gui_element_invalidate(elem->parent);
+	for (elem = elem->parent; elem && !elem->hidden && elem->shown; elem = elem->parent) {
+		elem->dirty = true;
 	}
 }
 
@@ -47,21 +183,60 @@ void gui_element_invalidate(gui_element_t *elem) {
 	}
 }
 
-static void gui_fb_invert_area(const gui_fb_t *fb, const gui_area_t *area) {
-	unsigned int x, y;
+static void gui_fb_fill_area(const gui_fb_t *fb, gui_pixel_t color, const gui_area_t *area) {
+	uint64_t bits = color ? UINT64_MAX : 0;
+	int x, y;
+
+	for (y = 0; y < area->size.y; y += FB_COLUMN_MAX_HEIGHT) {
+		unsigned int height = MIN(area->size.y - y, FB_COLUMN_MAX_HEIGHT);
 
-	for (y = 0; y < area->size.y; y++) {
 		for (x = 0; x < area->size.x; x++) {
-			unsigned int index = y * fb->stride + x;
+			fb_pages_write_column(fb->pages, fb->stride,
+					      fb->origin.x + area->position.x + x,
+					      fb->origin.y + area->position.y + y,
+					      bits, height);
+		}
+	}
+}
 
-			fb->pixels[index] = GUI_INVERT_PIXEL(fb->pixels[index]);
+static void gui_fb_memset(const gui_fb_t *fb, gui_pixel_t color, const gui_point_t *size) {
+	const gui_area_t area = {
+		.position = { 0, 0 },
+		.size = *size
+	};
+
+	gui_fb_fill_area(fb, color, &area);
+}
+
+static void gui_fb_invert_area(const gui_fb_t *fb, const gui_area_t *area) {
+	int x, y;
+
+	for (y = 0; y < area->size.y; y += FB_COLUMN_MAX_HEIGHT) {
+		unsigned int height = MIN(area->size.y - y, FB_COLUMN_MAX_HEIGHT);
+
+		for (x = 0; x < area->size.x; x++) {
+			fb_pages_invert_column(fb->pages, fb->stride,
+					       fb->origin.x + area->position.x + x,
+					       fb->origin.y + area->position.y + y,
+					       height);
 		}
 	}
 }
 
+static void gui_fb_get_sub_fb(const gui_fb_t *fb, const gui_point_t *position, gui_fb_t *sub_fb) {
+	*sub_fb = *fb;
+	sub_fb->origin.x += position->x;
+	sub_fb->origin.y += position->y;
+}
+
 static int gui_element_render(gui_element_t *elem, const gui_point_t *source_offset, const gui_fb_t *fb, const gui_point_t *destination_size) {
 	int ret = -1;
-	if (elem->shown && !elem->hidden && elem->ops->render) {
+	if (!elem->shown || elem->hidden) {
+		elem->dirty = false;
+		return ret;
+	}
+
+	if (elem->ops->render) {
 		ret = elem->ops->render(elem, source_offset, fb, destination_size);
 	}
 
@@ -89,7 +264,25 @@ static void gui_element_set_shown(gui_element_t *element, bool shown) {
 	gui_element_invalidate_ignore_hidden_shown(element);
 }
 
-static int gui_container_render(gui_element_t *element, const gui_point_t *source_offset, const gui_fb_t *fb, const gui_point_t *destination_size) {
+static void gui_fb_blit(const gui_fb_t *fb, const gui_fb_t *src, const gui_point_t *size) {
+	int x, y;
+
+	for (y = 0; y < size->y; y += FB_COLUMN_MAX_HEIGHT) {
+		unsigned int height = MIN(size->y - y, FB_COLUMN_MAX_HEIGHT);
+
+		for (x = 0; x < size->x; x++) {
+			uint64_t bits = fb_pages_read_column(src->pages, src->stride,
+							     src->origin.x + x, src->origin.y + y,
+							     height);
+
+			fb_pages_write_column(fb->pages, fb->stride,
+					      fb->origin.x + x, fb->origin.y + y,
+					      bits, height);
+		}
+	}
+}
+
+static int gui_container_render_children(gui_element_t *element, const gui_point_t *source_offset, const gui_fb_t *fb, const gui_point_t *destination_size) {
 	int ret = -1;
 	gui_container_t *container = container_of(element, gui_container_t, element);
 
@@ -100,9 +293,7 @@ static int gui_container_render(gui_element_t *element, const gui_point_t *sourc
 		// Render area realtive to container
 		gui_area_t render_area = cursor->area;
 		gui_point_t local_source_offset = *source_offset;
-		gui_fb_t local_fb = {
-			.stride = fb->stride
-		};
+		gui_fb_t local_fb;
 		int retval;
 
 		// Check if there is anything to render
@@ -149,7 +340,7 @@ static int gui_container_render(gui_element_t *element, const gui_point_t *sourc
 			local_source_offset.y = 0;
 		}
 
-		local_fb.pixels = &fb->pixels[render_area.position.y * fb->stride + render_area.position.x];
+		gui_fb_get_sub_fb(fb, &render_area.position, &local_fb);
 
 		retval = gui_element_render(cursor, &local_source_offset, &local_fb, &render_area.size);
 		if (ret == -1) {
@@ -162,6 +353,42 @@ static int gui_container_render(gui_element_t *element, const gui_point_t *sourc
 	return ret;
 }
 
+static bool gui_container_cache_usable(const gui_container_t *container) {
+	const gui_point_t *size = &container->element.area.size;
+
+	return container->cache &&
+	       (size_t)GUI_CONTAINER_CACHE_SIZE(size->x, size->y) <= container->cache_size;
+}
+
+static int gui_container_render(gui_element_t *element, const gui_point_t *source_offset, const gui_fb_t *fb, const gui_point_t *destination_size) {
+	gui_container_t *container = container_of(element, gui_container_t, element);
+	const gui_point_t no_offset = { 0, 0 };
+	gui_fb_t cache_fb = {
+		.pages = container->cache,
+		.stride = element->area.size.x,
+		.origin = { 0, 0 }
+	};
+	gui_point_t size;
+
+	if (!gui_container_cache_usable(container)) {
+		return gui_container_render_children(element, source_offset, fb, destination_size);
+	}
+
+	// Dirty means a child changed since the container was rendered last
+	if (!container->cache_valid || element->dirty) {
+		ESP_LOGD(TAG, "Updating container cache");
+		gui_fb_memset(&cache_fb, GUI_COLOR_BLACK, &element->area.size);
+		gui_container_render_children(element, &no_offset, &cache_fb, &element->area.size);
+		container->cache_valid = true;
+	}
+
+	size.x = MIN(element->area.size.x - source_offset->x, destination_size->x);
+	size.y = MIN(element->area.size.y - source_offset->y, destination_size->y);
+	cache_fb.origin = *source_offset;
+	gui_fb_blit(fb, &cache_fb, &size);
+	return -1;
+}
+
 static void gui_container_update_shown(gui_element_t *element) {
 	gui_container_t *container = container_of(element, gui_container_t, element);
 
@@ -179,6 +406,9 @@ static const gui_element_ops_t gui_container_ops = {
 static gui_element_t *gui_container_init_(gui_container_t *container, const gui_element_ops_t *ops) {
 	gui_element_init(&container->element, ops);
 	INIT_LIST_HEAD(container->children);
+	container->cache = NULL;
+	container->cache_size = 0;
+	container->cache_valid = false;
 	return &container->element;
 }
 
@@ -187,6 +417,8 @@ gui_element_t *gui_container_init(gui_container_t *container) {
 }
 
 static void gui_element_set_size_(gui_element_t *elem, unsigned int width, unsigned int height) {
+	// Damage previous area, too
+	gui_element_invalidate(elem);
 	elem->area.size.x = width;
 	elem->area.size.y = height;
 	gui_element_invalidate(elem);
@@ -205,9 +437,9 @@ static int gui_list_render(gui_element_t *element, const gui_point_t *source_off
 		if (list->last_y_scroll_pos > area->position.y) {
 			// Top of entry would be clipped, scroll to show it
 			list->last_y_scroll_pos = area->position.y - 1;
-		} else if (area->position.y + area->size.y - list->last_y_scroll_pos + 1 >= destination_size->y) {
+		} else if (area->position.y + area->size.y - list->last_y_scroll_pos + 1 >= element->area.size.y) {
 			// Bottom of entry would be clipped, scroll to show it
-			list->last_y_scroll_pos = area->position.y + area->size.y - destination_size->y + 1;
+			list->last_y_scroll_pos = area->position.y + area->size.y - element->area.size.y + 1;
 		}
 		ESP_LOGD(TAG, "Need to scroll by %d pixels to show selected entry", list->last_y_scroll_pos);
 	}
@@ -217,9 +449,7 @@ static int gui_list_render(gui_element_t *element, const gui_point_t *source_off
 		// Render area relative to list
 		gui_point_t scrolled_source_offset = *source_offset;
 		gui_area_t render_area = cursor->area;
-		gui_fb_t local_fb = {
-			.stride = fb->stride
-		};
+		gui_fb_t local_fb;
 		int retval;
 
 		ESP_LOGD(TAG, "Entry size: %dx%d", render_area.size.x, render_area.size.y);
@@ -260,15 +490,15 @@ static int gui_list_render(gui_element_t *element, const gui_point_t *source_off
 			scrolled_source_offset.y = 0;
 		}
 
-		local_fb.pixels = &fb->pixels[render_area.position.y * fb->stride + render_area.position.x];
+		gui_fb_get_sub_fb(fb, &render_area.position, &local_fb);
 
-		// Clip rendering area size by destination area
-		if (render_area.position.x + render_area.size.x - scrolled_source_offset.x > destination_size->x) {
-			render_area.size.x = destination_size->x - render_area.position.x + scrolled_source_offset.x;
+		// Clip rendering area size by destination area, position is relative to fb already
+		if (render_area.position.x + render_area.size.x > destination_size->x) {
+			render_area.size.x = destination_size->x - render_area.position.x;
 			ESP_LOGD(TAG, "Limiting horizontal size of render area to %d", render_area.size.x);
 		}
-		if (render_area.position.y + render_area.size.y - scrolled_source_offset.y > destination_size->y) {
-			render_area.size.y = destination_size->y - render_area.position.y + scrolled_source_offset.y;
+		if (render_area.position.y + render_area.size.y > destination_size->y) {
+			render_area.size.y = destination_size->y - render_area.position.y;
 			ESP_LOGD(TAG, "Limiting vertical size of render area to %d", render_area.size.y);
 		}
 
@@ -295,9 +525,17 @@ static int gui_list_render(gui_element_t *element, const gui_point_t *source_off
 	return ret;
 }
 
+// Children of scrolling containers move during rendering, damage all of it
+static void gui_scrolling_translate_child_damage(gui_element_t *element, gui_area_t *area) {
+	area->position.x = 0;
+	area->position.y = 0;
+	area->size = element->area.size;
+}
+
 static const gui_element_ops_t gui_list_ops = {
 	.render = gui_list_render,
 	.update_shown = gui_container_update_shown,
+	.translate_child_damage = gui_scrolling_translate_child_damage,
 };
 
 gui_element_t *gui_list_init(gui_list_t *list) {
@@ -307,19 +545,104 @@ gui_element_t *gui_list_init(gui_list_t *list) {
 	return &list->container.element;
 }
 
+gui_element_t *gui_virtual_list_init(gui_virtual_list_t *list, gui_virtual_list_row_t *rows, unsigned int num_rows,
+				     unsigned int row_height, gui_virtual_list_provider_t provider, void *priv) {
+	unsigned int i;
+
+	gui_container_init(&list->container);
+	list->row_height = row_height;
+	list->provider = provider;
+	list->priv = priv;
+	list->rows = rows;
+	list->num_rows = num_rows;
+	list->num_entries = 0;
+	list->selected_index = -1;
+	list->first_visible_index = 0;
+
+	for (i = 0; i < num_rows; i++) {
+		gui_virtual_list_row_t *row = &rows[i];
+
+		row->text[0] = '\0';
+		gui_label_init(&row->label, row->text);
+		gui_element_set_hidden(&row->label.element, true);
+		gui_element_set_size(&row->label.element, 0, row_height);
+		gui_element_set_position(&row->label.element, 0, i * row_height);
+		gui_element_add_child(&list->container.element, &row->label.element);
+	}
+
+	return &list->container.element;
+}
+
+static void gui_virtual_list_scroll_to_selected(gui_virtual_list_t *list) {
+	int full_rows = MAX(list->container.element.area.size.y / (int)list->row_height, 1);
+	int first = list->first_visible_index;
+
+	if (list->selected_index >= 0) {
+		if (list->selected_index < first) {
+			first = list->selected_index;
+		} else if (list->selected_index >= first + full_rows) {
+			first = list->selected_index - full_rows + 1;
+		}
+	}
+
+	// Do not leave empty rows at the bottom after entries were removed
+	first = MIN(first, MAX((int)list->num_entries - full_rows, 0));
+	list->first_visible_index = first;
+}
+
+// Binds the row pool to the visible entries, rows are only touched if their content changes
+static void gui_virtual_list_bind_rows(gui_virtual_list_t *list) {
+	gui_element_t *element = &list->container.element;
+	unsigned int visible_rows = MIN(list->num_rows, DIV_ROUND_UP(element->area.size.y, list->row_height));
+	unsigned int i;
+
+	for (i = 0; i < list->num_rows; i++) {
+		gui_virtual_list_row_t *row = &list->rows[i];
+		unsigned int index = list->first_visible_index + i;
+		bool visible = i < visible_rows && index < list->num_entries;
+		bool selected = visible && (int)index == list->selected_index;
+
+		if (row->label.element.area.size.x != element->area.size.x) {
+			gui_element_set_size(&row->label.element, element->area.size.x, list->row_height);
+		}
+
+		if (visible) {
+			char text[GUI_VIRTUAL_LIST_TEXT_LEN] = "";
+
+			list->provider(list->priv, index, text, sizeof(text));
+			text[sizeof(text) - 1] = '\0';
+			if (strcmp(text, row->text)) {
+				strcpy(row->text, text);
+				gui_label_set_text(&row->label, row->text);
+			}
+		}
+
+		if (row->label.element.hidden == visible) {
+			gui_element_set_hidden(&row->label.element, !visible);
+		}
+		if (row->label.element.inverted != selected) {
+			gui_element_set_inverted(&row->label.element, selected);
+		}
+	}
+}
+
 static int gui_image_render(gui_element_t *element, const gui_point_t *source_offset, const gui_fb_t *fb, const gui_point_t *destination_size) {
 	gui_image_t *image = container_of(element, gui_image_t, element);
 	int copy_width = MIN(element->area.size.x - source_offset->x, destination_size->x);
 	int copy_height = MIN(element->area.size.y - source_offset->y, destination_size->y);
-	unsigned int y;
+	int x, y;
 
 	ESP_LOGD(TAG, "Rendering image from [%d, %d] to [%d, %d]...", source_offset->x, source_offset->y, destination_size->x, destination_size->y);
 
-	for (y = 0; y < copy_height; y++) {
-		gui_pixel_t *dst = &fb->pixels[y * fb->stride];
-		const uint8_t *src = &image->image_data_start[image->element.area.size.x * (y + source_offset->y) + source_offset->x];
+	for (y = 0; y < copy_height; y += FB_COLUMN_MAX_HEIGHT) {
+		unsigned int height = MIN(copy_height - y, FB_COLUMN_MAX_HEIGHT);
 
-		memcpy(dst, src, copy_width * sizeof(gui_pixel_t));
+		for (x = 0; x < copy_width; x++) {
+			uint64_t bits = fb_pages_read_column(image->image_data_start, element->area.size.x,
+							     source_offset->x + x, source_offset->y + y, height);
+
+			fb_pages_write_column(fb->pages, fb->stride, fb->origin.x + x, fb->origin.y + y, bits, height);
+		}
 	}
 
 	return -1;
@@ -337,30 +660,138 @@ gui_element_t *gui_image_init(gui_image_t *image, unsigned int width, unsigned i
 	return &image->element;
 }
 
-static void gui_fb_memset(const gui_fb_t *fb, gui_pixel_t color, const gui_point_t *size) {
-	unsigned int x, y;
+// Swaps pending state into the GUI, updaters are only blocked for the duration of the copy
+static void gui_apply_updates(gui_t *gui) {
+	gui_update_t *cursor;
+	struct list_head *next;
 
-	for (y = 0; y < size->y; y++) {
-		for (x = 0; x < size->x; x++) {
-			fb->pixels[y * fb->stride + x] = color;
+	xSemaphoreTake(gui->update_lock, portMAX_DELAY);
+	LIST_FOR_EACH_ENTRY_SAFE(cursor, next, &gui->updates, list) {
+		LIST_DELETE(&cursor->list);
+		cursor->queued = false;
+		cursor->apply(cursor);
+	}
+	xSemaphoreGive(gui->update_lock);
+}
+
+// Advances all animations to the frame time, returns time of the next change in us or -1
+static int64_t gui_animations_tick(gui_t *gui) {
+	int64_t next_us = -1;
+	gui_animation_t *cursor;
+	struct list_head *next;
+
+	// Animations may stop themselves while ticking
+	LIST_FOR_EACH_ENTRY_SAFE(cursor, next, &gui->animations, list) {
+		int64_t due_us = cursor->tick(cursor, gui->frame_time_us);
+
+		if (due_us >= 0 && (next_us < 0 || due_us < next_us)) {
+			next_us = due_us;
 		}
 	}
+
+	return next_us;
 }
 
-int gui_render(gui_t *gui, gui_pixel_t *fb, unsigned int stride, const gui_point_t *size) {
-	int ret;
-	const gui_point_t offset = { 0, 0 };
-	gui_fb_t gui_fb = {
-		.pixels = fb,
-		.stride = stride
+int gui_render(gui_t *gui, uint8_t *pages, unsigned int stride, const gui_point_t *size, gui_damage_t *damage) {
+	int ret = -1;
+	const gui_area_t screen = {
+		.position = { 0, 0 },
+		.size = *size
 	};
+	gui_damage_t pending;
+	int64_t next_us;
+	unsigned int i;
+
+	// Updates and animations damage what they change, this must happen before pending damage is taken
+	gui_apply_updates(gui);
+	gui->frame_time_us = esp_timer_get_time();
+	next_us = gui_animations_tick(gui);
+	if (next_us >= 0) {
+		ret = DIV_ROUND_UP(MAX(next_us - gui->frame_time_us, 0), 1000);
+	}
+
+	pending = gui->damage;
+	gui->damage.num_areas = 0;
+
+	damage->num_areas = 0;
+	for (i = 0; i < pending.num_areas; i++) {
+		gui_area_t area = pending.areas[i];
+		gui_fb_t area_fb = {
+			.pages = pages,
+			.stride = stride,
+			.origin = area.position
+		};
+		int retval;
+
+		if (!gui_area_clip(&area, &screen)) {
+			continue;
+		}
+
+		ESP_LOGD(TAG, "Rendering damaged area [%d, %d] %dx%d", area.position.x, area.position.y, area.size.x, area.size.y);
+		gui_fb_memset(&area_fb, GUI_COLOR_BLACK, &area.size);
+		retval = gui_container_render(&gui->container.element, &area.position, &area_fb, &area.size);
+		if (ret == -1) {
+			ret = retval;
+		} else if (retval != -1) {
+			ret = MIN(ret, retval);
+		}
+		damage->areas[damage->num_areas++] = area;
+	}
 
-	gui_fb_memset(&gui_fb, GUI_COLOR_BLACK, size);
-	ret = gui_container_render(&gui->container.element, &offset, &gui_fb, size);
 	gui->container.element.dirty = false;
 	return ret;
 }
 
+void gui_update_init(gui_update_t *update, gui_update_apply_t apply) {
+	INIT_LIST_HEAD(update->list);
+	update->apply = apply;
+	update->queued = false;
+}
+
+void gui_update_lock(gui_t *gui) {
+	xSemaphoreTake(gui->update_lock, portMAX_DELAY);
+}
+
+void gui_update_unlock(gui_t *gui) {
+	xSemaphoreGive(gui->update_lock);
+}
+
+void gui_update_queue(gui_t *gui, gui_update_t *update) {
+	if (!update->queued) {
+		LIST_APPEND_TAIL(&update->list, &gui->updates);
+		update->queued = true;
+	}
+	if (gui->ops->request_render) {
+		gui->ops->request_render(gui);
+	}
+}
+
+void gui_animation_init(gui_animation_t *animation, gui_animation_tick_t tick) {
+	INIT_LIST_HEAD(animation->list);
+	animation->tick = tick;
+	animation->running = false;
+	animation->start_us = 0;
+}
+
+void gui_animation_start(gui_t *gui, gui_animation_t *animation) {
+	animation->start_us = esp_timer_get_time();
+	if (!animation->running) {
+		LIST_APPEND_TAIL(&animation->list, &gui->animations);
+		animation->running = true;
+	}
+	// First tick happens at the start of the next frame
+	if (gui->ops->request_render) {
+		gui->ops->request_render(gui);
+	}
+}
+
+void gui_animation_stop(gui_t *gui, gui_animation_t *animation) {
+	if (animation->running) {
+		LIST_DELETE(&animation->list);
+		animation->running = false;
+	}
+}
+
 static void gui_check_render(gui_element_t *element) {
 	gui_t *gui = container_of(element, gui_t, container.element);
 
@@ -381,6 +812,16 @@ gui_element_t *gui_init(gui_t *gui, void *priv, const gui_ops_t *ops) {
 	gui->priv = priv;
 	gui->ops = ops;
 	gui->lock = xSemaphoreCreateMutexStatic(&gui->lock_buffer);
+	gui->update_lock = xSemaphoreCreateMutexStatic(&gui->update_lock_buffer);
+	INIT_LIST_HEAD(gui->updates);
+	INIT_LIST_HEAD(gui->animations);
+	gui->frame_time_us = 0;
+	// Everything needs to be drawn initially, clipped to screen size during rendering
+	gui->damage.num_areas = 1;
+	gui->damage.areas[0].position.x = 0;
+	gui->damage.areas[0].position.y = 0;
+	gui->damage.areas[0].size.x = INT16_MAX;
+	gui->damage.areas[0].size.y = INT16_MAX;
 	return &gui->container.element;
 }
 
@@ -407,39 +848,31 @@ static int gui_rectangle_render(gui_element_t *element, const gui_point_t *sourc
 
 		gui_fb_memset(fb, rect->color, &fill_size);
 	} else {
-		unsigned int max_y = element->area.size.y - source_offset->y;
-		unsigned int max_x = element->area.size.x - source_offset->x;
+		int max_y = element->area.size.y - source_offset->y;
+		int max_x = element->area.size.x - source_offset->x;
 
 		if (source_offset->y == 0) {
-			unsigned int x;
+			const gui_area_t top = { { 0, 0 }, { width, 1 } };
 
-			for (x = 0; x < width; x++) {
-				fb->pixels[x] = rect->color;
-			}
+			gui_fb_fill_area(fb, rect->color, &top);
 		}
 
 		if (destination_size->y >= max_y) {
-			unsigned int x;
+			const gui_area_t bottom = { { 0, max_y - 1 }, { width, 1 } };
 
-			for (x = 0; x < width; x++) {
-				fb->pixels[(max_y - 1) * fb->stride + x] = rect->color;
-			}
+			gui_fb_fill_area(fb, rect->color, &bottom);
 		}
 
 		if (source_offset->x == 0) {
-			unsigned int y;
+			const gui_area_t left = { { 0, 0 }, { 1, height } };
 
-			for (y = 0; y < height; y++) {
-				fb->pixels[y * fb->stride] = rect->color;
-			}
+			gui_fb_fill_area(fb, rect->color, &left);
 		}
 
 		if (destination_size->x >= max_x) {
-			unsigned int y;
+			const gui_area_t right = { { max_x - 1, 0 }, { 1, height } };
 
-			for (y = 0; y < height; y++) {
-				fb->pixels[y * fb->stride + max_x - 1] = rect->color;
-			}
+			gui_fb_fill_area(fb, rect->color, &right);
 		}
 	}
 
@@ -455,6 +888,27 @@ gui_element_t *gui_rectangle_init(gui_rectangle_t *rectangle) {
 	return &rectangle->element;
 }
 
+/*
+ * Width of the label left visible by its parents. Text is aligned within
+ * it, as it was when every frame was rendered in full. Unlike the size of
+ * the part being rendered it does not depend on the damaged area.
+ */
+static int gui_label_visible_width(const gui_element_t *element) {
+	const gui_element_t *elem;
+	int start = 0;
+	int end = element->area.size.x;
+	int x = 0;
+
+	// The root has no size of its own, it is clipped to the render size
+	for (elem = element; elem->parent && elem->parent->parent; elem = elem->parent) {
+		x += elem->area.position.x;
+		start = MAX(start, -x);
+		end = MIN(end, elem->parent->area.size.x - x);
+	}
+
+	return MAX(end - start, 0);
+}
+
 static int gui_label_render(gui_element_t *element, const gui_point_t *source_offset, const gui_fb_t *fb, const gui_point_t *destination_size) {
 	gui_label_t *label = container_of(element, gui_label_t, element);
 	int width = MIN(element->area.size.x - source_offset->x, destination_size->x);
@@ -464,26 +918,26 @@ static int gui_label_render(gui_element_t *element, const gui_point_t *source_of
 		.x = source_offset->x,
 		.y = source_offset->y
 	};
-	int err;
 	int offset_x = label->text_offset.x;
 	int offset_y = label->text_offset.y;
-	font_text_params_t text_params;
+	const font_text_params_t *text_params = &label->text_params;
+	int align_width;
 
 	if (!label->text) {
 		return -1;
 	}
 
-	font_3x5_calculate_text_params(label->text, &text_params);
-
-	ESP_LOGD(TAG, "Size required to render string: %dx%d px", text_params.effective_size.x, text_params.effective_size.y);
+	ESP_LOGD(TAG, "Size required to render string: %dx%d px", text_params->effective_size.x, text_params->effective_size.y);
 
+	// Alignment is relative to the visible label, not just the part being rendered
+	align_width = gui_label_visible_width(element);
 	if (label->align == GUI_TEXT_ALIGN_END) {
-		if (width > text_params.effective_size.x) {
-			offset_x += width - text_params.effective_size.x;
+		if (align_width > text_params->effective_size.x) {
+			offset_x += align_width - text_params->effective_size.x;
 		}
 	} else if (label->align == GUI_TEXT_ALIGN_CENTER) {
-		if (width > text_params.effective_size.x) {
-			offset_x += (width - text_params.effective_size.x) / 2;
+		if (align_width > text_params->effective_size.x) {
+			offset_x += (align_width - text_params->effective_size.x) / 2;
 		}
 	}
 
@@ -502,12 +956,14 @@ static int gui_label_render(gui_element_t *element, const gui_point_t *source_of
 		font_source_offset.y = 0;
 	}
 
-	font_fb.pixels = &fb->pixels[offset_y * fb->stride + offset_x];
+	font_fb.pages = fb->pages;
 	font_fb.stride = fb->stride;
+	font_fb.origin.x = fb->origin.x + offset_x;
+	font_fb.origin.y = fb->origin.y + offset_y;
 	font_fb.size.x = width - offset_x;
 	font_fb.size.y = height - offset_y;
 
-	font_3x5_render_string2(label->text, &text_params, &font_source_offset, &font_fb);
+	font_3x5_render_string2(label->text, text_params, &font_source_offset, &font_fb);
 
 	return -1;
 }
@@ -516,43 +972,87 @@ static const gui_element_ops_t gui_label_ops = {
 	.render = gui_label_render,
 };
 
+static void gui_label_update_text(gui_label_t *label, const char *text) {
+	label->text = text;
+	if (text) {
+		font_3x5_calculate_text_params(text, &label->text_params);
+	} else {
+		memset(&label->text_params, 0, sizeof(label->text_params));
+	}
+}
+
 gui_element_t *gui_label_init(gui_label_t *label, const char *text) {
 	gui_element_init(&label->element, &gui_label_ops);
-	label->text = text;
+	gui_label_update_text(label, text);
 	label->text_offset.x = 0;
 	label->text_offset.y = 0;
 	label->align = GUI_TEXT_ALIGN_START;
 	return &label->element;
 }
 
-static int gui_marquee_render(gui_element_t *element, const gui_point_t *source_offset, const gui_fb_t *fb, const gui_point_t *destination_size) {
-	int ret = 10;
-	gui_marquee_t *marquee = container_of(element, gui_marquee_t, container.element);
-	unsigned int max_width = 0;
+static int gui_marquee_get_content_width(gui_marquee_t *marquee) {
+	int max_width = 0;
 	gui_element_t *cursor;
 
-	ESP_LOGD(TAG, "Rendering marquee from [%d, %d] to [%d, %d]...", source_offset->x, source_offset->y, destination_size->x, destination_size->y);
-
 	LIST_FOR_EACH_ENTRY(cursor, &marquee->container.children, list) {
 		max_width = MAX(max_width, cursor->area.size.x);
 	}
 
-	if (max_width > marquee->container.element.area.size.x) {
-		int delta = max_width - marquee->container.element.area.size.x;
+	return max_width;
+}
 
-		marquee->x_scroll_pos++;
-		marquee->x_scroll_pos %= delta;
-	} else {
-		marquee->x_scroll_pos = 0;
+// Scroll position is derived from time elapsed since the animation started
+static int64_t gui_marquee_tick(gui_animation_t *animation, int64_t now_us) {
+	gui_marquee_t *marquee = container_of(animation, gui_marquee_t, animation);
+	gui_element_t *element = &marquee->container.element;
+	int delta = gui_marquee_get_content_width(marquee) - element->area.size.x;
+	int64_t step_us, steps;
+	int x_scroll_pos;
+
+	if (!gui_element_is_visible(element) || !marquee->speed_px_per_s) {
+		return -1;
+	}
+
+	if (delta <= 0) {
+		if (marquee->x_scroll_pos) {
+			marquee->x_scroll_pos = 0;
+			gui_element_invalidate(element);
+		}
+		return -1;
+	}
+
+	step_us = DIV_ROUND_UP(1000000LL, marquee->speed_px_per_s);
+	steps = (now_us - animation->start_us) / step_us;
+	x_scroll_pos = steps % delta;
+	if (x_scroll_pos != marquee->x_scroll_pos) {
+		marquee->x_scroll_pos = x_scroll_pos;
+		gui_element_invalidate(element);
+	}
+
+	return animation->start_us + (steps + 1) * step_us;
+}
+
+static int gui_marquee_render(gui_element_t *element, const gui_point_t *source_offset, const gui_fb_t *fb, const gui_point_t *destination_size) {
+	int ret = -1;
+	gui_marquee_t *marquee = container_of(element, gui_marquee_t, container.element);
+	gui_element_t *cursor;
+
+	ESP_LOGD(TAG, "Rendering marquee from [%d, %d] to [%d, %d]...", source_offset->x, source_offset->y, destination_size->x, destination_size->y);
+
+	// Scrolling starts once the marquee is first drawn
+	if (!marquee->animation.running) {
+		gui_t *gui = gui_element_get_gui(element);
+
+		if (gui) {
+			gui_animation_start(gui, &marquee->animation);
+		}
 	}
 
 	LIST_FOR_EACH_ENTRY(cursor, &marquee->container.children, list) {
 		// Render area relative to marquee start
 		gui_point_t scrolled_source_offset = *source_offset;
 		gui_area_t render_area = cursor->area;
-		gui_fb_t local_fb = {
-			.stride = fb->stride
-		};
+		gui_fb_t local_fb;
 		int retval;
 
 		ESP_LOGD(TAG, "Entry size: %dx%d", render_area.size.x, render_area.size.y);
@@ -591,15 +1091,15 @@ static int gui_marquee_render(gui_element_t *element, const gui_point_t *source_
 			scrolled_source_offset.y = 0;
 		}
 
-		local_fb.pixels = &fb->pixels[render_area.position.y * fb->stride + render_area.position.x];
+		gui_fb_get_sub_fb(fb, &render_area.position, &local_fb);
 
-		// Clip rendering area size by destination area
-		if (render_area.position.x + render_area.size.x - scrolled_source_offset.x > destination_size->x) {
-			render_area.size.x = destination_size->x - render_area.position.x + scrolled_source_offset.x;
+		// Clip rendering area size by destination area, position is relative to fb already
+		if (render_area.position.x + render_area.size.x > destination_size->x) {
+			render_area.size.x = destination_size->x - render_area.position.x;
 			ESP_LOGD(TAG, "Limiting horizontal size of render area to %d", render_area.size.x);
 		}
-		if (render_area.position.y + render_area.size.y - scrolled_source_offset.y > destination_size->y) {
-			render_area.size.y = destination_size->y - render_area.position.y + scrolled_source_offset.y;
+		if (render_area.position.y + render_area.size.y > destination_size->y) {
+			render_area.size.y = destination_size->y - render_area.position.y;
 			ESP_LOGD(TAG, "Limiting vertical size of render area to %d", render_area.size.y);
 		}
 
@@ -607,7 +1107,9 @@ static int gui_marquee_render(gui_element_t *element, const gui_point_t *source_
 		scrolled_source_offset.x += marquee->x_scroll_pos;
 
 		retval = gui_element_render(cursor, &scrolled_source_offset, &local_fb, &render_area.size);
-		if (retval != -1) {
+		if (ret == -1) {
+			ret = retval;
+		} else if (retval != -1) {
 			ret = MIN(ret, retval);
 		}
 	}
@@ -618,16 +1120,29 @@ static int gui_marquee_render(gui_element_t *element, const gui_point_t *source_
 static const gui_element_ops_t gui_marquee_ops = {
 	.render = gui_marquee_render,
 	.update_shown = gui_container_update_shown,
+	.translate_child_damage = gui_scrolling_translate_child_damage,
 };
 
 gui_element_t *gui_marquee_init(gui_marquee_t *marquee) {
 	gui_container_init_(&marquee->container, &gui_marquee_ops);
+	marquee->speed_px_per_s = GUI_MARQUEE_DEFAULT_SPEED_PX_PER_S;
 	marquee->x_scroll_pos = 0;
+	gui_animation_init(&marquee->animation, gui_marquee_tick);
 	return &marquee->container.element;
 }
 
 // User API functions that might require rerendering
+void gui_container_set_cache(gui_container_t *container, uint8_t *cache, size_t cache_size) {
+	container->cache = cache;
+	container->cache_size = cache_size;
+	container->cache_valid = false;
+	gui_element_invalidate(&container->element);
+	gui_element_check_render(&container->element);
+}
+
 void gui_element_set_position(gui_element_t *elem, unsigned int x, unsigned int y) {
+	// Damage previous position, too
+	gui_element_invalidate(elem);
 	elem->area.position.x = x;
 	elem->area.position.y = y;
 	gui_element_invalidate(elem);
@@ -689,6 +1204,25 @@ void gui_list_set_selected_entry(gui_list_t *list, gui_element_t *entry) {
 	gui_element_check_render(&list->container.element);
 }
 
+void gui_virtual_list_set_num_entries(gui_virtual_list_t *list, unsigned int num_entries) {
+	list->num_entries = num_entries;
+	if (list->selected_index >= (int)num_entries) {
+		list->selected_index = (int)num_entries - 1;
+	}
+	gui_virtual_list_refresh(list);
+}
+
+void gui_virtual_list_set_selected_index(gui_virtual_list_t *list, int index) {
+	list->selected_index = MIN(index, (int)list->num_entries - 1);
+	gui_virtual_list_refresh(list);
+}
+
+void gui_virtual_list_refresh(gui_virtual_list_t *list) {
+	gui_virtual_list_scroll_to_selected(list);
+	gui_virtual_list_bind_rows(list);
+	gui_element_check_render(&list->container.element);
+}
+
 void gui_image_set_image(gui_image_t *image, unsigned int width, unsigned int height, const uint8_t *image_data_start) {
 	image->image_data_start = image_data_start;
 	gui_element_set_size_(&image->element, width, height);
@@ -696,7 +1230,7 @@ void gui_image_set_image(gui_image_t *image, unsigned int width, unsigned int he
 }
 
 void gui_label_set_text(gui_label_t *label, const char *text) {
-	label->text = text;
+	gui_label_update_text(label, text);
 	gui_element_invalidate(&label->element);
 	gui_element_check_render(&label->element);
 }
@@ -707,6 +1241,17 @@ void gui_label_set_text_alignment(gui_label_t *label, gui_text_alignment_t align
 	gui_element_check_render(&label->element);
 }
 
+void gui_marquee_set_speed(gui_marquee_t *marquee, unsigned int speed_px_per_s) {
+	marquee->speed_px_per_s = speed_px_per_s;
+	// Restart from the current position at the new speed
+	if (marquee->animation.running && speed_px_per_s) {
+		marquee->animation.start_us = esp_timer_get_time() -
+			(int64_t)marquee->x_scroll_pos * DIV_ROUND_UP(1000000LL, speed_px_per_s);
+	}
+	gui_element_invalidate(&marquee->container.element);
+	gui_element_check_render(&marquee->container.element);
+}
+
 void gui_label_set_text_offset(gui_label_t *label, int offset_x, int offset_y) {
 	label->text_offset.x = offset_x;
 	label->text_offset.y = offset_y;
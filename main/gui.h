@@ -1,11 +1,13 @@
 #pragma once
 
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
 #include <freertos/FreeRTOS.h>
 #include <freertos/semphr.h>
 
+#include "font_3x5.h"
 #include "list.h"
 
 typedef struct gui_point {
@@ -18,13 +20,23 @@ typedef struct gui_area {
 	gui_point_t size;
 } gui_area_t;
 
+#define GUI_MAX_DAMAGE_AREAS	8
+
+// Screen areas changed since the last render, in root coordinates
+typedef struct gui_damage {
+	unsigned int num_areas;
+	gui_area_t areas[GUI_MAX_DAMAGE_AREAS];
+} gui_damage_t;
+
+// Monochrome, any non-zero color lights the pixel
 typedef uint8_t gui_pixel_t;
-#define GUI_INVERT_PIXEL(px_) (((1U << (sizeof(gui_pixel_t) * 8)) - 1) - (px_))
 #define GUI_COLOR_BLACK	0
 
+// View into a page packed 1 bpp buffer in SSD1306 layout, see fb.h
 typedef struct gui_fb {
-	gui_pixel_t *pixels;
+	uint8_t *pages;
 	unsigned int stride;
+	gui_point_t origin;
 } gui_fb_t;
 
 typedef struct gui_element gui_element_t;
@@ -33,6 +45,8 @@ typedef struct gui_element_ops {
 	int (*render)(gui_element_t *element, const gui_point_t *source_offset, const gui_fb_t *fb, const gui_point_t *destination_size);
 	void (*update_shown)(gui_element_t *element);
 	void (*check_render)(gui_element_t *element);
+	// Maps damage of a child into local coordinates, identity if not set
+	void (*translate_child_damage)(gui_element_t *element, gui_area_t *area);
 } gui_element_ops_t;
 
 typedef struct gui_element {
@@ -52,10 +66,18 @@ typedef struct gui_element {
 typedef struct gui_container {
 	gui_element_t element;
 
+	// User properties, see gui_container_set_cache
+	uint8_t *cache;
+	size_t cache_size;
+
 	// Managed properties
 	struct list_head children;
+	bool cache_valid;
 } gui_container_t;
 
+// Bytes required to cache a container of the given size
+#define GUI_CONTAINER_CACHE_SIZE(width, height)	((width) * (((height) + 7) / 8))
+
 typedef struct gui_list {
 	gui_container_t container;
 
@@ -66,6 +88,7 @@ typedef struct gui_list {
 
 typedef struct gui_image {
 	gui_element_t element;
+	// Page packed 1 bpp, one byte per column and page like fb_t
 	const uint8_t *image_data_start;
 } gui_image_t;
 
@@ -88,17 +111,76 @@ typedef struct gui_label {
 	const char *text;
 	gui_point_t text_offset;
 	gui_text_alignment_t align;
+
+	// Managed properties, updated when the text is set
+	font_text_params_t text_params;
 } gui_label_t;
 
+typedef struct gui gui_t;
+typedef struct gui_animation gui_animation_t;
+typedef struct gui_update gui_update_t;
+
+// Copies pending state written by an updater into the GUI, runs at the start of a frame
+typedef void (*gui_update_apply_t)(gui_update_t *update);
+
+struct gui_update {
+	gui_update_apply_t apply;
+
+	// Managed properties
+	struct list_head list;
+	bool queued;
+};
+
+// Advances an animation to now_us, returns time of next visible change in us or -1 if idle
+typedef int64_t (*gui_animation_tick_t)(gui_animation_t *animation, int64_t now_us);
+
+struct gui_animation {
+	gui_animation_tick_t tick;
+
+	// Managed properties
+	struct list_head list;
+	bool running;
+	int64_t start_us;
+};
+
+#define GUI_MARQUEE_DEFAULT_SPEED_PX_PER_S	25
+
+#define GUI_VIRTUAL_LIST_TEXT_LEN	32
+
+// Writes the text of entry index, called only for entries scrolled into view
+typedef void (*gui_virtual_list_provider_t)(void *priv, unsigned int index, char *text, size_t text_size);
+
+typedef struct gui_virtual_list_row {
+	gui_label_t label;
+	char text[GUI_VIRTUAL_LIST_TEXT_LEN];
+} gui_virtual_list_row_t;
+
+// List with entries produced on demand, a fixed pool of rows is bound to the visible entries
+typedef struct gui_virtual_list {
+	gui_container_t container;
+
+	unsigned int row_height;
+	gui_virtual_list_provider_t provider;
+	void *priv;
+
+	// Managed properties
+	gui_virtual_list_row_t *rows;
+	unsigned int num_rows;
+	unsigned int num_entries;
+	int selected_index;
+	unsigned int first_visible_index;
+} gui_virtual_list_t;
+
 typedef struct gui_marquee {
 	gui_container_t container;
 
+	unsigned int speed_px_per_s;
+
 	// Managed properties
 	int x_scroll_pos;
+	gui_animation_t animation;
 } gui_marquee_t;
 
-typedef struct gui gui_t;
-
 typedef struct gui_ops {
 	void (*request_render)(const gui_t *gui);
 } gui_ops_t;
@@ -108,18 +190,42 @@ struct gui {
 
 	SemaphoreHandle_t lock;
 	StaticSemaphore_t lock_buffer;
+	// Only held while pending state is written or applied, never during rasterization
+	SemaphoreHandle_t update_lock;
+	StaticSemaphore_t update_lock_buffer;
+	struct list_head updates;
+	gui_damage_t damage;
+	struct list_head animations;
+	// Animation clock, sampled once at the start of each frame
+	int64_t frame_time_us;
 	void *priv;
 	const gui_ops_t *ops;
 };
 
 // Top level GUI API
 gui_element_t *gui_init(gui_t *gui, void *priv, const gui_ops_t *ops);
-int gui_render(gui_t *gui, gui_pixel_t *fb, unsigned int stride, const gui_point_t *size);
+// Renders damaged areas only, rendered areas are returned in damage
+// Returns ms until the next frame is due or -1 if nothing is animated
+int gui_render(gui_t *gui, uint8_t *pages, unsigned int stride, const gui_point_t *size, gui_damage_t *damage);
 void gui_lock(gui_t *gui);
 void gui_unlock(gui_t *gui);
 
+// Deferred update API, updaters write pending state with only the update lock held
+void gui_update_init(gui_update_t *update, gui_update_apply_t apply);
+void gui_update_lock(gui_t *gui);
+void gui_update_unlock(gui_t *gui);
+// Call with update lock held, apply runs in the render task with GUI and update lock held
+void gui_update_queue(gui_t *gui, gui_update_t *update);
+
+// Animation API, call with GUI locked
+void gui_animation_init(gui_animation_t *animation, gui_animation_tick_t tick);
+void gui_animation_start(gui_t *gui, gui_animation_t *animation);
+void gui_animation_stop(gui_t *gui, gui_animation_t *animation);
+
 // Container level GUI API
 gui_element_t *gui_container_init(gui_container_t *container);
+// Renders the subtree into cache once and blits it until a child changes, NULL disables caching
+void gui_container_set_cache(gui_container_t *container, uint8_t *cache, size_t cache_size);
 
 // Element level GUI API
 void gui_element_set_position(gui_element_t *elem, unsigned int x, unsigned int y);
@@ -138,6 +244,15 @@ void gui_image_set_image(gui_image_t *image, unsigned int width, unsigned int he
 gui_element_t *gui_list_init(gui_list_t *list);
 void gui_list_set_selected_entry(gui_list_t *list, gui_element_t *entry);
 
+// GUI virtual list widget API, the row pool needs to cover the list height
+gui_element_t *gui_virtual_list_init(gui_virtual_list_t *list, gui_virtual_list_row_t *rows, unsigned int num_rows,
+				     unsigned int row_height, gui_virtual_list_provider_t provider, void *priv);
+void gui_virtual_list_set_num_entries(gui_virtual_list_t *list, unsigned int num_entries);
+// Scrolls selected entry into view, -1 clears the selection
+void gui_virtual_list_set_selected_index(gui_virtual_list_t *list, int index);
+// Requests visible entries from the provider again, call after entries or list size changed
+void gui_virtual_list_refresh(gui_virtual_list_t *list);
+
 // GUI rectangle widget API
 gui_element_t *gui_rectangle_init(gui_rectangle_t *rectangle);
 void gui_rectangle_set_filled(gui_rectangle_t *rectangle, bool filled);
@@ -151,3 +266,4 @@ void gui_label_set_text_offset(gui_label_t *label, int offset_x, int offset_y);
 
 // GUI marquee widget API
 gui_element_t *gui_marquee_init(gui_marquee_t *marquee);
+void gui_marquee_set_speed(gui_marquee_t *marquee, unsigned int speed_px_per_s);
@@ -0,0 +1,292 @@
+#include "history.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+
+#include <esp_log.h>
+#include <esp_timer.h>
+
+#include "battery_gauge.h"
+#include "event_bus.h"
+#include "power_path.h"
+#include "rollup.h"
+#include "util.h"
+
+#define NUM_STATS	4
+
+#define VALUE_PRIV(series_, tier_, stat_) ((void *)(((series_) << 8) | ((tier_) << 4) | (stat_)))
+#define VALUE_PRIV_SERIES(priv_) (((unsigned int)(priv_) >> 8) & 0xff)
+#define VALUE_PRIV_TIER(priv_) (((unsigned int)(priv_) >> 4) & 0xf)
+#define VALUE_PRIV_STAT(priv_) ((unsigned int)(priv_) & 0xf)
+
+typedef struct history_series_def {
+	const char *name;
+	int32_t (*get_value)(void);
+} history_series_def_t;
+
+static const char *TAG = "history";
+
+static const char *tier_names[] = {
+	[ROLLUP_TIER_SECONDS] = "1s",
+	[ROLLUP_TIER_MINUTES] = "1m",
+	[ROLLUP_TIER_HOURS] = "1h",
+};
+
+static const char *stat_names[NUM_STATS] = {
+	"min",
+	"max",
+	"mean",
+	"last",
+};
+
+static int32_t get_group_power_mw(power_path_group_t group) {
+	power_path_group_data_t data;
+
+	power_path_get_group_data(group, &data);
+	return data.power_mw;
+}
+
+static int32_t get_input_power_mw(void) {
+	return get_group_power_mw(POWER_PATH_GROUP_IN);
+}
+
+static int32_t get_dc_power_mw(void) {
+	return get_group_power_mw(POWER_PATH_GROUP_DC);
+}
+
+static int32_t get_usb_power_mw(void) {
+	return get_group_power_mw(POWER_PATH_GROUP_USB);
+}
+
+static int32_t get_battery_voltage_mv(void) {
+	return battery_gauge_get_voltage_mv();
+}
+
+static int32_t get_battery_current_ma(void) {
+	return battery_gauge_get_current_ma();
+}
+
+static int32_t get_battery_soc_percent(void) {
+	return battery_gauge_get_soc_percent();
+}
+
+static const history_series_def_t series_defs[] = {
+	{ "input_power_mw",	get_input_power_mw },
+	{ "dc_power_mw",	get_dc_power_mw },
+	{ "usb_power_mw",	get_usb_power_mw },
+	{ "battery_voltage_mv",	get_battery_voltage_mv },
+	{ "battery_current_ma",	get_battery_current_ma },
+	{ "battery_soc_percent",	get_battery_soc_percent },
+};
+
+static rollup_t rollups[ARRAY_SIZE(series_defs)];
+
+static SemaphoreHandle_t lock;
+static StaticSemaphore_t lock_buffer;
+
+static event_bus_handler_t power_path_event_handler;
+
+static prometheus_metric_t history_metric;
+
+static int64_t get_uptime_s(void) {
+	return esp_timer_get_time() / 1000000LL;
+}
+
+static void on_power_path_event(void *priv, void *data) {
+	int64_t now_s = get_uptime_s();
+	int32_t values[ARRAY_SIZE(series_defs)];
+	unsigned int i;
+
+	/*
+	 * Battery gauge readings are cached, sampling them at the power path
+	 * update rate gives every series one sample per second.
+	 */
+	for (i = 0; i < ARRAY_SIZE(series_defs); i++) {
+		values[i] = series_defs[i].get_value();
+	}
+
+	xSemaphoreTake(lock, portMAX_DELAY);
+	for (i = 0; i < ARRAY_SIZE(rollups); i++) {
+		rollup_add_sample(&rollups[i], now_s, values[i]);
+	}
+	xSemaphoreGive(lock);
+}
+
+static int32_t get_bucket_stat(const rollup_bucket_t *bucket, unsigned int stat) {
+	switch (stat) {
+	case 0:
+		return bucket->min;
+	case 1:
+		return bucket->max;
+	case 2:
+		return bucket->mean;
+	default:
+		return bucket->last;
+	}
+}
+
+static unsigned int get_num_values(prometheus_metric_t *metric) {
+	return ARRAY_SIZE(series_defs) * ARRAY_SIZE(tier_names) * NUM_STATS;
+}
+
+static unsigned int get_num_labels(const prometheus_metric_value_t *val, prometheus_metric_t *metric) {
+	return 3;
+}
+
+static void get_label(const prometheus_metric_value_t *val, prometheus_metric_t *metric, unsigned int index, char *label, char *value) {
+	switch (index) {
+	case 0:
+		strcpy(label, "series");
+		strcpy(value, series_defs[VALUE_PRIV_SERIES(val->priv)].name);
+		break;
+	case 1:
+		strcpy(label, "tier");
+		strcpy(value, tier_names[VALUE_PRIV_TIER(val->priv)]);
+		break;
+	default:
+		strcpy(label, "stat");
+		strcpy(value, stat_names[VALUE_PRIV_STAT(val->priv)]);
+	}
+}
+
+static void get_value(const prometheus_metric_value_t *val, prometheus_metric_t *metric, char *value) {
+	rollup_bucket_t bucket;
+	bool valid;
+
+	xSemaphoreTake(lock, portMAX_DELAY);
+	rollup_advance(&rollups[VALUE_PRIV_SERIES(val->priv)], get_uptime_s());
+	valid = rollup_get_bucket(&rollups[VALUE_PRIV_SERIES(val->priv)], VALUE_PRIV_TIER(val->priv), 0, &bucket);
+	xSemaphoreGive(lock);
+
+	if (!valid || rollup_bucket_is_empty(&bucket)) {
+		strcpy(value, "NaN");
+	} else {
+		sprintf(value, "%ld", (long)get_bucket_stat(&bucket, VALUE_PRIV_STAT(val->priv)));
+	}
+}
+
+static void get_metric_value(prometheus_metric_t *metric, unsigned int index, prometheus_metric_value_t *value) {
+	unsigned int stat = index % NUM_STATS;
+	unsigned int tier = (index / NUM_STATS) % ARRAY_SIZE(tier_names);
+	unsigned int series = index / NUM_STATS / ARRAY_SIZE(tier_names);
+
+	value->priv = VALUE_PRIV(series, tier, stat);
+	value->get_num_labels = get_num_labels;
+	value->get_label = get_label;
+	value->get_value = get_value;
+}
+
+static const prometheus_metric_def_t history_metric_def = {
+	.name = "history",
+	.help = "Most recent complete aggregation bucket per series and tier",
+	.type = PROMETHEUS_METRIC_TYPE_GAUGE,
+	.num_values = 0,
+	.get_num_values = get_num_values,
+	.get_value = get_metric_value,
+};
+
+static int find_series(const char *name) {
+	unsigned int i;
+
+	for (i = 0; i < ARRAY_SIZE(series_defs); i++) {
+		if (!strcmp(name, series_defs[i].name)) {
+			return i;
+		}
+	}
+
+	return -1;
+}
+
+static int find_tier(const char *name) {
+	unsigned int i;
+
+	for (i = 0; i < ARRAY_SIZE(tier_names); i++) {
+		if (!strcmp(name, tier_names[i])) {
+			return i;
+		}
+	}
+
+	return -1;
+}
+
+static esp_err_t http_get_history(struct httpd_request_ctx* ctx, void* priv) {
+	char *series_str, *tier_str;
+	int series, tier;
+	rollup_bucket_t *buckets;
+	unsigned int num_buckets, interval_s, i;
+	char strbuf[96];
+
+	if (httpd_query_string_get_param(ctx, "series", &series_str) <= 0 ||
+	    httpd_query_string_get_param(ctx, "tier", &tier_str) <= 0) {
+		return httpd_send_error(ctx, HTTPD_400);
+	}
+
+	series = find_series(series_str);
+	tier = find_tier(tier_str);
+	if (series < 0 || tier < 0) {
+		return httpd_send_error(ctx, HTTPD_400);
+	}
+
+	buckets = calloc(rollups[series].tiers[tier].num_buckets, sizeof(rollup_bucket_t));
+	if (!buckets) {
+		return httpd_send_error(ctx, HTTPD_500);
+	}
+
+	// Snapshot tier to avoid holding the lock while sending
+	xSemaphoreTake(lock, portMAX_DELAY);
+	rollup_advance(&rollups[series], get_uptime_s());
+	num_buckets = rollup_get_num_buckets(&rollups[series], tier);
+	interval_s = rollup_get_tier_interval_s(&rollups[series], tier);
+	for (i = 0; i < num_buckets; i++) {
+		rollup_get_bucket(&rollups[series], tier, i, &buckets[i]);
+	}
+	xSemaphoreGive(lock);
+
+	httpd_resp_set_type(ctx->req, "application/json");
+	snprintf(strbuf, sizeof(strbuf), "{\"series\":\"%s\",\"tier\":\"%s\",\"interval_s\":%u,\"buckets\":[",
+		 series_defs[series].name, tier_names[tier], interval_s);
+	httpd_response_write_string(ctx, strbuf);
+	for (i = 0; i < num_buckets; i++) {
+		const rollup_bucket_t *bucket = &buckets[i];
+		const char *sep = i ? "," : "";
+
+		if (rollup_bucket_is_empty(bucket)) {
+			snprintf(strbuf, sizeof(strbuf), "%snull", sep);
+		} else {
+			snprintf(strbuf, sizeof(strbuf), "%s{\"min\":%ld,\"max\":%ld,\"mean\":%ld,\"last\":%ld}", sep,
+				 (long)bucket->min, (long)bucket->max, (long)bucket->mean, (long)bucket->last);
+		}
+		httpd_response_write_string(ctx, strbuf);
+	}
+	httpd_response_write_string(ctx, "]}");
+	free(buckets);
+
+	httpd_finalize_response(ctx);
+	return ESP_OK;
+}
+
+void history_init(void) {
+	int64_t now_s = get_uptime_s();
+	unsigned int i;
+
+	lock = xSemaphoreCreateMutexStatic(&lock_buffer);
+	for (i = 0; i < ARRAY_SIZE(rollups); i++) {
+		rollup_init(&rollups[i], now_s);
+	}
+
+	event_bus_subscribe(&power_path_event_handler, "power_path", on_power_path_event, NULL);
+	ESP_LOGI(TAG, "Recording %u series", (unsigned int)ARRAY_SIZE(series_defs));
+}
+
+void history_install_metrics(prometheus_t *prometheus) {
+	prometheus_metric_init(&history_metric, &history_metric_def, NULL);
+	prometheus_add_metric(prometheus, &history_metric);
+}
+
+esp_err_t history_register_api(httpd_t *httpd, const char *path) {
+	return httpd_add_get_handler(httpd, path, http_get_history, NULL, 2, "series", "tier");
+}
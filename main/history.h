@@ -0,0 +1,10 @@
+#pragma once
+
+#include <esp_err.h>
+
+#include "httpd.h"
+#include "prometheus.h"
+
+void history_init(void);
+void history_install_metrics(prometheus_t *prometheus);
+esp_err_t history_register_api(httpd_t *httpd, const char *path);
@@ -0,0 +1,235 @@
+#include "input_current_probe.h"
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+
+#include <esp_log.h>
+
+#include "battery_self_test.h"
+#include "power_path.h"
+#include "scheduler.h"
+#include "util.h"
+
+#define PROBE_MIN_CURRENT_MA		512
+#define PROBE_STEP_CURRENT_MA		128
+#define PROBE_MAX_CURRENT_MA		4000
+// Charge control loop and power path readings need to settle after a step
+#define PROBE_SETTLE_MS			3000
+// Input current must come this close to the charge control setpoint for a step to count
+#define PROBE_DEMAND_SLACK_MA		64
+#define PROBE_MAX_SAG_PERCENT		5
+// Knee: incremental source resistance rises by this factor over the first step
+#define PROBE_KNEE_RESISTANCE_FACTOR	3
+#define PROBE_MIN_RESISTANCE_MOHM	50
+#define PROBE_BACKOFF_PERCENT		10
+
+static const char *TAG = "input_current_probe";
+
+static input_current_probe_status_t status = {
+	.state = INPUT_CURRENT_PROBE_IDLE,
+	.reason = "",
+};
+
+static unsigned int original_current_ma;
+// Limit to continue from once the baseline is taken, 0 when stepping
+static unsigned int resume_current_ma;
+static unsigned int last_good_current_ma;
+static unsigned int last_voltage_mv;
+static int last_current_ma;
+static unsigned int reference_resistance_mohm;
+
+static SemaphoreHandle_t lock;
+static StaticSemaphore_t lock_buffer;
+
+static scheduler_task_t probe_task;
+
+static void finish(input_current_probe_state_t state, const char *reason, unsigned int result_current_ma) {
+	status.state = state;
+	status.reason = reason;
+	status.result_current_ma = result_current_ma;
+	if (state == INPUT_CURRENT_PROBE_DONE && result_current_ma != original_current_ma) {
+		power_path_set_input_current_limit(result_current_ma);
+	} else {
+		power_path_set_input_current_limit_transient(original_current_ma);
+	}
+
+	ESP_LOGI(TAG, "Probing %s (%s), input current limit %u mA",
+		 input_current_probe_state_to_name(state), reason, power_path_get_input_current_limit_ma());
+}
+
+static unsigned int backoff_current_ma(unsigned int current_ma) {
+	current_ma = current_ma * (100 - PROBE_BACKOFF_PERCENT) / 100;
+	// Charger input current resolution is 64 mA
+	return MAX(current_ma & ~63U, PROBE_MIN_CURRENT_MA);
+}
+
+// Charging regulates to a setpoint below the limit, not to the limit itself
+static bool is_demand_sufficient(unsigned int limit_ma, int current_ma) {
+	unsigned int setpoint_ma = limit_ma * (100 - CHARGE_CONTROL_SETPOINT_MARGIN_PERCENT) / 100;
+
+	return current_ma + PROBE_DEMAND_SLACK_MA >= (int)setpoint_ma;
+}
+
+static bool is_knee(unsigned int voltage_mv, int current_ma) {
+	unsigned int sag_mv = status.baseline_voltage_mv > voltage_mv ? status.baseline_voltage_mv - voltage_mv : 0;
+	int delta_current_ma = current_ma - last_current_ma;
+	unsigned int resistance_mohm;
+
+	if (sag_mv * 100 > status.baseline_voltage_mv * PROBE_MAX_SAG_PERCENT) {
+		return true;
+	}
+
+	if (delta_current_ma <= 0 || last_voltage_mv <= voltage_mv) {
+		return false;
+	}
+
+	resistance_mohm = (last_voltage_mv - voltage_mv) * 1000 / delta_current_ma;
+	if (!reference_resistance_mohm) {
+		reference_resistance_mohm = MAX(resistance_mohm, PROBE_MIN_RESISTANCE_MOHM);
+		return false;
+	}
+
+	return resistance_mohm > reference_resistance_mohm * PROBE_KNEE_RESISTANCE_FACTOR;
+}
+
+// Self-test inhibits charging, which removes the load probing relies on
+static bool is_self_test_running(void) {
+	battery_self_test_status_t self_test;
+
+	battery_self_test_get_status(&self_test);
+	return self_test.state != BATTERY_SELF_TEST_IDLE &&
+	       self_test.state != BATTERY_SELF_TEST_DONE &&
+	       self_test.state != BATTERY_SELF_TEST_ABORTED;
+}
+
+static void probe_step_cb(void *ctx);
+
+static void probe_step(void) {
+	power_path_group_data_t input;
+
+	if (power_path_is_running_on_battery()) {
+		finish(INPUT_CURRENT_PROBE_ABORTED, "input lost", original_current_ma);
+		return;
+	}
+
+	if (power_path_get_input_current_limit_ma() != status.probe_current_ma) {
+		// Limit was set manually while probing, keep it
+		original_current_ma = power_path_get_input_current_limit_ma();
+		finish(INPUT_CURRENT_PROBE_ABORTED, "limit overridden", original_current_ma);
+		return;
+	}
+
+	if (is_self_test_running()) {
+		finish(INPUT_CURRENT_PROBE_ABORTED, "self-test running", original_current_ma);
+		return;
+	}
+
+	power_path_get_group_data(POWER_PATH_GROUP_IN, &input);
+	status.voltage_mv = input.voltage_mv;
+
+	if (!status.baseline_voltage_mv) {
+		// First sample at minimum current establishes an unloaded baseline
+		status.baseline_voltage_mv = input.voltage_mv;
+	} else if (!is_demand_sufficient(status.probe_current_ma, input.current_ma)) {
+		// Battery full or load too small to draw the limit, can't go further
+		if (last_good_current_ma > original_current_ma) {
+			finish(INPUT_CURRENT_PROBE_DONE, "insufficient load", last_good_current_ma);
+		} else {
+			finish(INPUT_CURRENT_PROBE_ABORTED, "insufficient load", original_current_ma);
+		}
+		return;
+	} else if (is_knee(input.voltage_mv, input.current_ma)) {
+		if (status.probe_current_ma == resume_current_ma) {
+			// Previous limit is already past the knee, search for it from the baseline
+			ESP_LOGI(TAG, "Knee below %u mA, stepping up from %u mA", resume_current_ma, last_good_current_ma);
+			resume_current_ma = 0;
+			reference_resistance_mohm = 0;
+			status.probe_current_ma = last_good_current_ma + PROBE_STEP_CURRENT_MA;
+			power_path_set_input_current_limit_transient(status.probe_current_ma);
+			scheduler_schedule_task_relative(&probe_task, probe_step_cb, NULL, MS_TO_US(PROBE_SETTLE_MS));
+			return;
+		}
+		finish(INPUT_CURRENT_PROBE_DONE, "knee", backoff_current_ma(last_good_current_ma));
+		return;
+	}
+
+	last_good_current_ma = status.probe_current_ma;
+	last_voltage_mv = input.voltage_mv;
+	last_current_ma = input.current_ma;
+
+	if (status.probe_current_ma + PROBE_STEP_CURRENT_MA > PROBE_MAX_CURRENT_MA) {
+		finish(INPUT_CURRENT_PROBE_DONE, "maximum reached", backoff_current_ma(last_good_current_ma));
+		return;
+	}
+
+	if (resume_current_ma > status.probe_current_ma) {
+		// Skip straight to the previous limit, usually the result of the last probe
+		status.probe_current_ma = resume_current_ma;
+	} else {
+		resume_current_ma = 0;
+		status.probe_current_ma += PROBE_STEP_CURRENT_MA;
+	}
+	power_path_set_input_current_limit_transient(status.probe_current_ma);
+	ESP_LOGD(TAG, "Probing %u mA, input %u mV", status.probe_current_ma, input.voltage_mv);
+	scheduler_schedule_task_relative(&probe_task, probe_step_cb, NULL, MS_TO_US(PROBE_SETTLE_MS));
+}
+
+static void probe_step_cb(void *ctx) {
+	xSemaphoreTake(lock, portMAX_DELAY);
+	probe_step();
+	xSemaphoreGive(lock);
+}
+
+void input_current_probe_init(void) {
+	lock = xSemaphoreCreateMutexStatic(&lock_buffer);
+	scheduler_task_init(&probe_task);
+}
+
+esp_err_t input_current_probe_start(void) {
+	xSemaphoreTake(lock, portMAX_DELAY);
+	if (status.state == INPUT_CURRENT_PROBE_RUNNING || power_path_is_running_on_battery() ||
+	    is_self_test_running()) {
+		xSemaphoreGive(lock);
+		return ESP_ERR_INVALID_STATE;
+	}
+
+	original_current_ma = power_path_get_input_current_limit_ma();
+	last_good_current_ma = 0;
+	last_voltage_mv = 0;
+	last_current_ma = 0;
+	reference_resistance_mohm = 0;
+	status.state = INPUT_CURRENT_PROBE_RUNNING;
+	status.reason = "";
+	/*
+	 * Take the baseline at the minimum current, a baseline sampled at a
+	 * limit already past the knee would hide the sag.
+	 */
+	resume_current_ma = MIN(original_current_ma & ~63U, PROBE_MAX_CURRENT_MA);
+	status.probe_current_ma = PROBE_MIN_CURRENT_MA;
+	status.result_current_ma = 0;
+	status.baseline_voltage_mv = 0;
+	status.voltage_mv = 0;
+
+	ESP_LOGI(TAG, "Starting input current probing, current limit %u mA", original_current_ma);
+	power_path_set_input_current_limit_transient(status.probe_current_ma);
+	scheduler_schedule_task_relative(&probe_task, probe_step_cb, NULL, MS_TO_US(PROBE_SETTLE_MS));
+	xSemaphoreGive(lock);
+
+	return ESP_OK;
+}
+
+void input_current_probe_get_status(input_current_probe_status_t *status_) {
+	xSemaphoreTake(lock, portMAX_DELAY);
+	*status_ = status;
+	xSemaphoreGive(lock);
+}
+
+const char *input_current_probe_state_to_name(input_current_probe_state_t state) {
+	switch (state) {
+	case INPUT_CURRENT_PROBE_IDLE: return "idle";
+	case INPUT_CURRENT_PROBE_RUNNING: return "running";
+	case INPUT_CURRENT_PROBE_DONE: return "done";
+	case INPUT_CURRENT_PROBE_ABORTED: return "aborted";
+	default: return "(unknown)";
+	}
+}
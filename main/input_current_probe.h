@@ -0,0 +1,26 @@
+#pragma once
+
+#include <stdbool.h>
+
+#include <esp_err.h>
+
+typedef enum input_current_probe_state {
+	INPUT_CURRENT_PROBE_IDLE,
+	INPUT_CURRENT_PROBE_RUNNING,
+	INPUT_CURRENT_PROBE_DONE,
+	INPUT_CURRENT_PROBE_ABORTED,
+} input_current_probe_state_t;
+
+typedef struct input_current_probe_status {
+	input_current_probe_state_t state;
+	const char *reason;
+	unsigned int probe_current_ma;
+	unsigned int result_current_ma;
+	unsigned int baseline_voltage_mv;
+	unsigned int voltage_mv;
+} input_current_probe_status_t;
+
+void input_current_probe_init(void);
+esp_err_t input_current_probe_start(void);
+void input_current_probe_get_status(input_current_probe_status_t *status);
+const char *input_current_probe_state_to_name(input_current_probe_state_t state);
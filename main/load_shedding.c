@@ -0,0 +1,292 @@
+#include "load_shedding.h"
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+
+#include <esp_log.h>
+#include <esp_timer.h>
+
+#include "battery_gauge.h"
+#include "event_bus.h"
+#include "scheduler.h"
+#include "settings.h"
+#include "util.h"
+
+#define NUM_OUTPUTS			(POWER_PATH_OUTPUT_MAX_ + 1)
+
+#define EVALUATION_INTERVAL_MS		5000
+// Gauge runtime prediction needs some time to settle after load changes
+#define SHED_HOLDOFF_US			(60LL * 1000000LL)
+#define RESTORE_HOLDOFF_US		(5LL * 60LL * 1000000LL)
+// Predicted runtime after restore must exceed target by this much
+#define RESTORE_HYSTERESIS_PERCENT	20
+
+// Gauge reports 65535 min time to empty while not discharging
+#define RUNTIME_NOT_DISCHARGING_MIN	65535
+
+static const char *TAG = "load_shedding";
+
+static unsigned int output_priority[NUM_OUTPUTS];
+static bool output_shed[NUM_OUTPUTS] = { false };
+// Power saved by shedding an output, measured after shedding it
+static unsigned long output_shed_power_mw[NUM_OUTPUTS] = { 0 };
+static int pending_measurement_output = -1;
+static unsigned long pending_measurement_power_mw = 0;
+
+static unsigned int target_runtime_min;
+static int64_t holdoff_deadline_us = 0;
+
+static load_shedding_log_entry_t log_entries[LOAD_SHEDDING_LOG_SIZE];
+static unsigned int log_head = 0;
+static unsigned int log_num_entries = 0;
+
+static SemaphoreHandle_t lock;
+static StaticSemaphore_t lock_buffer;
+
+static scheduler_task_t evaluation_task;
+static event_bus_handler_t power_source_event_handler;
+
+static void log_action(power_path_output_t output, load_shedding_action_t action, unsigned int runtime_min) {
+	load_shedding_log_entry_t *entry;
+
+	log_head = (log_head + 1) % ARRAY_SIZE(log_entries);
+	entry = &log_entries[log_head];
+	entry->timestamp_us = esp_timer_get_time();
+	entry->output = output;
+	entry->action = action;
+	entry->runtime_min = runtime_min;
+	entry->target_runtime_min = target_runtime_min;
+	if (log_num_entries < ARRAY_SIZE(log_entries)) {
+		log_num_entries++;
+	}
+
+	ESP_LOGI(TAG, "%s output %s, runtime %u min, target %u min",
+		 action == LOAD_SHEDDING_ACTION_SHED ? "Shedding" : "Restoring",
+		 power_path_output_to_name(output), runtime_min, target_runtime_min);
+}
+
+static void shed_output(power_path_output_t output, unsigned int runtime_min) {
+	pending_measurement_output = output;
+	pending_measurement_power_mw = power_path_get_output_power_consumption_mw();
+	output_shed[output] = true;
+	power_path_set_output_enabled(output, false);
+	log_action(output, LOAD_SHEDDING_ACTION_SHED, runtime_min);
+}
+
+static void restore_output(power_path_output_t output, unsigned int runtime_min) {
+	if (pending_measurement_output == output) {
+		pending_measurement_output = -1;
+	}
+	output_shed[output] = false;
+	power_path_set_output_enabled(output, true);
+	log_action(output, LOAD_SHEDDING_ACTION_RESTORE, runtime_min);
+}
+
+static void restore_all_outputs(unsigned int runtime_min) {
+	int i;
+
+	for (i = 0; i < NUM_OUTPUTS; i++) {
+		if (output_shed[i]) {
+			restore_output(i, runtime_min);
+		}
+	}
+	holdoff_deadline_us = 0;
+}
+
+static int find_output_to_shed(void) {
+	int i, output = -1;
+	unsigned int num_enabled = 0;
+
+	for (i = 0; i < NUM_OUTPUTS; i++) {
+		if (!output_shed[i] && power_path_is_output_enabled(i)) {
+			num_enabled++;
+		}
+	}
+	// Shedding the last load leaves nothing to save runtime for
+	if (num_enabled <= 1) {
+		return -1;
+	}
+
+	for (i = 0; i < NUM_OUTPUTS; i++) {
+		if (output_shed[i] || output_priority[i] == LOAD_SHEDDING_PRIORITY_CRITICAL ||
+		    !power_path_is_output_enabled(i)) {
+			continue;
+		}
+		if (output < 0 || output_priority[i] > output_priority[output]) {
+			output = i;
+		}
+	}
+
+	return output;
+}
+
+static int find_output_to_restore(void) {
+	int i, output = -1;
+
+	for (i = 0; i < NUM_OUTPUTS; i++) {
+		if (!output_shed[i]) {
+			continue;
+		}
+		if (output < 0 || output_priority[i] < output_priority[output]) {
+			output = i;
+		}
+	}
+
+	return output;
+}
+
+static unsigned int predict_runtime_with_output_min(power_path_output_t output, unsigned int runtime_min) {
+	unsigned long load_power_mw = power_path_get_output_power_consumption_mw();
+	unsigned long restored_power_mw = load_power_mw + output_shed_power_mw[output];
+
+	if (!restored_power_mw) {
+		return runtime_min;
+	}
+
+	// Assume remaining energy is drained at constant power
+	return (unsigned long long)runtime_min * load_power_mw / restored_power_mw;
+}
+
+static void evaluate(void) {
+	unsigned int runtime_min = battery_gauge_get_time_to_empty_min();
+	int64_t now = esp_timer_get_time();
+	int output;
+
+	if (!power_path_is_running_on_battery()) {
+		restore_all_outputs(runtime_min);
+		return;
+	}
+
+	if (now < holdoff_deadline_us) {
+		return;
+	}
+
+	if (pending_measurement_output >= 0) {
+		unsigned long power_mw = power_path_get_output_power_consumption_mw();
+
+		output_shed_power_mw[pending_measurement_output] =
+			pending_measurement_power_mw > power_mw ? pending_measurement_power_mw - power_mw : 0;
+		pending_measurement_output = -1;
+	}
+
+	if (!runtime_min || runtime_min >= RUNTIME_NOT_DISCHARGING_MIN) {
+		return;
+	}
+
+	// A target of 0 disables shedding, shed outputs are still restored
+	if (target_runtime_min && runtime_min < target_runtime_min) {
+		output = find_output_to_shed();
+		if (output >= 0) {
+			shed_output(output, runtime_min);
+			holdoff_deadline_us = now + SHED_HOLDOFF_US;
+		}
+	} else {
+		output = find_output_to_restore();
+		if (output >= 0) {
+			unsigned int predicted_runtime_min = predict_runtime_with_output_min(output, runtime_min);
+
+			if (predicted_runtime_min * 100 >= target_runtime_min * (100 + RESTORE_HYSTERESIS_PERCENT)) {
+				restore_output(output, runtime_min);
+				holdoff_deadline_us = now + RESTORE_HOLDOFF_US;
+			}
+		}
+	}
+}
+
+static void evaluation_cb(void *ctx);
+static void evaluation_cb(void *ctx) {
+	xSemaphoreTake(lock, portMAX_DELAY);
+	evaluate();
+	xSemaphoreGive(lock);
+
+	scheduler_schedule_task_relative(&evaluation_task, evaluation_cb, NULL, MS_TO_US(EVALUATION_INTERVAL_MS));
+}
+
+static void on_power_source_changed(void *priv, void *data) {
+	if (!power_path_is_running_on_battery()) {
+		xSemaphoreTake(lock, portMAX_DELAY);
+		restore_all_outputs(battery_gauge_get_time_to_empty_min());
+		xSemaphoreGive(lock);
+	}
+}
+
+void load_shedding_init(void) {
+	int i;
+
+	lock = xSemaphoreCreateMutexStatic(&lock_buffer);
+	for (i = 0; i < NUM_OUTPUTS; i++) {
+		output_priority[i] = settings_get_output_priority(i, LOAD_SHEDDING_PRIORITY_CRITICAL);
+	}
+	target_runtime_min = settings_get_shed_target_runtime_min();
+
+	event_bus_subscribe(&power_source_event_handler, "power_source", on_power_source_changed, NULL);
+	scheduler_task_init(&evaluation_task);
+	scheduler_schedule_task_relative(&evaluation_task, evaluation_cb, NULL, MS_TO_US(EVALUATION_INTERVAL_MS));
+}
+
+void load_shedding_set_output_priority(power_path_output_t output, unsigned int priority) {
+	xSemaphoreTake(lock, portMAX_DELAY);
+	output_priority[output] = priority;
+	if (priority == LOAD_SHEDDING_PRIORITY_CRITICAL && output_shed[output]) {
+		restore_output(output, battery_gauge_get_time_to_empty_min());
+	}
+	xSemaphoreGive(lock);
+	settings_set_output_priority(output, priority);
+}
+
+unsigned int load_shedding_get_output_priority(power_path_output_t output) {
+	unsigned int priority;
+
+	xSemaphoreTake(lock, portMAX_DELAY);
+	priority = output_priority[output];
+	xSemaphoreGive(lock);
+
+	return priority;
+}
+
+void load_shedding_set_target_runtime_min(unsigned int runtime_min) {
+	xSemaphoreTake(lock, portMAX_DELAY);
+	target_runtime_min = runtime_min;
+	holdoff_deadline_us = 0;
+	xSemaphoreGive(lock);
+	settings_set_shed_target_runtime_min(runtime_min);
+}
+
+unsigned int load_shedding_get_target_runtime_min(void) {
+	return target_runtime_min;
+}
+
+bool load_shedding_is_output_shed(power_path_output_t output) {
+	bool shed;
+
+	xSemaphoreTake(lock, portMAX_DELAY);
+	shed = output_shed[output];
+	xSemaphoreGive(lock);
+
+	return shed;
+}
+
+unsigned int load_shedding_get_num_log_entries(void) {
+	return log_num_entries;
+}
+
+bool load_shedding_get_log_entry(unsigned int age, load_shedding_log_entry_t *entry) {
+	bool found = false;
+
+	xSemaphoreTake(lock, portMAX_DELAY);
+	if (age < log_num_entries) {
+		*entry = log_entries[(log_head + ARRAY_SIZE(log_entries) - age) % ARRAY_SIZE(log_entries)];
+		found = true;
+	}
+	xSemaphoreGive(lock);
+
+	return found;
+}
+
+const char *load_shedding_action_to_name(load_shedding_action_t action) {
+	switch (action) {
+	case LOAD_SHEDDING_ACTION_SHED: return "shed";
+	case LOAD_SHEDDING_ACTION_RESTORE: return "restore";
+	default: return "(unknown)";
+	}
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "power_path.h"
+
+#define LOAD_SHEDDING_PRIORITY_CRITICAL	0
+#define LOAD_SHEDDING_LOG_SIZE		32
+
+typedef enum load_shedding_action {
+	LOAD_SHEDDING_ACTION_SHED,
+	LOAD_SHEDDING_ACTION_RESTORE,
+} load_shedding_action_t;
+
+typedef struct load_shedding_log_entry {
+	int64_t timestamp_us;
+	power_path_output_t output;
+	load_shedding_action_t action;
+	unsigned int runtime_min;
+	unsigned int target_runtime_min;
+} load_shedding_log_entry_t;
+
+/*
+ * Outputs with priority LOAD_SHEDDING_PRIORITY_CRITICAL are never shed.
+ * All other outputs are shed in order of descending priority value and
+ * restored in reverse order. Unconfigured outputs are critical, so
+ * shedding is opt-in. The last enabled output is never shed and a target
+ * runtime of 0 disables shedding.
+ */
+void load_shedding_init(void);
+void load_shedding_set_output_priority(power_path_output_t output, unsigned int priority);
+unsigned int load_shedding_get_output_priority(power_path_output_t output);
+void load_shedding_set_target_runtime_min(unsigned int runtime_min);
+unsigned int load_shedding_get_target_runtime_min(void);
+bool load_shedding_is_output_shed(power_path_output_t output);
+unsigned int load_shedding_get_num_log_entries(void);
+bool load_shedding_get_log_entry(unsigned int age, load_shedding_log_entry_t *entry);
+const char *load_shedding_action_to_name(load_shedding_action_t action);
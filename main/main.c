@@ -4,19 +4,27 @@
 #include <esp_err.h>
 #include <esp_log.h>
 #include <esp_spiffs.h>
+#include <esp_system.h>
 #include <freertos/FreeRTOS.h>
 
 #include "api.h"
 #include "battery_protection.h"
+#include "battery_self_test.h"
 #include "bq40z50_gauge.h"
 #include "buttons.h"
+#include "cell_monitor.h"
 #include "display.h"
+#include "energy.h"
 #include "ethernet.h"
 #include "event_bus.h"
+#include "event_log.h"
 #include "font_3x5.h"
 #include "gpio_hc595.h"
+#include "history.h"
 #include "httpd.h"
 #include "i2c_bus.h"
+#include "input_current_probe.h"
+#include "load_shedding.h"
 #include "power_path.h"
 #include "prometheus_exporter.h"
 #include "prometheus_metrics.h"
@@ -30,13 +38,6 @@
 #include "website.h"
 #include "wifi.h"
 
-#define GPIO_HC595_DC_OUT3_OFF	1
-#define GPIO_HC595_DC_OUT_TEST	2
-#define GPIO_HC595_DC_OUT_OFF	3
-#define GPIO_HC595_USB_OUT_OFF	4
-#define GPIO_HC595_DC_OUT2_OFF	5
-#define GPIO_HC595_DC_OUT1_OFF	6
-
 #define SPI_HC595		SPI2_HOST
 #define GPIO_HC595_DATA		16
 #define GPIO_HC595_CLK		14
@@ -124,6 +125,8 @@ void app_main() {
 	settings_init();
 	vendor_init();
 	scheduler_init();
+	event_log_init();
+	event_log_append(EVENT_LOG_TYPE_BOOT, esp_reset_reason(), 0, 0, 0);
 	buttons_init();
 
 	ESP_ERROR_CHECK(ethernet_init(&ethernet_cfg));
@@ -133,12 +136,7 @@ void app_main() {
 
 	ESP_ERROR_CHECK(spi_bus_initialize(SPI_HC595, &hc595_spi_bus_cfg, SPI_DMA_DISABLED));
 	ESP_ERROR_CHECK(gpio_hc595_init(&hc595, SPI_HC595, GPIO_HC595_LATCH));
-	gpio_hc595_set_level(&hc595, GPIO_HC595_DC_OUT3_OFF, 0);
-	gpio_hc595_set_level(&hc595, GPIO_HC595_DC_OUT_TEST, 0);
-	gpio_hc595_set_level(&hc595, GPIO_HC595_DC_OUT_OFF, 0);
-	gpio_hc595_set_level(&hc595, GPIO_HC595_USB_OUT_OFF, 0);
-	gpio_hc595_set_level(&hc595, GPIO_HC595_DC_OUT2_OFF, 0);
-	gpio_hc595_set_level(&hc595, GPIO_HC595_DC_OUT1_OFF, 0);
+	power_path_outputs_init(&hc595);
 
 	ESP_ERROR_CHECK(i2c_bus_init(&smbus_i2c_bus, I2C_SMBUS, GPIO_SMBUS_DATA, GPIO_SMBUS_CLK, KHZ(100)));
 	smbus_init(&smbus_bus, &smbus_i2c_bus);
@@ -156,6 +154,12 @@ void app_main() {
 	power_path_init(&smbus_bus, &i2c_bus);
 
 	battery_protection_init(&bq40z50);
+	history_init();
+	energy_init();
+	load_shedding_init();
+	input_current_probe_init();
+	battery_self_test_init(&bq40z50);
+	cell_monitor_init();
 
 	buttons_register_single_button_event_handler(&button_held_event_handler, &button_held_cfg);
 	buttons_enable_event_handler(&button_held_event_handler);
@@ -163,11 +167,21 @@ void app_main() {
 	ESP_ERROR_CHECK(httpd_init(&httpd, "/webroot", 32));
 	website_init(&httpd);
 	api_init(&httpd);
+	ESP_ERROR_CHECK(history_register_api(&httpd, "/api/v1/history"));
+	ESP_ERROR_CHECK(event_log_register_api(&httpd, "/api/v1/event_log"));
+	ESP_ERROR_CHECK(display_register_api(&httpd, "/api/v1/display/screenshot"));
 	prometheus_init(&prometheus);
 
 	prometheus_battery_metrics_init(&battery_metrics, &bq40z50);
 	prometheus_add_battery_metrics(&battery_metrics, &prometheus);
 	sensor_install_metrics(&prometheus);
+	history_install_metrics(&prometheus);
+	energy_install_metrics(&prometheus);
+	power_path_install_metrics(&prometheus);
+	battery_protection_install_metrics(&prometheus);
+	battery_self_test_install_metrics(&prometheus);
+	cell_monitor_install_metrics(&prometheus);
+	display_install_metrics(&prometheus);
 	ESP_ERROR_CHECK(prometheus_register_exporter(&prometheus, &httpd, "/prometheus"));
 
 	display_render_loop();
@@ -1,15 +1,29 @@
 #include "power_path.h"
 
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/queue.h>
+#include <freertos/semphr.h>
+#include <freertos/task.h>
+
 #include <driver/gpio.h>
 #include <esp_err.h>
 #include <esp_log.h>
+#include <esp_timer.h>
 
 #include "battery_gauge.h"
 #include "bq24715_charger.h"
+#include "charge_controller.h"
+#include "charge_profile.h"
 #include "event_bus.h"
+#include "event_log.h"
 #include "ina219.h"
 #include "lm75.h"
 #include "scheduler.h"
+#include "seqlock.h"
 #include "settings.h"
 #include "util.h"
 
@@ -18,14 +32,33 @@
 #define GPIO_VSEL0	35
 #define GPIO_VSEL1	36
 
+#define GPIO_HC595_DC_OUT3_OFF	1
+#define GPIO_HC595_DC_OUT_TEST	2
+#define GPIO_HC595_DC_OUT_OFF	3
+#define GPIO_HC595_USB_OUT_OFF	4
+#define GPIO_HC595_DC_OUT2_OFF	5
+#define GPIO_HC595_DC_OUT1_OFF	6
+
 #define POWER_UPDATE_INTERVAL_MS	1000
 
+#define POWER_GPIO_DEBOUNCE_INTERVAL_MS	2
+#define POWER_GPIO_EVENT_QUEUE_LENGTH	16
+
 #define BATTERY_CHARGE_VOLTAGE_MV	8400
 #define BATTERY_NOMINAL_VOLTAGE_MV	7400
 #define DEFAULT_CHARGE_CURRENT_MA	128
-#define MAX_CHARGE_CURRENT_MA		1024
 #define MAX_INPUT_CURRENT_MA		4000
 
+// Catch charger resets, refresh well within the 175 s charger watchdog
+#define CHARGER_VERIFY_INTERVAL_US	(10LL * 1000000LL)
+#define CHARGER_REFRESH_INTERVAL_US	(60LL * 1000000LL)
+
+#define CHARGE_CONTROL_MIN_INTERVAL_MS	20
+#define CHARGE_CONTROL_MAX_INTERVAL_MS	1000
+// Tuned for ~0.45 mA input per mA charge current (7.6 V pack, 19 V adapter)
+#define CHARGE_CONTROL_KP_MILLI		800
+#define CHARGE_CONTROL_KI_MILLI_PER_S	15000
+
 typedef enum ina_type {
 	INA_TYPE_DC_IN			= 0,
 	INA_TYPE_DC_OUT_PASSTHROUGH	= 1,
@@ -55,8 +88,36 @@ typedef struct lm75_state {
 	int32_t temperature_mdegc;
 } lm75_state_t;
 
+typedef struct output_def {
+	const char *name;
+	unsigned int hc595_gpio;
+} output_def_t;
+
+typedef enum power_gpio_event_type {
+	POWER_GPIO_EVENT_EDGE,
+	POWER_GPIO_EVENT_DEBOUNCED,
+} power_gpio_event_type_t;
+
+typedef struct power_gpio_event {
+	power_gpio_event_type_t type;
+	int64_t timestamp_us;
+} power_gpio_event_t;
+
 static const char *TAG = "power_path";
 
+static const output_def_t output_defs[] = {
+	[POWER_PATH_OUTPUT_DC1] = { "dc1", GPIO_HC595_DC_OUT1_OFF },
+	[POWER_PATH_OUTPUT_DC2] = { "dc2", GPIO_HC595_DC_OUT2_OFF },
+	[POWER_PATH_OUTPUT_DC3] = { "dc3", GPIO_HC595_DC_OUT3_OFF },
+	[POWER_PATH_OUTPUT_USB] = { "usb", GPIO_HC595_USB_OUT_OFF },
+};
+
+static const unsigned int power_gpios[] = {
+	GPIO_DCOK,
+	GPIO_VSEL0,
+	GPIO_VSEL1,
+};
+
 static const ina_def_t ina_defs[] = {
 	{ "ina_dc_in",			0x40, 10 },
 	{ "ina_dc_out_passthrough",	0x41, 10 },
@@ -79,11 +140,55 @@ static scheduler_task_t power_path_update_task;
 static unsigned int input_current_limit_ma = 0;
 
 static bq24715_t bq24715;
+static int64_t charger_last_verify_us = 0;
+static int64_t charger_last_refresh_us = 0;
+
+static scheduler_task_t charge_control_task;
+static charge_controller_t charge_controller;
+static unsigned int charge_control_interval_ms;
+static bool charge_control_active = false;
+static bool charging_inhibited = false;
+static int64_t charge_control_last_update_us;
+
+static unsigned int charge_current_limit_ma = DEFAULT_CHARGE_CURRENT_MA;
+
+static const charge_controller_cfg_t charge_controller_cfg = {
+	.kp_milli = CHARGE_CONTROL_KP_MILLI,
+	.ki_milli_per_s = CHARGE_CONTROL_KI_MILLI_PER_S,
+	.max_output_ma = DEFAULT_CHARGE_CURRENT_MA,
+};
 
-static unsigned long output_power_mw = 0;
-static bool running_on_battery = false;
-
-static power_path_group_data_t group_data[POWER_PATH_GROUP_MAX_ + 1] = { 0 };
+// Cached power source state, updated from GPIO interrupts
+static volatile bool running_on_battery = false;
+static volatile unsigned int dc_output_voltage_mv = 0;
+
+static QueueHandle_t power_gpio_event_queue;
+static StaticQueue_t power_gpio_event_static_queue;
+static uint8_t power_gpio_event_queue_storage[POWER_GPIO_EVENT_QUEUE_LENGTH * sizeof(power_gpio_event_t)];
+static esp_timer_handle_t power_gpio_debounce_timer;
+static int64_t first_edge_us = -1;
+
+static SemaphoreHandle_t power_source_lock;
+static StaticSemaphore_t power_source_lock_buffer;
+
+static unsigned int power_source_transitions = 0;
+// Subscribers are notified from the scheduler, not from the GPIO task
+static scheduler_task_t power_source_notify_task;
+static bool power_source_notify_pending = false;
+// Edge that caused the pending notification, -1 if found by polling
+static int64_t power_source_notify_edge_us = -1;
+static int64_t outage_start_us = 0;
+static int64_t power_source_last_latency_us = 0;
+static int64_t power_source_max_latency_us = 0;
+
+static prometheus_metric_t power_source_transitions_metric;
+static prometheus_metric_t power_source_latency_metric;
+
+// Working copy, only accessed from power path update
+static power_path_snapshot_t snapshot_next = { 0 };
+// Published copy for readers
+static power_path_snapshot_t snapshot = { 0 };
+static seqlock_t snapshot_lock;
 
 static const unsigned int dc_output_voltage_table[] = {
 	9000,
@@ -92,7 +197,12 @@ static const unsigned int dc_output_voltage_table[] = {
 	15000
 };
 
-static bool dc_output_enable_table[] = {
+static gpio_hc595_t *output_hc595;
+// Outputs are switched from httpd, scheduler and power source handlers
+static SemaphoreHandle_t output_lock;
+static StaticSemaphore_t output_lock_buffer;
+static bool output_enabled[ARRAY_SIZE(output_defs)] = {
+	true,
 	true,
 	true,
 	true
@@ -131,33 +241,108 @@ static long long calculate_max_input_power_uw(void) {
 	return max_power_uw;
 }
 
+// Open-loop charge current estimate, used as starting point for the controller
+static unsigned int estimate_charge_current_ma(void) {
+	long long current_output_power_uw = calculate_output_power_uw();
+	long long max_input_power_uw = calculate_max_input_power_uw();
+	long long charging_power_uw;
+
+	if (current_output_power_uw >= max_input_power_uw) {
+		return 0;
+	}
+
+	charging_power_uw = max_input_power_uw - current_output_power_uw;
+	return MIN(charging_power_uw / BATTERY_CHARGE_VOLTAGE_MV, charge_current_limit_ma);
+}
+
+static void update_charge_current_limit(void) {
+	battery_gauge_params_t battery;
+	charge_profile_inputs_t inputs;
+
+	battery_gauge_get_params(&battery);
+	if (!battery.values[BATTERY_VOLTAGE_MV]) {
+		// No gauge readings yet
+		charge_current_limit_ma = DEFAULT_CHARGE_CURRENT_MA;
+	} else {
+		inputs.pack_temperature_mdegc = battery.values[BATTERY_TEMPERATURE_MDEG_C];
+		inputs.charger_temperature_mdegc = snapshot_next.groups[POWER_PATH_GROUP_IN].temperature_mdegc;
+		inputs.max_cell_voltage_mv = MAX(battery.values[BATTERY_VOLTAGE_CELL1_MV],
+						 battery.values[BATTERY_VOLTAGE_CELL2_MV]);
+		inputs.soc_percent = battery.values[BATTERY_SOC_PERCENT];
+		inputs.full_charge_capacity_mah = MAX(battery.values[BATTERY_FULL_CHARGE_CAPACITY_MAH], 0);
+		charge_current_limit_ma = charge_profile_get_current_ma(&charge_profile_default, &inputs);
+	}
+
+	charge_controller_set_max_output(&charge_controller, charge_current_limit_ma);
+}
+
 static void update_charge_current(void) {
 	long long current_output_power_uw = calculate_output_power_uw();
 	long long max_input_power_uw = calculate_max_input_power_uw();
-	unsigned int charge_current_setpoint_ma = 0;
 	long predicted_discharge_current_ma = current_output_power_uw / BATTERY_NOMINAL_VOLTAGE_MV;
 
 	battery_gauge_set_at_rate(-predicted_discharge_current_ma);
 
-	output_power_mw = DIV_ROUND(current_output_power_uw, 1000);
+	snapshot_next.output_power_mw = DIV_ROUND(current_output_power_uw, 1000);
 
 	ESP_LOGI(TAG, "Output power: %ldmW", (long)DIV_ROUND(current_output_power_uw, 1000));
 	ESP_LOGI(TAG, "Max input power: %ldmW", (long)DIV_ROUND(max_input_power_uw, 1000));
-	if (current_output_power_uw < max_input_power_uw) {
-		long long charging_power_uw = max_input_power_uw - current_output_power_uw;
-		long charging_current_ma = charging_power_uw / BATTERY_CHARGE_VOLTAGE_MV;
+	ESP_LOGI(TAG, "Charge current setpoint: %umA, limit: %umA", charge_controller.output_ma, charge_current_limit_ma);
 
-		ESP_LOGI(TAG, "Charging power budget: %ldmW", (long)DIV_ROUND(charging_power_uw, 1000));
+	// Input current limit of the charger is a hardware backstop for the control loop
+	bq24715_set_input_current(&bq24715, input_current_limit_ma);
+}
+
+static void maintain_charger_registers(void) {
+	int64_t now = esp_timer_get_time();
+
+	if (now - charger_last_refresh_us >= CHARGER_REFRESH_INTERVAL_US) {
+		charger_last_refresh_us = now;
+		charger_last_verify_us = now;
+		bq24715_invalidate_registers(&bq24715);
+		bq24715_set_max_charge_voltage(&bq24715, BATTERY_CHARGE_VOLTAGE_MV);
+		bq24715_set_input_current(&bq24715, input_current_limit_ma);
+		bq24715_set_charge_current(&bq24715, charge_control_active ? charge_controller.output_ma : 0);
+	} else if (now - charger_last_verify_us >= CHARGER_VERIFY_INTERVAL_US) {
+		charger_last_verify_us = now;
+		bq24715_verify_registers(&bq24715);
+	}
+}
+
+static void charge_control_cb(void *ctx);
+static void charge_control_cb(void *ctx) {
+	ina_state_t *ina_dc_in_state = &inas[INA_TYPE_DC_IN];
+	int64_t now_us = esp_timer_get_time();
+	long current_ua;
 
-		if (charging_current_ma > MAX_CHARGE_CURRENT_MA) {
-			charging_current_ma = MAX_CHARGE_CURRENT_MA;
+	if (power_path_is_running_on_battery() || charging_inhibited) {
+		if (charge_control_active) {
+			charge_control_active = false;
+			charge_controller_reset(&charge_controller, 0);
+			bq24715_set_charge_current(&bq24715, 0);
 		}
-		charge_current_setpoint_ma = charging_current_ma;
+	} else if (!ina219_read_current_ua(&ina_dc_in_state->ina, &current_ua)) {
+		int setpoint_ma = input_current_limit_ma * (100 - CHARGE_CONTROL_SETPOINT_MARGIN_PERCENT) / 100;
+		unsigned int charge_current_ma;
+
+		if (!charge_control_active) {
+			charge_control_active = true;
+			charge_control_last_update_us = now_us;
+			charge_controller_reset(&charge_controller, estimate_charge_current_ma());
+		}
+
+		charge_current_ma = charge_controller_update(&charge_controller, setpoint_ma,
+							     DIV_ROUND(current_ua, 1000),
+							     now_us - charge_control_last_update_us);
+		charge_control_last_update_us = now_us;
+		bq24715_set_charge_current(&bq24715, charge_current_ma);
 	}
-	ESP_LOGI(TAG, "Charge current setpoint: %umA", charge_current_setpoint_ma);
 
-	bq24715_set_charge_current(&bq24715, charge_current_setpoint_ma);
-	bq24715_set_input_current(&bq24715, input_current_limit_ma);
+	scheduler_schedule_task_relative(&charge_control_task, charge_control_cb, NULL, MS_TO_US(charge_control_interval_ms));
+}
+
+static void power_path_set_charge_control_interval_ms_(unsigned int interval_ms) {
+	charge_control_interval_ms = CLAMP(interval_ms, CHARGE_CONTROL_MIN_INTERVAL_MS, CHARGE_CONTROL_MAX_INTERVAL_MS);
 }
 
 static void power_path_group_add_ina_data_(power_path_group_data_t *data, const ina_state_t *ina) {
@@ -191,35 +376,160 @@ static void power_path_update_group_data(void) {
 		update_ina(ina_state);
 	}
 
-	power_path_group_set_ina_data(&group_data[POWER_PATH_GROUP_IN],
+	power_path_group_set_ina_data(&snapshot_next.groups[POWER_PATH_GROUP_IN],
 				      &inas[INA_TYPE_DC_IN], NULL);
-	power_path_group_set_ina_data(&group_data[POWER_PATH_GROUP_DC],
+	power_path_group_set_ina_data(&snapshot_next.groups[POWER_PATH_GROUP_DC],
 				      &inas[INA_TYPE_DC_OUT_PASSTHROUGH],
 				      &inas[INA_TYPE_DC_OUT_STEP_UP]);
-	power_path_group_set_ina_data(&group_data[POWER_PATH_GROUP_USB],
+	power_path_group_set_ina_data(&snapshot_next.groups[POWER_PATH_GROUP_USB],
 				      &inas[INA_TYPE_USB_OUT], NULL);
 
 	for (i = 0; i < ARRAY_SIZE(lm75_defs); i++) {
 		lm75_state_t *lm75_state = &lm75s[i];
 		const lm75_def_t *lm75_def = &lm75_defs[i];
 
-		lm75_read_temperature_mdegc(&lm75_state->lm75, &group_data[i].temperature_mdegc);
+		lm75_read_temperature_mdegc(&lm75_state->lm75, &snapshot_next.groups[i].temperature_mdegc);
+	}
+
+}
+
+static void publish_snapshot(void) {
+	seqlock_write_begin(&snapshot_lock);
+	snapshot = snapshot_next;
+	seqlock_write_end(&snapshot_lock);
+}
+
+static unsigned int read_dc_output_voltage_mv(void) {
+	unsigned int lookup_idx =
+		(gpio_get_level(GPIO_VSEL0) ? 1 : 0) |
+		((gpio_get_level(GPIO_VSEL1) ? 1 : 0) << 1);
+
+	return dc_output_voltage_table[lookup_idx];
+}
+
+static void power_source_notify_cb(void *ctx) {
+	int64_t edge_us;
+	bool on_battery;
+
+	xSemaphoreTake(power_source_lock, portMAX_DELAY);
+	edge_us = power_source_notify_edge_us;
+	power_source_notify_pending = false;
+	on_battery = running_on_battery;
+	xSemaphoreGive(power_source_lock);
+
+	if (edge_us >= 0) {
+		power_source_last_latency_us = esp_timer_get_time() - edge_us;
+		power_source_max_latency_us = MAX(power_source_max_latency_us, power_source_last_latency_us);
+	} else {
+		ESP_LOGW(TAG, "Missed power source GPIO edge");
 	}
+	event_bus_notify("power_source", NULL);
+	if (edge_us >= 0) {
+		ESP_LOGI(TAG, "Power source changed, on battery: %d, edge to notify: %"PRId64" us",
+			 on_battery, power_source_last_latency_us);
+	}
+}
+
+/*
+ * Samples power source GPIOs and schedules a notification on change. Called
+ * with the timestamp of the first edge that caused the change or -1 if the
+ * change was found by polling.
+ */
+static void update_power_source(int64_t edge_us) {
+	bool on_battery;
+	unsigned int voltage_mv;
+	bool changed = false;
+	bool power_failed = false, power_restored = false;
+	int64_t outage_duration_us = 0;
+
+	xSemaphoreTake(power_source_lock, portMAX_DELAY);
+	on_battery = !gpio_get_level(GPIO_DCOK);
+	voltage_mv = read_dc_output_voltage_mv();
+	if (on_battery != running_on_battery || voltage_mv != dc_output_voltage_mv) {
+		if (on_battery && !running_on_battery) {
+			outage_start_us = esp_timer_get_time();
+			power_failed = true;
+		} else if (!on_battery && running_on_battery) {
+			outage_duration_us = esp_timer_get_time() - outage_start_us;
+			power_restored = true;
+		}
+		running_on_battery = on_battery;
+		dc_output_voltage_mv = voltage_mv;
+		power_source_transitions++;
+		// Latency is measured from the first edge not yet delivered to subscribers
+		if (!power_source_notify_pending) {
+			power_source_notify_pending = true;
+			power_source_notify_edge_us = edge_us;
+		}
+		changed = true;
+	}
+	xSemaphoreGive(power_source_lock);
+
+	// Appends are queued and written to flash from the scheduler task
+	if (power_failed) {
+		event_log_append(EVENT_LOG_TYPE_POWER_FAIL, voltage_mv, battery_gauge_get_soc_percent(), 0, 0);
+	} else if (power_restored) {
+		event_log_append(EVENT_LOG_TYPE_POWER_RESTORED, outage_duration_us / 1000000LL,
+				 battery_gauge_get_soc_percent(), 0, 0);
+	}
+	if (changed) {
+		scheduler_schedule_task_relative(&power_source_notify_task, power_source_notify_cb, NULL, 0);
+	}
+}
+
+static void power_gpio_isr(void *priv) {
+	power_gpio_event_t event = {
+		.type = POWER_GPIO_EVENT_EDGE,
+		.timestamp_us = esp_timer_get_time(),
+	};
+
+	xQueueSendToBackFromISR(power_gpio_event_queue, &event, NULL);
+}
+
+static void power_gpio_debounce_timer_elapsed_cb(void *arg) {
+	power_gpio_event_t event = {
+		.type = POWER_GPIO_EVENT_DEBOUNCED,
+		.timestamp_us = esp_timer_get_time(),
+	};
+
+	xQueueSendToBack(power_gpio_event_queue, &event, 0);
+}
 
+static void power_gpio_event_loop(void *arg) {
+	while (1) {
+		power_gpio_event_t event;
+
+		if (xQueueReceive(power_gpio_event_queue, &event, portMAX_DELAY)) {
+			switch (event.type) {
+			case POWER_GPIO_EVENT_EDGE:
+				if (first_edge_us < 0) {
+					first_edge_us = event.timestamp_us;
+				}
+				// Restart debounce interval on every edge
+				esp_timer_stop(power_gpio_debounce_timer);
+				esp_timer_start_once(power_gpio_debounce_timer, MS_TO_US(POWER_GPIO_DEBOUNCE_INTERVAL_MS));
+				break;
+			case POWER_GPIO_EVENT_DEBOUNCED:
+				update_power_source(first_edge_us);
+				first_edge_us = -1;
+				break;
+			}
+		}
+	}
 }
 
 static void power_path_update_cb(void *ctx);
 static void power_path_update_cb(void *ctx) {
-	bool on_battery = power_path_is_running_on_battery();
-
 	power_path_update_group_data();
 
+	update_charge_current_limit();
 	update_charge_current();
+	maintain_charger_registers();
 
-	if (running_on_battery != on_battery) {
-		running_on_battery = on_battery;
-		event_bus_notify("power_source", NULL);
-	}
+	publish_snapshot();
+
+	// Consistency check, edges should have been caught by the ISR already
+	update_power_source(-1);
 
 	event_bus_notify("power_path", NULL);
 	scheduler_schedule_task_relative(&power_path_update_task, power_path_update_cb, NULL, MS_TO_US(POWER_UPDATE_INTERVAL_MS));
@@ -238,6 +548,44 @@ void power_path_early_init(smbus_t *smbus, i2c_bus_t *i2c_bus) {
 	ESP_ERROR_CHECK(bq24715_set_charge_current(&bq24715, DEFAULT_CHARGE_CURRENT_MA));
 }
 
+static void power_path_init_power_source_gpios(void) {
+	int i;
+	const esp_timer_create_args_t debounce_timer_args = {
+		.callback = power_gpio_debounce_timer_elapsed_cb,
+		.dispatch_method = ESP_TIMER_TASK,
+		.name = "power_gpio_debounce"
+	};
+
+	power_source_lock = xSemaphoreCreateMutexStatic(&power_source_lock_buffer);
+	scheduler_task_init(&power_source_notify_task);
+	power_gpio_event_queue = xQueueCreateStatic(POWER_GPIO_EVENT_QUEUE_LENGTH, sizeof(power_gpio_event_t),
+						    power_gpio_event_queue_storage, &power_gpio_event_static_queue);
+	ESP_ERROR_CHECK(esp_timer_create(&debounce_timer_args, &power_gpio_debounce_timer));
+
+	// GPIO ISR service is installed by buttons_init
+	for (i = 0; i < ARRAY_SIZE(power_gpios); i++) {
+		gpio_config_t gpio_cfg = {
+			.pin_bit_mask = 1ULL << power_gpios[i],
+			.mode = GPIO_MODE_INPUT,
+			.pull_up_en = GPIO_PULLUP_DISABLE,
+			.pull_down_en = GPIO_PULLDOWN_DISABLE,
+			.intr_type = GPIO_INTR_ANYEDGE
+		};
+
+		ESP_ERROR_CHECK(gpio_config(&gpio_cfg));
+		ESP_ERROR_CHECK(gpio_isr_handler_add(power_gpios[i], power_gpio_isr, NULL));
+	}
+
+	running_on_battery = !gpio_get_level(GPIO_DCOK);
+	dc_output_voltage_mv = read_dc_output_voltage_mv();
+	// Booted on battery, the outage started no later than now
+	if (running_on_battery) {
+		outage_start_us = esp_timer_get_time();
+	}
+
+	ESP_ERROR_CHECK(xTaskCreate(power_gpio_event_loop, "power_gpio_event_loop", 4096, NULL, 12, NULL) != pdPASS);
+}
+
 void power_path_init(smbus_t *smbus, i2c_bus_t *i2c_bus) {
 	int i;
 
@@ -255,8 +603,16 @@ void power_path_init(smbus_t *smbus, i2c_bus_t *i2c_bus) {
 
 	power_path_set_input_current_limit_(settings_get_input_current_limit_ma());
 
+	seqlock_init(&snapshot_lock);
+	power_path_init_power_source_gpios();
+
 	scheduler_task_init(&power_path_update_task);
 	scheduler_schedule_task_relative(&power_path_update_task, power_path_update_cb, NULL, 0);
+
+	charge_controller_init(&charge_controller, &charge_controller_cfg);
+	power_path_set_charge_control_interval_ms_(settings_get_charge_control_interval_ms());
+	scheduler_task_init(&charge_control_task);
+	scheduler_schedule_task_relative(&charge_control_task, charge_control_cb, NULL, MS_TO_US(POWER_UPDATE_INTERVAL_MS));
 }
 
 void power_path_set_input_current_limit(unsigned int current_ma) {
@@ -264,34 +620,176 @@ void power_path_set_input_current_limit(unsigned int current_ma) {
 	settings_set_input_current_limit_ma(current_ma);
 }
 
+// Does not persist the limit, used while probing the input source
+void power_path_set_input_current_limit_transient(unsigned int current_ma) {
+	power_path_set_input_current_limit_(current_ma);
+}
+
 unsigned int power_path_get_input_current_limit_ma(void) {
 	return input_current_limit_ma;
 }
 
+void power_path_set_charge_control_interval_ms(unsigned int interval_ms) {
+	power_path_set_charge_control_interval_ms_(interval_ms);
+	settings_set_charge_control_interval_ms(charge_control_interval_ms);
+}
+
+unsigned int power_path_get_charge_control_interval_ms(void) {
+	return charge_control_interval_ms;
+}
+
 
 bool power_path_is_running_on_battery() {
-	gpio_set_direction(GPIO_DCOK, GPIO_MODE_INPUT);
-	return !gpio_get_level(GPIO_DCOK);
+	return running_on_battery;
 }
 
 unsigned int power_path_get_dc_output_voltage_mv() {
-	gpio_set_direction(GPIO_VSEL0, GPIO_MODE_INPUT);
-	gpio_set_direction(GPIO_VSEL1, GPIO_MODE_INPUT);
+	return dc_output_voltage_mv;
+}
 
-	unsigned int lookup_idx =
-		(gpio_get_level(GPIO_VSEL0) ? 1 : 0) |
-		((gpio_get_level(GPIO_VSEL1) ? 1 : 0) << 1);
-	return dc_output_voltage_table[lookup_idx];
+void power_path_outputs_init(gpio_hc595_t *hc595) {
+	int i;
+
+	output_lock = xSemaphoreCreateMutexStatic(&output_lock_buffer);
+	output_hc595 = hc595;
+	gpio_hc595_set_level(hc595, GPIO_HC595_DC_OUT_TEST, 0);
+	gpio_hc595_set_level(hc595, GPIO_HC595_DC_OUT_OFF, 0);
+	for (i = 0; i < ARRAY_SIZE(output_defs); i++) {
+		gpio_hc595_set_level(hc595, output_defs[i].hc595_gpio, !output_enabled[i]);
+	}
+}
+
+void power_path_set_output_enabled(power_path_output_t output, bool enable) {
+	xSemaphoreTake(output_lock, portMAX_DELAY);
+	if (output_enabled[output] != enable) {
+		ESP_LOGI(TAG, "%s output %s", enable ? "Enabling" : "Disabling", output_defs[output].name);
+	}
+	output_enabled[output] = enable;
+	gpio_hc595_set_level(output_hc595, output_defs[output].hc595_gpio, !enable);
+	xSemaphoreGive(output_lock);
+}
+
+// DC_OUT_TEST feeds the DC outputs from the battery regardless of the input
+void power_path_set_test_load_enabled(bool enable) {
+	ESP_LOGI(TAG, "%s battery test load", enable ? "Enabling" : "Disabling");
+	gpio_hc595_set_level(output_hc595, GPIO_HC595_DC_OUT_TEST, enable);
+}
+
+void power_path_set_charging_inhibited(bool inhibit) {
+	charging_inhibited = inhibit;
+	scheduler_schedule_task_relative(&charge_control_task, charge_control_cb, NULL, 0);
+}
+
+bool power_path_is_output_enabled(power_path_output_t output) {
+	bool enabled;
+
+	xSemaphoreTake(output_lock, portMAX_DELAY);
+	enabled = output_enabled[output];
+	xSemaphoreGive(output_lock);
+
+	return enabled;
+}
+
+const char *power_path_output_to_name(power_path_output_t output) {
+	return output_defs[output].name;
 }
 
 bool power_path_is_dc_output_enabled(unsigned int output_idx) {
-	return dc_output_enable_table[output_idx];
+	return power_path_is_output_enabled(POWER_PATH_OUTPUT_DC1 + output_idx);
 }
 
 unsigned long power_path_get_output_power_consumption_mw() {
-	return output_power_mw;
+	unsigned long power_mw;
+	uint32_t sequence;
+
+	do {
+		sequence = seqlock_read_begin(&snapshot_lock);
+		power_mw = snapshot.output_power_mw;
+	} while (seqlock_read_retry(&snapshot_lock, sequence));
+
+	return power_mw;
 }
 
 void power_path_get_group_data(power_path_group_t group, power_path_group_data_t *data) {
-	*data = group_data[group];
+	uint32_t sequence;
+
+	do {
+		sequence = seqlock_read_begin(&snapshot_lock);
+		*data = snapshot.groups[group];
+	} while (seqlock_read_retry(&snapshot_lock, sequence));
+}
+
+void power_path_get_snapshot(power_path_snapshot_t *snapshot_) {
+	uint32_t sequence;
+
+	do {
+		sequence = seqlock_read_begin(&snapshot_lock);
+		*snapshot_ = snapshot;
+	} while (seqlock_read_retry(&snapshot_lock, sequence));
+}
+
+static void get_power_source_transitions(const prometheus_metric_value_t *val, prometheus_metric_t *metric, char *value) {
+	sprintf(value, "%u", power_source_transitions);
+}
+
+static const prometheus_metric_value_t power_source_transitions_value = {
+	.num_labels = 0,
+	.get_num_labels = NULL,
+	.get_value = get_power_source_transitions,
+};
+
+static const prometheus_metric_def_t power_source_transitions_metric_def = {
+	.name = "power_source_transitions_total",
+	.help = "Number of power source changes since boot",
+	.type = PROMETHEUS_METRIC_TYPE_COUNTER,
+	.values = &power_source_transitions_value,
+	.num_values = 1,
+	.get_num_values = NULL,
+};
+
+static void get_power_source_latency_last(const prometheus_metric_value_t *val, prometheus_metric_t *metric, char *value) {
+	sprintf(value, "%f", power_source_last_latency_us / 1000000.f);
+}
+
+static void get_power_source_latency_max(const prometheus_metric_value_t *val, prometheus_metric_t *metric, char *value) {
+	sprintf(value, "%f", power_source_max_latency_us / 1000000.f);
+}
+
+static const prometheus_label_t power_source_latency_last_labels[] = {
+	{ "stat", "last" },
+};
+
+static const prometheus_label_t power_source_latency_max_labels[] = {
+	{ "stat", "max" },
+};
+
+static const prometheus_metric_value_t power_source_latency_values[] = {
+	{
+		.num_labels = ARRAY_SIZE(power_source_latency_last_labels),
+		.labels = power_source_latency_last_labels,
+		.get_num_labels = NULL,
+		.get_value = get_power_source_latency_last,
+	},
+	{
+		.num_labels = ARRAY_SIZE(power_source_latency_max_labels),
+		.labels = power_source_latency_max_labels,
+		.get_num_labels = NULL,
+		.get_value = get_power_source_latency_max,
+	},
+};
+
+static const prometheus_metric_def_t power_source_latency_metric_def = {
+	.name = "power_source_transition_latency_seconds",
+	.help = "Time from power source GPIO edge to power source notification",
+	.type = PROMETHEUS_METRIC_TYPE_GAUGE,
+	.values = power_source_latency_values,
+	.num_values = ARRAY_SIZE(power_source_latency_values),
+	.get_num_values = NULL,
+};
+
+void power_path_install_metrics(prometheus_t *prometheus) {
+	prometheus_metric_init(&power_source_transitions_metric, &power_source_transitions_metric_def, NULL);
+	prometheus_add_metric(prometheus, &power_source_transitions_metric);
+	prometheus_metric_init(&power_source_latency_metric, &power_source_latency_metric_def, NULL);
+	prometheus_add_metric(prometheus, &power_source_latency_metric);
 }
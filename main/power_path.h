@@ -3,9 +3,18 @@
 #include <stdbool.h>
 #include <stdint.h>
 
+#include "gpio_hc595.h"
 #include "i2c_bus.h"
+#include "prometheus.h"
 #include "smbus.h"
 
+/*
+ * The charger clamps input current at the input current limit on its own
+ * (DPM). Regulating to the same value would wind the integrator up against
+ * that loop, so the PI loop tracks a setpoint this far below the limit.
+ */
+#define CHARGE_CONTROL_SETPOINT_MARGIN_PERCENT	5
+
 typedef enum power_path_group {
 	POWER_PATH_GROUP_IN,
 	POWER_PATH_GROUP_DC,
@@ -13,6 +22,14 @@ typedef enum power_path_group {
 	POWER_PATH_GROUP_MAX_ = POWER_PATH_GROUP_USB
 } power_path_group_t;
 
+typedef enum power_path_output {
+	POWER_PATH_OUTPUT_DC1,
+	POWER_PATH_OUTPUT_DC2,
+	POWER_PATH_OUTPUT_DC3,
+	POWER_PATH_OUTPUT_USB,
+	POWER_PATH_OUTPUT_MAX_ = POWER_PATH_OUTPUT_USB
+} power_path_output_t;
+
 typedef struct power_path_group_data {
 	unsigned int voltage_mv;
 	int current_ma;
@@ -20,12 +37,28 @@ typedef struct power_path_group_data {
 	int32_t temperature_mdegc;
 } power_path_group_data_t;
 
+typedef struct power_path_snapshot {
+	power_path_group_data_t groups[POWER_PATH_GROUP_MAX_ + 1];
+	unsigned long output_power_mw;
+} power_path_snapshot_t;
+
 void power_path_early_init(smbus_t *smbus, i2c_bus_t *i2c_bus);
 void power_path_init(smbus_t *smbus, i2c_bus_t *i2c_bus);
 void power_path_set_input_current_limit(unsigned int current_ma);
+void power_path_set_input_current_limit_transient(unsigned int current_ma);
 unsigned int power_path_get_input_current_limit_ma(void);
+void power_path_set_charge_control_interval_ms(unsigned int interval_ms);
+unsigned int power_path_get_charge_control_interval_ms(void);
 bool power_path_is_running_on_battery(void);
 unsigned int power_path_get_dc_output_voltage_mv(void);
+void power_path_outputs_init(gpio_hc595_t *hc595);
+void power_path_set_output_enabled(power_path_output_t output, bool enable);
+bool power_path_is_output_enabled(power_path_output_t output);
+void power_path_set_test_load_enabled(bool enable);
+void power_path_set_charging_inhibited(bool inhibit);
+const char *power_path_output_to_name(power_path_output_t output);
 bool power_path_is_dc_output_enabled(unsigned int output_idx);
 unsigned long power_path_get_output_power_consumption_mw(void);
 void power_path_get_group_data(power_path_group_t group, power_path_group_data_t *data);
+void power_path_get_snapshot(power_path_snapshot_t *snapshot);
+void power_path_install_metrics(prometheus_t *prometheus);
@@ -4,6 +4,7 @@
 #include <stdio.h>
 #include <string.h>
 
+#include "battery_gauge.h"
 #include "util.h"
 
 static void get_state_of_charge(const prometheus_metric_value_t *val, prometheus_metric_t *metric, char *value) {
@@ -72,14 +73,112 @@ static const prometheus_metric_def_t battery_full_charge_capacity_metric_def = {
 	.get_num_values = NULL,
 };
 
+static void get_remaining_capacity(const prometheus_metric_value_t *val, prometheus_metric_t *metric, char *value) {
+	bq40z50_t *gauge = metric->priv;
+	unsigned int remaining = 0;
+	bq40z50_get_remaining_capacity_mah(gauge, &remaining);
+	sprintf(value, "%f", remaining / 1000.f);
+}
+
+static const prometheus_metric_value_t battery_remaining_capacity_value = {
+	.num_labels = 0,
+	.get_num_labels = NULL,
+	.get_value = get_remaining_capacity,
+};
+
+static const prometheus_metric_def_t battery_remaining_capacity_metric_def = {
+	.name = "battery_remaining_capacity",
+	.help = "UPS battery remaining capacity in Ah",
+	.type = PROMETHEUS_METRIC_TYPE_GAUGE,
+	.values = &battery_remaining_capacity_value,
+	.num_values = 1,
+	.get_num_values = NULL,
+};
+
+static void get_runtime(const prometheus_metric_value_t *val, prometheus_metric_t *metric, char *value) {
+	runtime_estimate_t estimate;
+	battery_gauge_get_runtime_estimate(&estimate);
+	if (!estimate.valid) {
+		strcpy(value, "NaN");
+		return;
+	}
+	sprintf(value, "%u", estimate.runtime_min * 60);
+}
+
+static void get_runtime_low(const prometheus_metric_value_t *val, prometheus_metric_t *metric, char *value) {
+	runtime_estimate_t estimate;
+	battery_gauge_get_runtime_estimate(&estimate);
+	if (!estimate.valid) {
+		strcpy(value, "NaN");
+		return;
+	}
+	sprintf(value, "%u", estimate.runtime_low_min * 60);
+}
+
+static void get_runtime_high(const prometheus_metric_value_t *val, prometheus_metric_t *metric, char *value) {
+	runtime_estimate_t estimate;
+	battery_gauge_get_runtime_estimate(&estimate);
+	if (!estimate.valid) {
+		strcpy(value, "NaN");
+		return;
+	}
+	sprintf(value, "%u", estimate.runtime_high_min * 60);
+}
+
+static const prometheus_label_t battery_runtime_expected_labels[] = {
+	{ "bound", "expected" },
+};
+
+static const prometheus_label_t battery_runtime_low_labels[] = {
+	{ "bound", "low" },
+};
+
+static const prometheus_label_t battery_runtime_high_labels[] = {
+	{ "bound", "high" },
+};
+
+static const prometheus_metric_value_t battery_runtime_values[] = {
+	{
+		.num_labels = ARRAY_SIZE(battery_runtime_expected_labels),
+		.labels = battery_runtime_expected_labels,
+		.get_num_labels = NULL,
+		.get_value = get_runtime,
+	},
+	{
+		.num_labels = ARRAY_SIZE(battery_runtime_low_labels),
+		.labels = battery_runtime_low_labels,
+		.get_num_labels = NULL,
+		.get_value = get_runtime_low,
+	},
+	{
+		.num_labels = ARRAY_SIZE(battery_runtime_high_labels),
+		.labels = battery_runtime_high_labels,
+		.get_num_labels = NULL,
+		.get_value = get_runtime_high,
+	},
+};
+
+static const prometheus_metric_def_t battery_runtime_metric_def = {
+	.name = "battery_runtime_estimate_seconds",
+	.help = "Predicted UPS battery runtime at the smoothed output load with confidence band",
+	.type = PROMETHEUS_METRIC_TYPE_GAUGE,
+	.values = battery_runtime_values,
+	.num_values = ARRAY_SIZE(battery_runtime_values),
+	.get_num_values = NULL,
+};
+
 void prometheus_battery_metrics_init(prometheus_battery_metrics_t *metrics, bq40z50_t *gauge) {
 	prometheus_metric_init(&metrics->state_of_charge, &battery_state_of_charge_metric_def, gauge);
 	prometheus_metric_init(&metrics->state_of_health, &battery_state_of_health_metric_def, gauge);
 	prometheus_metric_init(&metrics->full_charge_capacity, &battery_full_charge_capacity_metric_def, gauge);
+	prometheus_metric_init(&metrics->remaining_capacity, &battery_remaining_capacity_metric_def, gauge);
+	prometheus_metric_init(&metrics->runtime, &battery_runtime_metric_def, gauge);
 }
 
 void prometheus_add_battery_metrics(prometheus_battery_metrics_t *metrics, prometheus_t *prometheus) {
 	prometheus_add_metric(prometheus, &metrics->state_of_charge);
 	prometheus_add_metric(prometheus, &metrics->state_of_health);
 	prometheus_add_metric(prometheus, &metrics->full_charge_capacity);
+	prometheus_add_metric(prometheus, &metrics->remaining_capacity);
+	prometheus_add_metric(prometheus, &metrics->runtime);
 }
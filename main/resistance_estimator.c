@@ -0,0 +1,51 @@
+#include "resistance_estimator.h"
+
+#include "util.h"
+
+void resistance_estimator_init(resistance_estimator_t *estimator, const resistance_estimator_cfg_t *cfg) {
+	estimator->cfg = *cfg;
+	estimator->sum_ii = 0;
+	estimator->sum_iv = 0;
+	estimator->sum_vv = 0;
+	estimator->weight_milli = 0;
+}
+
+static int64_t forget(const resistance_estimator_t *estimator, int64_t sum) {
+	return sum * estimator->cfg.forgetting_permille / 1000;
+}
+
+bool resistance_estimator_add_step(resistance_estimator_t *estimator, int delta_current_ma, int delta_voltage_mv) {
+	if (ABS(delta_current_ma) < estimator->cfg.min_step_ma) {
+		return false;
+	}
+
+	estimator->sum_ii = forget(estimator, estimator->sum_ii) + (int64_t)delta_current_ma * delta_current_ma;
+	estimator->sum_iv = forget(estimator, estimator->sum_iv) + (int64_t)delta_current_ma * delta_voltage_mv;
+	estimator->sum_vv = forget(estimator, estimator->sum_vv) + (int64_t)delta_voltage_mv * delta_voltage_mv;
+	estimator->weight_milli = forget(estimator, estimator->weight_milli) + 1000;
+
+	return true;
+}
+
+unsigned int resistance_estimator_get_resistance_mohm(const resistance_estimator_t *estimator) {
+	if (!estimator->sum_ii || estimator->sum_iv <= 0) {
+		return 0;
+	}
+
+	return estimator->sum_iv * 1000 / estimator->sum_ii;
+}
+
+unsigned int resistance_estimator_get_confidence_percent(const resistance_estimator_t *estimator) {
+	unsigned int full_weight_milli = estimator->cfg.full_confidence_steps * 1000;
+	int64_t fit_percent;
+
+	if (!estimator->sum_ii || !estimator->sum_vv || estimator->sum_iv <= 0) {
+		return 0;
+	}
+
+	// Coefficient of determination, forgetting keeps the sums well within int64
+	fit_percent = estimator->sum_iv * estimator->sum_iv * 100 / (estimator->sum_ii * estimator->sum_vv);
+	fit_percent = MIN(fit_percent, 100);
+
+	return fit_percent * MIN(estimator->weight_milli, full_weight_milli) / full_weight_milli;
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * Incremental least squares estimate of a resistance from current and
+ * voltage steps (delta_v = r * delta_i, regression through the origin)
+ * with exponential forgetting. Only running sums are kept. Pure integer
+ * math, no hardware dependencies.
+ *
+ * Confidence combines the coefficient of determination of the fit with
+ * the effective number of steps seen.
+ */
+typedef struct resistance_estimator_cfg {
+	// Weight retained by past steps per new step, in 1/1000
+	unsigned int forgetting_permille;
+	// Smaller current steps are drowned in measurement noise and ignored
+	unsigned int min_step_ma;
+	// Effective number of steps required for full confidence
+	unsigned int full_confidence_steps;
+} resistance_estimator_cfg_t;
+
+typedef struct resistance_estimator {
+	resistance_estimator_cfg_t cfg;
+
+	// Managed properties
+	int64_t sum_ii;
+	int64_t sum_iv;
+	int64_t sum_vv;
+	// Effective number of steps in 1/1000
+	unsigned int weight_milli;
+} resistance_estimator_t;
+
+void resistance_estimator_init(resistance_estimator_t *estimator, const resistance_estimator_cfg_t *cfg);
+bool resistance_estimator_add_step(resistance_estimator_t *estimator, int delta_current_ma, int delta_voltage_mv);
+unsigned int resistance_estimator_get_resistance_mohm(const resistance_estimator_t *estimator);
+unsigned int resistance_estimator_get_confidence_percent(const resistance_estimator_t *estimator);
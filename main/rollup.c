@@ -0,0 +1,133 @@
+#include "rollup.h"
+
+#include "util.h"
+
+static const unsigned int tier_intervals_s[] = {
+	[ROLLUP_TIER_SECONDS] = 1,
+	[ROLLUP_TIER_MINUTES] = 60,
+	[ROLLUP_TIER_HOURS] = 60 * 60,
+};
+
+static void accumulator_reset(rollup_accumulator_t *acc) {
+	acc->sum = 0;
+	acc->count = 0;
+	acc->min = INT32_MAX;
+	acc->max = INT32_MIN;
+	acc->last = 0;
+}
+
+static void accumulator_merge(rollup_accumulator_t *acc, const rollup_accumulator_t *other) {
+	if (!other->count) {
+		return;
+	}
+
+	acc->sum += other->sum;
+	acc->count += other->count;
+	acc->min = MIN(acc->min, other->min);
+	acc->max = MAX(acc->max, other->max);
+	acc->last = other->last;
+}
+
+static void tier_init(rollup_tier_t *tier, unsigned int interval_s, rollup_bucket_t *buckets, unsigned int num_buckets, int64_t now_s) {
+	tier->interval_s = interval_s;
+	tier->buckets = buckets;
+	tier->num_buckets = num_buckets;
+	tier->head = 0;
+	tier->num_closed = 0;
+	tier->bucket_start_s = now_s - now_s % interval_s;
+	accumulator_reset(&tier->acc);
+}
+
+static void tier_close_bucket(rollup_tier_t *tier, rollup_tier_t *next_tier) {
+	rollup_accumulator_t *acc = &tier->acc;
+	rollup_bucket_t *bucket;
+
+	tier->head = (tier->head + 1) % tier->num_buckets;
+	bucket = &tier->buckets[tier->head];
+	bucket->min = acc->min;
+	bucket->max = acc->max;
+	bucket->last = acc->last;
+	bucket->mean = acc->count ? acc->sum / (int64_t)acc->count : 0;
+	if (tier->num_closed < tier->num_buckets) {
+		tier->num_closed++;
+	}
+
+	if (next_tier) {
+		accumulator_merge(&next_tier->acc, acc);
+	}
+	accumulator_reset(acc);
+	tier->bucket_start_s += tier->interval_s;
+}
+
+static void tier_advance(rollup_tier_t *tier, rollup_tier_t *next_tier, int64_t now_s) {
+	int64_t span_s = (int64_t)tier->interval_s * tier->num_buckets;
+
+	if (now_s < tier->bucket_start_s + tier->interval_s) {
+		return;
+	}
+
+	// Close current bucket, it might hold data that needs to propagate
+	tier_close_bucket(tier, next_tier);
+
+	// Skip over gaps larger than the whole tier at once
+	if (now_s - tier->bucket_start_s >= span_s) {
+		int64_t aligned_now_s = now_s - now_s % tier->interval_s;
+
+		tier->bucket_start_s = aligned_now_s - span_s;
+	}
+
+	while (now_s >= tier->bucket_start_s + tier->interval_s) {
+		tier_close_bucket(tier, next_tier);
+	}
+}
+
+void rollup_init(rollup_t *rollup, int64_t now_s) {
+	tier_init(&rollup->tiers[ROLLUP_TIER_SECONDS], tier_intervals_s[ROLLUP_TIER_SECONDS],
+		  rollup->buckets_seconds, ARRAY_SIZE(rollup->buckets_seconds), now_s);
+	tier_init(&rollup->tiers[ROLLUP_TIER_MINUTES], tier_intervals_s[ROLLUP_TIER_MINUTES],
+		  rollup->buckets_minutes, ARRAY_SIZE(rollup->buckets_minutes), now_s);
+	tier_init(&rollup->tiers[ROLLUP_TIER_HOURS], tier_intervals_s[ROLLUP_TIER_HOURS],
+		  rollup->buckets_hours, ARRAY_SIZE(rollup->buckets_hours), now_s);
+}
+
+void rollup_advance(rollup_t *rollup, int64_t now_s) {
+	unsigned int i;
+
+	// Finer tiers first, closing their buckets feeds the coarser tiers
+	for (i = 0; i < ARRAY_SIZE(rollup->tiers); i++) {
+		rollup_tier_t *next_tier = i < ROLLUP_TIER_MAX_ ? &rollup->tiers[i + 1] : NULL;
+
+		tier_advance(&rollup->tiers[i], next_tier, now_s);
+	}
+}
+
+void rollup_add_sample(rollup_t *rollup, int64_t now_s, int32_t value) {
+	rollup_accumulator_t *acc = &rollup->tiers[ROLLUP_TIER_SECONDS].acc;
+
+	rollup_advance(rollup, now_s);
+
+	acc->sum += value;
+	acc->count++;
+	acc->min = MIN(acc->min, value);
+	acc->max = MAX(acc->max, value);
+	acc->last = value;
+}
+
+unsigned int rollup_get_num_buckets(const rollup_t *rollup, rollup_tier_id_t tier) {
+	return rollup->tiers[tier].num_closed;
+}
+
+unsigned int rollup_get_tier_interval_s(const rollup_t *rollup, rollup_tier_id_t tier) {
+	return rollup->tiers[tier].interval_s;
+}
+
+bool rollup_get_bucket(const rollup_t *rollup, rollup_tier_id_t tier_id, unsigned int age, rollup_bucket_t *bucket) {
+	const rollup_tier_t *tier = &rollup->tiers[tier_id];
+
+	if (age >= tier->num_closed) {
+		return false;
+	}
+
+	*bucket = tier->buckets[(tier->head + tier->num_buckets - age) % tier->num_buckets];
+	return true;
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define ROLLUP_SECONDS_NUM_BUCKETS	60
+#define ROLLUP_MINUTES_NUM_BUCKETS	60
+#define ROLLUP_HOURS_NUM_BUCKETS	(24 * 7)
+
+typedef enum rollup_tier_id {
+	ROLLUP_TIER_SECONDS,
+	ROLLUP_TIER_MINUTES,
+	ROLLUP_TIER_HOURS,
+	ROLLUP_TIER_MAX_ = ROLLUP_TIER_HOURS
+} rollup_tier_id_t;
+
+// Closed bucket, empty if min > max
+typedef struct rollup_bucket {
+	int32_t min;
+	int32_t max;
+	int32_t mean;
+	int32_t last;
+} rollup_bucket_t;
+
+typedef struct rollup_accumulator {
+	int64_t sum;
+	uint32_t count;
+	int32_t min;
+	int32_t max;
+	int32_t last;
+} rollup_accumulator_t;
+
+typedef struct rollup_tier {
+	unsigned int interval_s;
+	unsigned int num_buckets;
+	rollup_bucket_t *buckets;
+
+	// Managed properties
+	unsigned int head;
+	unsigned int num_closed;
+	int64_t bucket_start_s;
+	rollup_accumulator_t acc;
+} rollup_tier_t;
+
+typedef struct rollup {
+	rollup_tier_t tiers[ROLLUP_TIER_MAX_ + 1];
+	rollup_bucket_t buckets_seconds[ROLLUP_SECONDS_NUM_BUCKETS];
+	rollup_bucket_t buckets_minutes[ROLLUP_MINUTES_NUM_BUCKETS];
+	rollup_bucket_t buckets_hours[ROLLUP_HOURS_NUM_BUCKETS];
+} rollup_t;
+
+void rollup_init(rollup_t *rollup, int64_t now_s);
+void rollup_add_sample(rollup_t *rollup, int64_t now_s, int32_t value);
+void rollup_advance(rollup_t *rollup, int64_t now_s);
+unsigned int rollup_get_num_buckets(const rollup_t *rollup, rollup_tier_id_t tier);
+unsigned int rollup_get_tier_interval_s(const rollup_t *rollup, rollup_tier_id_t tier);
+bool rollup_get_bucket(const rollup_t *rollup, rollup_tier_id_t tier, unsigned int age, rollup_bucket_t *bucket);
+
+static inline bool rollup_bucket_is_empty(const rollup_bucket_t *bucket) {
+	return bucket->min > bucket->max;
+}
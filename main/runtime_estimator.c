@@ -0,0 +1,73 @@
+#include "runtime_estimator.h"
+
+#include "util.h"
+
+// Band width in smoothed mean absolute deviations of the load
+#define LOAD_DEVIATION_FACTOR	1
+
+void runtime_estimator_init(runtime_estimator_t *estimator, const runtime_estimator_cfg_t *cfg) {
+	estimator->cfg = *cfg;
+	estimator->primed = false;
+	estimator->load_uw = 0;
+	estimator->load_deviation_uw = 0;
+}
+
+static int64_t ema_update(int64_t average, int64_t sample, int64_t dt_us, int64_t time_constant_us) {
+	return average + (sample - average) * dt_us / (time_constant_us + dt_us);
+}
+
+void runtime_estimator_add_load_sample(runtime_estimator_t *estimator, unsigned long load_mw, unsigned int dt_us) {
+	int64_t time_constant_us = MS_TO_US((int64_t)estimator->cfg.load_time_constant_ms);
+	int64_t sample_uw = (int64_t)load_mw * 1000;
+	int64_t deviation_uw;
+
+	if (!estimator->primed) {
+		estimator->load_uw = sample_uw;
+		estimator->load_deviation_uw = 0;
+		estimator->primed = true;
+		return;
+	}
+
+	deviation_uw = sample_uw - estimator->load_uw;
+	if (deviation_uw < 0) {
+		deviation_uw = -deviation_uw;
+	}
+	estimator->load_uw = ema_update(estimator->load_uw, sample_uw, dt_us, time_constant_us);
+	estimator->load_deviation_uw = ema_update(estimator->load_deviation_uw, deviation_uw, dt_us, time_constant_us);
+}
+
+static unsigned int runtime_min(const runtime_estimator_cfg_t *cfg, int64_t energy_uwh, int64_t load_uw) {
+	int64_t runtime_min;
+
+	load_uw = MAX(load_uw, (int64_t)cfg->min_load_mw * 1000);
+	runtime_min = energy_uwh * 60 / load_uw;
+	return MIN(runtime_min, cfg->max_runtime_min);
+}
+
+void runtime_estimator_get_estimate(const runtime_estimator_t *estimator, const runtime_estimator_inputs_t *inputs,
+				    runtime_estimate_t *estimate) {
+	const runtime_estimator_cfg_t *cfg = &estimator->cfg;
+	unsigned int voltage_mv = COALESCE(inputs->voltage_mv, cfg->nominal_voltage_mv);
+	int32_t usable_percent = charge_profile_curve_eval(&cfg->temperature_derating, inputs->temperature_mdegc);
+	int64_t energy_uwh;
+	int64_t energy_low_uwh;
+	int64_t load_deviation_uw = estimator->load_deviation_uw * LOAD_DEVIATION_FACTOR;
+	unsigned int band_min;
+
+	usable_percent = CLAMP(usable_percent, 0, 100);
+	energy_uwh = (int64_t)inputs->remaining_capacity_mah * voltage_mv;
+	energy_uwh = energy_uwh * usable_percent / 100 * cfg->efficiency_percent / 100;
+	energy_low_uwh = energy_uwh * (100 - cfg->capacity_uncertainty_percent) / 100;
+
+	estimate->valid = estimator->primed && inputs->remaining_capacity_mah;
+	estimate->load_mw = DIV_ROUND(estimator->load_uw, 1000);
+	estimate->usable_energy_mwh = DIV_ROUND(energy_uwh, 1000);
+	estimate->runtime_min = runtime_min(cfg, energy_uwh, estimator->load_uw);
+	estimate->runtime_low_min = runtime_min(cfg, energy_low_uwh, estimator->load_uw + load_deviation_uw);
+	/*
+	 * Runtime is convex in load, a load dip would inflate the upper bound
+	 * far more than a load spike shrinks the lower one. Mirror the band.
+	 */
+	band_min = estimate->runtime_min - estimate->runtime_low_min;
+	estimate->runtime_high_min = MIN(estimate->runtime_min + band_min, cfg->max_runtime_min);
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "charge_profile.h"
+
+/*
+ * Battery runtime prediction from remaining capacity and exponentially
+ * smoothed load power. Load samples may arrive at irregular intervals, the
+ * filters weight each one by the time elapsed since the previous sample.
+ *
+ * The confidence band combines load variability (smoothed mean absolute
+ * deviation) with a fixed capacity uncertainty.
+ */
+typedef struct runtime_estimator_cfg {
+	// Time constant of the load power and load deviation filters
+	unsigned int load_time_constant_ms;
+	// Pack temperature in mdeg C to usable percentage of remaining capacity
+	charge_profile_curve_t temperature_derating;
+	// Efficiency of the conversion from battery to outputs
+	unsigned int efficiency_percent;
+	unsigned int capacity_uncertainty_percent;
+	// Used if the gauge does not report a pack voltage
+	unsigned int nominal_voltage_mv;
+	// Loads below this are treated as this for the upper bound
+	unsigned int min_load_mw;
+	unsigned int max_runtime_min;
+} runtime_estimator_cfg_t;
+
+typedef struct runtime_estimator {
+	runtime_estimator_cfg_t cfg;
+
+	// Managed properties
+	bool primed;
+	int64_t load_uw;
+	int64_t load_deviation_uw;
+} runtime_estimator_t;
+
+typedef struct runtime_estimator_inputs {
+	unsigned int remaining_capacity_mah;
+	unsigned int voltage_mv;
+	int32_t temperature_mdegc;
+} runtime_estimator_inputs_t;
+
+typedef struct runtime_estimate {
+	bool valid;
+	unsigned int runtime_min;
+	unsigned int runtime_low_min;
+	unsigned int runtime_high_min;
+	unsigned long load_mw;
+	unsigned long usable_energy_mwh;
+} runtime_estimate_t;
+
+void runtime_estimator_init(runtime_estimator_t *estimator, const runtime_estimator_cfg_t *cfg);
+void runtime_estimator_add_load_sample(runtime_estimator_t *estimator, unsigned long load_mw, unsigned int dt_us);
+void runtime_estimator_get_estimate(const runtime_estimator_t *estimator, const runtime_estimator_inputs_t *inputs,
+				    runtime_estimate_t *estimate);
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <freertos/FreeRTOS.h>
+
+/*
+ * Sequence lock for single writer, multiple reader snapshots.
+ *
+ * The writer runs its (short) update inside a critical section. Thus it
+ * can not be preempted while the sequence is odd and readers on either
+ * core only ever spin for the duration of a memcpy.
+ */
+typedef struct seqlock {
+	uint32_t sequence;
+	portMUX_TYPE mux;
+} seqlock_t;
+
+static inline void seqlock_init(seqlock_t *lock) {
+	lock->sequence = 0;
+	portMUX_INITIALIZE(&lock->mux);
+}
+
+static inline void seqlock_write_begin(seqlock_t *lock) {
+	portENTER_CRITICAL(&lock->mux);
+	__atomic_store_n(&lock->sequence, lock->sequence + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static inline void seqlock_write_end(seqlock_t *lock) {
+	__atomic_store_n(&lock->sequence, lock->sequence + 1, __ATOMIC_RELEASE);
+	portEXIT_CRITICAL(&lock->mux);
+}
+
+static inline uint32_t seqlock_read_begin(const seqlock_t *lock) {
+	uint32_t sequence;
+
+	while ((sequence = __atomic_load_n(&lock->sequence, __ATOMIC_ACQUIRE)) & 1);
+
+	return sequence;
+}
+
+static inline bool seqlock_read_retry(const seqlock_t *lock, uint32_t sequence) {
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	return __atomic_load_n(&lock->sequence, __ATOMIC_RELAXED) != sequence;
+}
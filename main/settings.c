@@ -1,5 +1,6 @@
 #include "settings.h"
 
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
@@ -10,6 +11,8 @@
 #include <esp_log.h>
 #include <nvs_flash.h>
 
+#include "util.h"
+
 static const char *TAG = "settings";
 
 static nvs_handle_t nvs;
@@ -132,6 +135,47 @@ static void nvs_set_uint(const char *key, unsigned int value) {
 	}
 }
 
+static bool nvs_load_blob(const char *key, void *buf, size_t len) {
+	esp_err_t err;
+	size_t stored_len = 0;
+
+	key = ellipsize_key(key);
+	// Query size first, the caller's buffer must stay untouched if it does not match
+	err = nvs_get_blob(nvs, key, NULL, &stored_len);
+	if (!err) {
+		if (stored_len != len) {
+			ESP_LOGW(TAG, "Size of blob '%s' in NVS changed from %u to %u bytes, ignoring it",
+				 key, (unsigned int)stored_len, (unsigned int)len);
+			return false;
+		}
+		err = nvs_get_blob(nvs, key, buf, &stored_len);
+	}
+	if (err) {
+		if (err != ESP_ERR_NVS_NOT_FOUND) {
+			ESP_LOGE(TAG, "Failed to load blob '%s' from NVS: %d", key, err);
+		}
+		return false;
+	}
+
+	return true;
+}
+
+static void nvs_store_blob(const char *key, const void *buf, size_t len) {
+	esp_err_t err;
+
+	key = ellipsize_key(key);
+	err = nvs_set_blob(nvs, key, buf, len);
+	if (err) {
+		ESP_LOGE(TAG, "Failed to store blob '%s' to NVS: %d", key, err);
+		return;
+	}
+
+	err = nvs_commit(nvs);
+	if (err) {
+		ESP_LOGE(TAG, "Failed to commit blob '%s' to NVS: %d", key, err);
+	}
+}
+
 void settings_set_serial_number(const char *str) {
 	nvs_set_string("Serial", str);
 }
@@ -147,3 +191,84 @@ void settings_set_input_current_limit_ma(unsigned int current_ma) {
 unsigned int settings_get_input_current_limit_ma(void) {
 	return nvs_get_uint("MaxInCurrent", 1000);
 }
+
+void settings_set_charge_control_interval_ms(unsigned int interval_ms) {
+	nvs_set_uint("ChargeCtrlMs", interval_ms);
+}
+
+unsigned int settings_get_charge_control_interval_ms(void) {
+	return nvs_get_uint("ChargeCtrlMs", 100);
+}
+
+void settings_set_energy_counters(const uint64_t *counters_nj, unsigned int num_counters) {
+	nvs_store_blob("EnergyCounters", counters_nj, num_counters * sizeof(*counters_nj));
+}
+
+bool settings_get_energy_counters(uint64_t *counters_nj, unsigned int num_counters) {
+	return nvs_load_blob("EnergyCounters", counters_nj, num_counters * sizeof(*counters_nj));
+}
+
+void settings_set_output_priority(unsigned int output, unsigned int priority) {
+	char key[NVS_KEY_NAME_MAX_SIZE];
+
+	snprintf(key, sizeof(key), "OutPrio%u", output);
+	nvs_set_uint(key, priority);
+}
+
+unsigned int settings_get_output_priority(unsigned int output, unsigned int default_priority) {
+	char key[NVS_KEY_NAME_MAX_SIZE];
+
+	snprintf(key, sizeof(key), "OutPrio%u", output);
+	return nvs_get_uint(key, default_priority);
+}
+
+void settings_set_shed_target_runtime_min(unsigned int runtime_min) {
+	nvs_set_uint("ShedTargetTime", runtime_min);
+}
+
+unsigned int settings_get_shed_target_runtime_min(void) {
+	return nvs_get_uint("ShedTargetTime", 0);
+}
+
+void settings_set_undervoltage_latency_ms(unsigned int last_ms, unsigned int max_ms) {
+	nvs_set_uint("UvLatencyLast", MIN(last_ms, UINT16_MAX));
+	nvs_set_uint("UvLatencyMax", MIN(max_ms, UINT16_MAX));
+}
+
+void settings_get_undervoltage_latency_ms(unsigned int *last_ms, unsigned int *max_ms) {
+	*last_ms = nvs_get_uint("UvLatencyLast", 0);
+	*max_ms = nvs_get_uint("UvLatencyMax", 0);
+}
+
+void settings_set_battery_self_test_results(const void *results, size_t len) {
+	nvs_store_blob("BattTestTrend", results, len);
+}
+
+bool settings_get_battery_self_test_results(void *results, size_t len) {
+	return nvs_load_blob("BattTestTrend", results, len);
+}
+
+void settings_set_battery_self_test_interval_h(unsigned int interval_h) {
+	nvs_set_uint("BattTestIntvl", interval_h);
+}
+
+unsigned int settings_get_battery_self_test_interval_h(void) {
+	// Weekly by default
+	return nvs_get_uint("BattTestIntvl", 7 * 24);
+}
+
+void settings_set_battery_self_test_age_h(unsigned int age_h) {
+	nvs_set_uint("BattTestAge", age_h);
+}
+
+unsigned int settings_get_battery_self_test_age_h(void) {
+	return nvs_get_uint("BattTestAge", 0);
+}
+
+void settings_set_display_max_fps(unsigned int fps) {
+	nvs_set_uint("DispMaxFps", fps);
+}
+
+unsigned int settings_get_display_max_fps(void) {
+	return nvs_get_uint("DispMaxFps", 25);
+}
@@ -1,6 +1,8 @@
 #pragma once
 
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 
 void settings_init(void);
 
@@ -9,3 +11,28 @@ char *settings_get_serial_number(void);
 
 void settings_set_input_current_limit_ma(unsigned int current_ma);
 unsigned int settings_get_input_current_limit_ma(void);
+
+void settings_set_charge_control_interval_ms(unsigned int interval_ms);
+unsigned int settings_get_charge_control_interval_ms(void);
+
+void settings_set_energy_counters(const uint64_t *counters_nj, unsigned int num_counters);
+bool settings_get_energy_counters(uint64_t *counters_nj, unsigned int num_counters);
+
+void settings_set_output_priority(unsigned int output, unsigned int priority);
+unsigned int settings_get_output_priority(unsigned int output, unsigned int default_priority);
+
+void settings_set_shed_target_runtime_min(unsigned int runtime_min);
+unsigned int settings_get_shed_target_runtime_min(void);
+
+void settings_set_undervoltage_latency_ms(unsigned int last_ms, unsigned int max_ms);
+void settings_get_undervoltage_latency_ms(unsigned int *last_ms, unsigned int *max_ms);
+
+void settings_set_battery_self_test_results(const void *results, size_t len);
+bool settings_get_battery_self_test_results(void *results, size_t len);
+void settings_set_battery_self_test_interval_h(unsigned int interval_h);
+unsigned int settings_get_battery_self_test_interval_h(void);
+void settings_set_battery_self_test_age_h(unsigned int age_h);
+unsigned int settings_get_battery_self_test_age_h(void);
+
+void settings_set_display_max_fps(unsigned int fps);
+unsigned int settings_get_display_max_fps(void);
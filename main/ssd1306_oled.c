@@ -10,6 +10,18 @@
 #include "delay.h"
 #include "util.h"
 
+#define COLUMN_OFFSET		32
+#define NUM_COLUMNS		64
+#define NUM_PAGES		6
+
+// Co = 1: a single command byte follows, then another control byte
+#define CONTROL_COMMAND_SINGLE	0x80
+#define CONTROL_COMMAND_STREAM	0x00
+#define CONTROL_DATA_STREAM	0x40
+
+// Address byte, window setup and data control byte sent for each window
+#define WINDOW_OVERHEAD_BYTES	(1 + 12 + 1)
+
 const uint8_t init_sequence[] = {
 	0xae, /* display off */
 	0x00, /* set low column address */
@@ -38,24 +50,18 @@ const uint8_t init_sequence[] = {
 	0xaf /* display on */
 };
 
-static esp_err_t send_command(ssd1306_oled_t *oled, uint8_t command) {
-	i2c_cmd_handle_t cmd = i2c_cmd_link_create_static(oled->xfers_cmd, sizeof(oled->xfers_cmd));
-	i2c_master_start(cmd);
-	i2c_master_write_byte(cmd, (oled->address << 1), true);
-	i2c_master_write_byte(cmd, 0x00, true);
-	i2c_master_write_byte(cmd, command, true);
-	i2c_master_stop(cmd);
-	esp_err_t err = i2c_bus_cmd_begin(oled->bus, cmd, pdMS_TO_TICKS(10));
-	i2c_cmd_link_delete_static(cmd);
-	return err;
-}
+typedef struct window {
+	unsigned int first_page;
+	unsigned int last_page;
+	unsigned int first_column;
+	unsigned int last_column;
+} window_t;
 
-static esp_err_t write_gdram(ssd1306_oled_t *oled, uint8_t* data, unsigned int len) {
+static esp_err_t write_buf(ssd1306_oled_t *oled, const uint8_t *buf, unsigned int len) {
 	i2c_cmd_handle_t cmd = i2c_cmd_link_create_static(oled->xfers_cmd, sizeof(oled->xfers_cmd));
 	i2c_master_start(cmd);
 	i2c_master_write_byte(cmd, (oled->address << 1), true);
-	i2c_master_write_byte(cmd, 0x40, true);
-	i2c_master_write(cmd, data, len, I2C_MASTER_ACK);
+	i2c_master_write(cmd, buf, len, I2C_MASTER_ACK);
 	i2c_master_stop(cmd);
 	esp_err_t err = i2c_bus_cmd_begin(oled->bus, cmd, pdMS_TO_TICKS(10));
 	i2c_cmd_link_delete_static(cmd);
@@ -63,13 +69,9 @@ static esp_err_t write_gdram(ssd1306_oled_t *oled, uint8_t* data, unsigned int l
 }
 
 static esp_err_t send_command_list(ssd1306_oled_t *oled, const uint8_t *cmds, unsigned int num_cmds) {
-	while (num_cmds--) {
-		esp_err_t err = send_command(oled, *cmds++);
-		if (err) {
-			return err;
-		}
-	}
-	return ESP_OK;
+	oled->tx_buf[0] = CONTROL_COMMAND_STREAM;
+	memcpy(&oled->tx_buf[1], cmds, num_cmds);
+	return write_buf(oled, oled->tx_buf, num_cmds + 1);
 }
 
 static void reset(ssd1306_oled_t *oled) {
@@ -86,6 +88,7 @@ esp_err_t ssd1306_oled_init(ssd1306_oled_t *oled, i2c_bus_t *bus, unsigned int a
 	oled->bus = bus;
 	oled->address = address;
 	oled->reset_gpio = reset_gpio;
+	oled->shadow_valid = false;
 	if (reset_gpio >= 0) {
 		gpio_set_direction(reset_gpio, GPIO_MODE_OUTPUT);
 	}
@@ -93,19 +96,111 @@ esp_err_t ssd1306_oled_init(ssd1306_oled_t *oled, i2c_bus_t *bus, unsigned int a
 	return send_command_list(oled, init_sequence, ARRAY_SIZE(init_sequence));
 }
 
-esp_err_t ssd1306_oled_render_fb(ssd1306_oled_t *oled, fb_t *fb) {
+// Address setup and data for one window in a single transaction
+static esp_err_t send_window(ssd1306_oled_t *oled, const fb_t *fb, const window_t *window, unsigned int *bytes_sent) {
 	const uint8_t address_setup[] = {
 		0x21,
-		32,
-		95,
+		COLUMN_OFFSET + window->first_column,
+		COLUMN_OFFSET + window->last_column,
 		0x22,
-		0,
-		5
+		window->first_page,
+		window->last_page
 	};
-	esp_err_t err = send_command_list(oled, address_setup, ARRAY_SIZE(address_setup));
+	unsigned int width = window->last_column - window->first_column + 1;
+	unsigned int len = 0;
+	unsigned int i, page;
+	esp_err_t err;
+
+	for (i = 0; i < ARRAY_SIZE(address_setup); i++) {
+		oled->tx_buf[len++] = CONTROL_COMMAND_SINGLE;
+		oled->tx_buf[len++] = address_setup[i];
+	}
+	oled->tx_buf[len++] = CONTROL_DATA_STREAM;
+	for (page = window->first_page; page <= window->last_page; page++) {
+		memcpy(&oled->tx_buf[len], &fb->data[page * NUM_COLUMNS + window->first_column], width);
+		len += width;
+	}
+
+	err = write_buf(oled, oled->tx_buf, len);
 	if (err) {
 		return err;
 	}
-	return write_gdram(oled, fb->data, sizeof(fb->data));
+
+	for (page = window->first_page; page <= window->last_page; page++) {
+		unsigned int offset = page * NUM_COLUMNS + window->first_column;
+
+		memcpy(&oled->shadow_fb.data[offset], &fb->data[offset], width);
+	}
+	*bytes_sent += len + 1;
+	return ESP_OK;
 }
 
+static unsigned int window_bytes(const window_t *window) {
+	return (window->last_page - window->first_page + 1) *
+	       (window->last_column - window->first_column + 1) + WINDOW_OVERHEAD_BYTES;
+}
+
+esp_err_t ssd1306_oled_render_fb(ssd1306_oled_t *oled, const fb_t *fb, unsigned int *bytes_sent) {
+	window_t window;
+	bool window_open = false;
+	unsigned int bytes = 0;
+	unsigned int page;
+	esp_err_t err = ESP_OK;
+
+	for (page = 0; page < NUM_PAGES && !err; page++) {
+		const uint8_t *row = &fb->data[page * NUM_COLUMNS];
+		const uint8_t *shadow_row = &oled->shadow_fb.data[page * NUM_COLUMNS];
+		window_t page_window = {
+			.first_page = page,
+			.last_page = page,
+			.first_column = 0,
+			.last_column = NUM_COLUMNS - 1
+		};
+
+		if (oled->shadow_valid) {
+			while (page_window.first_column < NUM_COLUMNS &&
+			       row[page_window.first_column] == shadow_row[page_window.first_column]) {
+				page_window.first_column++;
+			}
+			if (page_window.first_column == NUM_COLUMNS) {
+				// Page unchanged, windows only span adjacent pages
+				if (window_open) {
+					err = send_window(oled, fb, &window, &bytes);
+					window_open = false;
+				}
+				continue;
+			}
+			while (row[page_window.last_column] == shadow_row[page_window.last_column]) {
+				page_window.last_column--;
+			}
+		}
+
+		if (window_open) {
+			window_t merged = {
+				.first_page = window.first_page,
+				.last_page = page,
+				.first_column = MIN(window.first_column, page_window.first_column),
+				.last_column = MAX(window.last_column, page_window.last_column)
+			};
+
+			// Extend the window if that is cheaper than starting a new transaction
+			if (window_bytes(&merged) <= window_bytes(&window) + window_bytes(&page_window)) {
+				window = merged;
+				continue;
+			}
+			err = send_window(oled, fb, &window, &bytes);
+		}
+		window = page_window;
+		window_open = true;
+	}
+	if (window_open && !err) {
+		err = send_window(oled, fb, &window, &bytes);
+	}
+
+	// Display contents are unknown after a failed transfer, resend everything next time
+	oled->shadow_valid = !err;
+	if (bytes_sent) {
+		*bytes_sent = bytes;
+	}
+	return err;
+}
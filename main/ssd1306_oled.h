@@ -8,12 +8,20 @@
 #include "fb.h"
 #include "i2c_bus.h"
 
+// Window setup commands, data control byte and a full frame
+#define SSD1306_OLED_TX_BUF_SIZE	(12 + 1 + sizeof(fb_t))
+
 typedef struct ssd1306_oled {
 	i2c_bus_t *bus;
 	unsigned int address;
 	int reset_gpio;
 	uint8_t xfers_cmd[I2C_LINK_RECOMMENDED_SIZE(3)];
+	// Display contents as of the last successful transfer
+	fb_t shadow_fb;
+	bool shadow_valid;
+	uint8_t tx_buf[SSD1306_OLED_TX_BUF_SIZE];
 } ssd1306_oled_t;
 
 esp_err_t ssd1306_oled_init(ssd1306_oled_t *oled, i2c_bus_t *bus, unsigned int address, int reset_gpio);
-esp_err_t ssd1306_oled_render_fb(ssd1306_oled_t *oled, fb_t *fb);
+// Sends only what changed since the last call, bytes_sent is optional
+esp_err_t ssd1306_oled_render_fb(ssd1306_oled_t *oled, const fb_t *fb, unsigned int *bytes_sent);
@@ -0,0 +1,92 @@
+#!/usr/bin/env python3
+"""Decode the binary battery event log downloaded from /api/v1/event_log.
+
+Usage: decode_event_log.py [--json] [FILE]
+
+Reads from stdin if FILE is omitted, e.g.
+    curl -s http://ups/api/v1/event_log | ./decode_event_log.py
+"""
+
+import argparse
+import json
+import struct
+import sys
+import zlib
+
+# Must match event_log_record_t in main/event_log.h
+RECORD = struct.Struct('<IIHBB4iI')
+CRC_LEN = RECORD.size - 4
+# esp_rom_crc32_le() with an initial value of 0 matches zlib's CRC32
+
+RESET_REASONS = {
+    0: 'unknown', 1: 'power-on', 2: 'external', 3: 'software', 4: 'panic',
+    5: 'interrupt watchdog', 6: 'task watchdog', 7: 'watchdog', 8: 'deep sleep',
+    9: 'brownout', 10: 'sdio',
+}
+
+
+def describe(event_type, data):
+    if event_type == 1:
+        return 'boot', {'reset_reason': RESET_REASONS.get(data[0], data[0])}
+    if event_type == 2:
+        return 'power_fail', {'dc_output_voltage_mv': data[0], 'soc_percent': data[1]}
+    if event_type == 3:
+        return 'power_restored', {'outage_s': data[0], 'soc_percent': data[1]}
+    if event_type == 4:
+        return 'deep_discharge', {'cell_voltage_mv': data[0]}
+    if event_type == 5:
+        return 'undervoltage_shutdown', {'cell_voltage_mv': data[0], 'latency_ms': data[1]}
+    if event_type == 6:
+        return 'temperature_excursion', {'temperature_mdegc': data[0], 'entering': bool(data[1])}
+    if event_type == 7:
+        if not data[0]:
+            return 'self_test', {'result': 'aborted'}
+        return 'self_test', {'result': 'done', 'resistance_mohm': data[1],
+                             'resistance_ohmic_mohm': data[2], 'step_current_ma': data[3]}
+    return 'unknown_%d' % event_type, {'data': list(data)}
+
+
+def decode(blob):
+    records = []
+    corrupt = 0
+    for offset in range(0, len(blob) - RECORD.size + 1, RECORD.size):
+        raw = blob[offset:offset + RECORD.size]
+        sequence, uptime_s, boot, event_type, version, d0, d1, d2, d3, crc = RECORD.unpack(raw)
+        if zlib.crc32(raw[:CRC_LEN]) != crc:
+            corrupt += 1
+            continue
+        name, fields = describe(event_type, (d0, d1, d2, d3))
+        records.append({'sequence': sequence, 'boot': boot, 'uptime_s': uptime_s,
+                        'event': name, 'version': version, **fields})
+    records.sort(key=lambda record: record['sequence'])
+    return records, corrupt
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('--json', action='store_true', help='print records as JSON lines')
+    parser.add_argument('file', nargs='?', help='binary event log, stdin if omitted')
+    args = parser.parse_args()
+
+    if args.file:
+        with open(args.file, 'rb') as f:
+            blob = f.read()
+    else:
+        blob = sys.stdin.buffer.read()
+
+    records, corrupt = decode(blob)
+    for record in records:
+        if args.json:
+            print(json.dumps(record))
+        else:
+            fields = ' '.join('%s=%s' % (key, value) for key, value in record.items()
+                              if key not in ('sequence', 'boot', 'uptime_s', 'event', 'version'))
+            uptime = '+%us' % record['uptime_s']
+            print('#%-6u boot %-4u %-10s %-22s %s' % (record['sequence'], record['boot'], uptime,
+                                                     record['event'], fields))
+    if corrupt:
+        print('%u corrupt record(s) skipped' % corrupt, file=sys.stderr)
+
+
+if __name__ == '__main__':
+    main()
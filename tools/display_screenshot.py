@@ -0,0 +1,102 @@
+#!/usr/bin/env python3
+"""Capture the OLED contents from /api/v1/display/screenshot.
+
+Usage: display_screenshot.py [--save FILE] [--compare GOLDEN [--diff FILE]] [--ascii] URL_OR_FILE
+
+URL_OR_FILE is either the device address, e.g. http://ups, or a PBM file.
+With --compare the exit status is 1 if the image differs from GOLDEN. The
+differing pixels are optionally written to --diff, set pixels mark a change.
+"""
+
+import argparse
+import sys
+import urllib.request
+
+PATH = '/api/v1/display/screenshot'
+
+
+def parse_pbm(data):
+    """Returns width, height and rows of booleans, True for lit pixels."""
+    fields = []
+    pos = 0
+    while len(fields) < 3:
+        while data[pos:pos + 1].isspace():
+            pos += 1
+        if data[pos:pos + 1] == b'#':
+            pos = data.index(b'\n', pos)
+            continue
+        end = pos
+        while not data[end:end + 1].isspace():
+            end += 1
+        fields.append(data[pos:end])
+        pos = end
+    if fields[0] != b'P4':
+        raise ValueError('not a binary PBM image')
+    width, height = int(fields[1]), int(fields[2])
+    pos += 1
+    stride = (width + 7) // 8
+    rows = []
+    for y in range(height):
+        row = data[pos + y * stride:pos + (y + 1) * stride]
+        # PBM 1 is black, lit OLED pixels are stored as 0
+        rows.append([not (row[x // 8] & (0x80 >> (x % 8))) for x in range(width)])
+    return width, height, rows
+
+
+def encode_pbm(width, rows):
+    stride = (width + 7) // 8
+    out = bytearray(b'P4\n%d %d\n' % (width, len(rows)))
+    for row in rows:
+        packed = bytearray(stride)
+        for x, lit in enumerate(row):
+            if not lit:
+                packed[x // 8] |= 0x80 >> (x % 8)
+        out += packed
+    return bytes(out)
+
+
+def load(source):
+    if source.startswith('http://') or source.startswith('https://'):
+        with urllib.request.urlopen(source.rstrip('/') + PATH) as response:
+            return response.read()
+    with open(source, 'rb') as f:
+        return f.read()
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Capture and compare OLED screenshots')
+    parser.add_argument('source', help='device URL or PBM file')
+    parser.add_argument('--save', help='write the screenshot to FILE')
+    parser.add_argument('--compare', metavar='GOLDEN', help='compare against reference PBM')
+    parser.add_argument('--diff', help='write differing pixels to FILE')
+    parser.add_argument('--ascii', action='store_true', help='print the image as text')
+    args = parser.parse_args()
+
+    data = load(args.source)
+    width, height, rows = parse_pbm(data)
+    if args.save:
+        with open(args.save, 'wb') as f:
+            f.write(data)
+    if args.ascii:
+        for row in rows:
+            print(''.join('#' if lit else '.' for lit in row))
+
+    if args.compare:
+        with open(args.compare, 'rb') as f:
+            golden_width, golden_height, golden_rows = parse_pbm(f.read())
+        if (golden_width, golden_height) != (width, height):
+            print('size mismatch: %dx%d vs %dx%d' % (width, height, golden_width, golden_height))
+            return 1
+        diff = [[a != b for a, b in zip(row, golden_row)] for row, golden_row in zip(rows, golden_rows)]
+        changed = sum(sum(row) for row in diff)
+        if args.diff:
+            with open(args.diff, 'wb') as f:
+                f.write(encode_pbm(width, diff))
+        if changed:
+            print('%d pixels differ' % changed)
+            return 1
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
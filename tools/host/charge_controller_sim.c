@@ -0,0 +1,167 @@
+/*
+ * Host simulation of the charge current PI loop in power_path.c
+ *
+ * Models the DC input as the output load plus charging power behind a
+ * charger with first order current response and its own input current
+ * limit (DPM). Runs load steps through charge_controller.c and reports
+ * overshoot, settling time and how long the charger limit was active.
+ *
+ * Usage: charge_controller_sim [-m margin_percent] [-i interval_ms] [-d dpm_error_percent] [-t]
+ */
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "charge_controller.h"
+#include "util.h"
+
+// Keep in sync with power_path.c
+#define CHARGE_CONTROL_KP_MILLI		800
+#define CHARGE_CONTROL_KI_MILLI_PER_S	15000
+#define CHARGE_CONTROL_SETPOINT_MARGIN_PERCENT	5
+
+#define INPUT_VOLTAGE_MV		19000
+#define PACK_VOLTAGE_MV			7600
+#define CHARGER_EFFICIENCY_PERCENT	90
+#define CHARGER_TAU_US			50000
+#define INPUT_CURRENT_LIMIT_MA		1000
+#define MAX_CHARGE_CURRENT_MA		1000
+#define SETTLE_BAND_PERCENT		2
+
+#define STEP_US				1000
+#define SEGMENT_US			(5 * 1000000LL)
+
+typedef struct load_step {
+	const char *name;
+	unsigned int load_mw;
+} load_step_t;
+
+static const load_step_t load_steps[] = {
+	{ "start at 14 W", 14000 },
+	{ "drop to 10 W", 10000 },
+	{ "rise to 16 W", 16000 },
+	{ "drop to 12 W", 12000 },
+};
+
+typedef struct sim_cfg {
+	unsigned int margin_percent;
+	unsigned int interval_ms;
+	// Charger limits input current this much below the programmed value as seen by the INA
+	int dpm_error_percent;
+	bool trace;
+} sim_cfg_t;
+
+static double input_current_ma(unsigned int load_mw, double charge_current_ma) {
+	double charge_power_mw = charge_current_ma * PACK_VOLTAGE_MV / 1000. * 100 / CHARGER_EFFICIENCY_PERCENT;
+
+	return (load_mw + charge_power_mw) * 1000. / INPUT_VOLTAGE_MV;
+}
+
+static int run(const sim_cfg_t *cfg) {
+	const charge_controller_cfg_t ctrl_cfg = {
+		.kp_milli = CHARGE_CONTROL_KP_MILLI,
+		.ki_milli_per_s = CHARGE_CONTROL_KI_MILLI_PER_S,
+		.max_output_ma = MAX_CHARGE_CURRENT_MA,
+	};
+	int setpoint_ma = INPUT_CURRENT_LIMIT_MA * (100 - cfg->margin_percent) / 100;
+	double dpm_limit_ma = INPUT_CURRENT_LIMIT_MA * (100 + cfg->dpm_error_percent) / 100.;
+	static double trace_in[SEGMENT_US / STEP_US];
+	charge_controller_t ctrl;
+	double charge_current_ma = 0;
+	unsigned int commanded_ma = 0;
+	int64_t t_us, next_control_us = 0;
+	int worst_settle_ms = 0;
+	unsigned int i;
+
+	charge_controller_init(&ctrl, &ctrl_cfg);
+	charge_controller_reset(&ctrl, 0);
+
+	printf("setpoint %d mA, charger limit %.0f mA, control interval %u ms\n",
+	       setpoint_ma, dpm_limit_ma, cfg->interval_ms);
+	printf("%-16s %10s %10s %10s %10s %12s %10s\n",
+	       "step", "final mA", "overshoot", "settle ms", "dpm ms", "cmd-act mA", "saturated");
+
+	for (i = 0; i < ARRAY_SIZE(load_steps); i++) {
+		const load_step_t *step = &load_steps[i];
+		unsigned int dpm_steps = 0, n = 0, k;
+		double final_ma, band_ma = setpoint_ma * SETTLE_BAND_PERCENT / 100.;
+		double overshoot_ma = 0;
+		int last_outside = -1;
+
+		for (t_us = 0; t_us < SEGMENT_US; t_us += STEP_US, n++) {
+			double measured_ma;
+
+			// Charger slews towards the commanded current
+			charge_current_ma += (commanded_ma - charge_current_ma) * STEP_US / CHARGER_TAU_US;
+			measured_ma = input_current_ma(step->load_mw, charge_current_ma);
+			if (measured_ma > dpm_limit_ma) {
+				// Charger DPM backs off charge current to hold its input limit
+				double room_ma = dpm_limit_ma - input_current_ma(step->load_mw, 0);
+
+				charge_current_ma = MAX(room_ma * INPUT_VOLTAGE_MV / PACK_VOLTAGE_MV * CHARGER_EFFICIENCY_PERCENT / 100, 0);
+				measured_ma = input_current_ma(step->load_mw, charge_current_ma);
+				dpm_steps++;
+			}
+			trace_in[n] = measured_ma;
+
+			if (t_us >= next_control_us) {
+				commanded_ma = charge_controller_update(&ctrl, setpoint_ma, (int)(measured_ma + .5),
+									cfg->interval_ms * 1000);
+				next_control_us = t_us + cfg->interval_ms * 1000LL;
+			}
+			if (cfg->trace) {
+				printf("%u %.3f %.1f %u %.1f\n", i, t_us / 1e6, measured_ma, commanded_ma, charge_current_ma);
+			}
+		}
+		next_control_us -= SEGMENT_US;
+
+		final_ma = trace_in[n - 1];
+		for (k = 0; k < n; k++) {
+			overshoot_ma = MAX(overshoot_ma, trace_in[k] - final_ma);
+			if (trace_in[k] > final_ma + band_ma || trace_in[k] < final_ma - band_ma) {
+				last_outside = k;
+			}
+		}
+
+		printf("%-16s %10.0f %10.0f %10d %10u %12.0f %10s\n", step->name, final_ma, overshoot_ma,
+		       (last_outside + 1) * STEP_US / 1000, dpm_steps * STEP_US / 1000,
+		       commanded_ma - charge_current_ma, ctrl.saturated ? "yes" : "no");
+		worst_settle_ms = MAX(worst_settle_ms, (last_outside + 1) * STEP_US / 1000);
+	}
+
+	return worst_settle_ms;
+}
+
+int main(int argc, char **argv) {
+	sim_cfg_t cfg = {
+		.margin_percent = CHARGE_CONTROL_SETPOINT_MARGIN_PERCENT,
+		.interval_ms = 100,
+		.dpm_error_percent = -2,
+		.trace = false,
+	};
+	int opt;
+
+	while ((opt = getopt(argc, argv, "m:i:d:t")) != -1) {
+		switch (opt) {
+		case 'm':
+			cfg.margin_percent = atoi(optarg);
+			break;
+		case 'i':
+			cfg.interval_ms = MAX(atoi(optarg), 1);
+			break;
+		case 'd':
+			cfg.dpm_error_percent = atoi(optarg);
+			break;
+		case 't':
+			cfg.trace = true;
+			break;
+		default:
+			fprintf(stderr, "Usage: %s [-m margin_percent] [-i interval_ms] [-d dpm_error_percent] [-t]\n", argv[0]);
+			return 2;
+		}
+	}
+
+	run(&cfg);
+	return 0;
+}
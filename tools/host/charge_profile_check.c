@@ -0,0 +1,125 @@
+/*
+ * Host check of the default charge profile tables
+ *
+ * Evaluates charge_profile_default at the temperature breakpoints, along the
+ * cell voltage taper and outside the range of every curve.
+ */
+#include <stdio.h>
+
+#include "charge_profile.h"
+#include "util.h"
+
+static unsigned int failures = 0;
+
+#define CHECK_EQ(expr, expected) do {								\
+	long long actual_ = (expr);								\
+	long long expected_ = (expected);							\
+	if (actual_ != expected_) {								\
+		printf("%s:%d: %s = %lld, expected %lld\n", __FILE__, __LINE__, #expr, actual_, expected_); \
+		failures++;									\
+	}											\
+} while (0)
+
+// Room temperature, cool charger, pack half full
+static const charge_profile_inputs_t nominal_inputs = {
+	.pack_temperature_mdegc = 25000,
+	.charger_temperature_mdegc = 40000,
+	.max_cell_voltage_mv = 3800,
+	.soc_percent = 50,
+	.full_charge_capacity_mah = 2000,
+};
+
+static unsigned int current_at_pack_temperature(int32_t mdegc) {
+	charge_profile_inputs_t inputs = nominal_inputs;
+
+	inputs.pack_temperature_mdegc = mdegc;
+	return charge_profile_get_current_ma(&charge_profile_default, &inputs);
+}
+
+static unsigned int current_at_cell_voltage(unsigned int mv) {
+	charge_profile_inputs_t inputs = nominal_inputs;
+
+	inputs.max_cell_voltage_mv = mv;
+	return charge_profile_get_current_ma(&charge_profile_default, &inputs);
+}
+
+static void check_sorted(const char *name, const charge_profile_curve_t *curve) {
+	unsigned int i;
+
+	if (!curve->num_points) {
+		printf("%s: empty curve\n", name);
+		failures++;
+	}
+	for (i = 1; i < curve->num_points; i++) {
+		if (curve->points[i].x <= curve->points[i - 1].x) {
+			printf("%s: point %u not sorted by x\n", name, i);
+			failures++;
+		}
+	}
+}
+
+int main(void) {
+	const charge_profile_t *profile = &charge_profile_default;
+	charge_profile_inputs_t inputs;
+
+	check_sorted("pack_temperature_rate", &profile->pack_temperature_rate);
+	check_sorted("charger_temperature_derating", &profile->charger_temperature_derating);
+	check_sorted("cell_voltage_taper", &profile->cell_voltage_taper);
+	check_sorted("soc_taper", &profile->soc_taper);
+
+	// Pack temperature breakpoints, 0.5 C of 2000 mAh at room temperature
+	CHECK_EQ(current_at_pack_temperature(-20000), 0);
+	CHECK_EQ(current_at_pack_temperature(0), 0);
+	CHECK_EQ(current_at_pack_temperature(2000), 200);
+	CHECK_EQ(current_at_pack_temperature(10000), 600);
+	CHECK_EQ(current_at_pack_temperature(12500), 800);
+	CHECK_EQ(current_at_pack_temperature(15000), 1000);
+	CHECK_EQ(current_at_pack_temperature(45000), 1000);
+	CHECK_EQ(current_at_pack_temperature(50000), 500);
+	CHECK_EQ(current_at_pack_temperature(55000), 0);
+	CHECK_EQ(current_at_pack_temperature(80000), 0);
+
+	// Cell voltage taper ahead of CV
+	CHECK_EQ(current_at_cell_voltage(3000), 1000);
+	CHECK_EQ(current_at_cell_voltage(4050), 1000);
+	CHECK_EQ(current_at_cell_voltage(4100), 750);
+	CHECK_EQ(current_at_cell_voltage(4150), 500);
+	CHECK_EQ(current_at_cell_voltage(4200), 100);
+	CHECK_EQ(current_at_cell_voltage(4350), 100);
+
+	// Charger derating
+	inputs = nominal_inputs;
+	inputs.charger_temperature_mdegc = 85000;
+	CHECK_EQ(charge_profile_get_current_ma(profile, &inputs), 500);
+	inputs.charger_temperature_mdegc = 120000;
+	CHECK_EQ(charge_profile_get_current_ma(profile, &inputs), 0);
+
+	// State of charge taper
+	inputs = nominal_inputs;
+	inputs.soc_percent = 100;
+	CHECK_EQ(charge_profile_get_current_ma(profile, &inputs), 250);
+
+	// Most restrictive curve wins
+	inputs = nominal_inputs;
+	inputs.soc_percent = 100;
+	inputs.max_cell_voltage_mv = 4150;
+	CHECK_EQ(charge_profile_get_current_ma(profile, &inputs), 250);
+
+	// Large packs are clamped to the pack rating
+	inputs = nominal_inputs;
+	inputs.full_charge_capacity_mah = 10000;
+	CHECK_EQ(charge_profile_get_current_ma(profile, &inputs), profile->max_current_ma);
+	CHECK_EQ(profile->max_current_ma, 1024);
+
+	// Unknown capacity falls back to the nominal pack
+	inputs = nominal_inputs;
+	inputs.full_charge_capacity_mah = 0;
+	CHECK_EQ(charge_profile_get_current_ma(profile, &inputs), profile->fallback_capacity_mah / 2);
+
+	if (failures) {
+		printf("%u checks failed\n", failures);
+		return 1;
+	}
+	printf("charge profile OK\n");
+	return 0;
+}
@@ -0,0 +1,778 @@
+/*
+ * Host harness for the GUI and the display screens
+ *
+ * Builds gui.c, font_3x5.c and the display_*.c screens against stubbed
+ * data sources and renders every screen from fixture data. Frames are
+ * compared against (or written to) golden PBM images in the same format
+ * as the device screenshot endpoint, see tools/display_screenshot.py.
+ *
+ * Usage: gui_harness [-c golden_dir | -w golden_dir | -b frames] [screen...]
+ *   -c  compare against golden images (default, golden/), mismatching
+ *       frames are written to <screen>.actual.pbm
+ *   -w  write golden images
+ *   -b  benchmark, switches to and updates each screen for the given number
+ *       of frames, every switch renders a cleared and a redrawn frame
+ * Screens default to all of them.
+ *
+ * The list shots exercise the virtual list widget, which no screen uses
+ * yet, and also check its scroll and selection state.
+ *
+ * Built with GUI_HARNESS_REFERENCE the harness compiles against the
+ * sources of REFERENCE_REV instead, the renderer golden images are
+ * recorded from. See the golden target in the Makefile.
+ */
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <esp_random.h>
+#include <esp_timer.h>
+
+#include "battery_gauge.h"
+#include "display.h"
+#include "display_bms.h"
+#include "display_network.h"
+#include "display_on_battery.h"
+#include "display_power.h"
+#include "display_screensaver.h"
+#include "display_system.h"
+#include "ethernet.h"
+#include "event_bus.h"
+#include "fb.h"
+#include "gui.h"
+#include "power_path.h"
+#include "scheduler.h"
+#include "util.h"
+#include "vendor.h"
+
+#define DEFAULT_GOLDEN_DIR	"golden"
+#define MAX_EVENT_HANDLERS	16
+#define LIST_ROW_HEIGHT		6
+// Rows needed to cover the 40 px high list, 6 of them fully visible
+#define LIST_NUM_ROWS		7
+#define LIST_FULL_ROWS		6
+// Fixed frame clock, keeps animations deterministic
+#define FRAME_TIME_US		(1000LL * 1000LL * 1000LL)
+
+typedef struct fixture {
+	const char *name;
+	bool on_battery;
+	unsigned int soc_percent;
+	unsigned int soh_percent;
+	long temperature_mdegc;
+	unsigned int cell1_mv;
+	unsigned int cell2_mv;
+	long current_ma;
+	unsigned int full_charge_capacity_mah;
+	bool runtime_valid;
+	unsigned int runtime_min;
+	unsigned int runtime_low_min;
+	unsigned int runtime_high_min;
+	power_path_group_data_t groups[POWER_PATH_GROUP_MAX_ + 1];
+	unsigned int input_current_limit_ma;
+	bool link_up;
+	eth_speed_t link_speed;
+	uint8_t ipv4[4];
+	const char *serial_number;
+} fixture_t;
+
+static const fixture_t fixture_mains = {
+	.name = "mains",
+	.on_battery = false,
+	.soc_percent = 87,
+	.soh_percent = 96,
+	.temperature_mdegc = 27400,
+	.cell1_mv = 4012,
+	.cell2_mv = 4008,
+	.current_ma = 742,
+	.full_charge_capacity_mah = 2950,
+	.runtime_valid = true,
+	.runtime_min = 143,
+	.runtime_low_min = 128,
+	.runtime_high_min = 158,
+	.groups = {
+		[POWER_PATH_GROUP_IN] = { .voltage_mv = 19120, .current_ma = 1310, .power_mw = 25047 },
+		[POWER_PATH_GROUP_DC] = { .voltage_mv = 12050, .current_ma = 1250, .power_mw = 15062 },
+		[POWER_PATH_GROUP_USB] = { .voltage_mv = 5080, .current_ma = 420, .power_mw = 2133 },
+	},
+	.input_current_limit_ma = 2048,
+	.link_up = true,
+	.link_speed = ETH_SPEED_100M,
+	.ipv4 = { 192, 168, 1, 42 },
+	.serial_number = "UPS-0042",
+};
+
+static const fixture_t fixture_battery = {
+	.name = "battery",
+	.on_battery = true,
+	.soc_percent = 64,
+	.soh_percent = 96,
+	.temperature_mdegc = 31200,
+	.cell1_mv = 3741,
+	.cell2_mv = 3736,
+	.current_ma = -2210,
+	.full_charge_capacity_mah = 2950,
+	.runtime_valid = true,
+	.runtime_min = 47,
+	.runtime_low_min = 41,
+	.runtime_high_min = 53,
+	.groups = {
+		[POWER_PATH_GROUP_IN] = { 0 },
+		[POWER_PATH_GROUP_DC] = { .voltage_mv = 12010, .current_ma = 1240, .power_mw = 14892 },
+		[POWER_PATH_GROUP_USB] = { .voltage_mv = 5060, .current_ma = 410, .power_mw = 2074 },
+	},
+	.input_current_limit_ma = 2048,
+	.link_up = true,
+	.link_speed = ETH_SPEED_100M,
+	.ipv4 = { 192, 168, 1, 42 },
+	.serial_number = "UPS-0042",
+};
+
+typedef struct shot {
+	const char *name;
+	const display_screen_t **screen;
+	const fixture_t *fixture;
+	// Runs after showing the screen, returns the number of failed checks
+	unsigned int (*prepare)(void);
+} shot_t;
+
+#define CHECK_EQ(expr, expected) do {								\
+	long long actual_ = (expr);								\
+	long long expected_ = (expected);							\
+	if (actual_ != expected_) {								\
+		printf("%s:%d: %s = %lld, expected %lld\n", __FILE__, __LINE__, #expr, actual_, expected_); \
+		failures++;									\
+	}											\
+} while (0)
+
+static const display_screen_t *screen_bms;
+static const display_screen_t *screen_power;
+static const display_screen_t *screen_network;
+static const display_screen_t *screen_system;
+static const display_screen_t *screen_screensaver;
+static const display_screen_t *screen_on_battery;
+#ifndef GUI_HARNESS_REFERENCE
+static const display_screen_t *screen_list;
+
+static unsigned int list_top(void);
+static unsigned int list_scrolled(void);
+static unsigned int list_shrunk(void);
+static unsigned int list_deselected(void);
+#endif
+
+static const shot_t shots[] = {
+	{ "bms", &screen_bms, &fixture_mains, NULL },
+	{ "power", &screen_power, &fixture_mains, NULL },
+	{ "network", &screen_network, &fixture_mains, NULL },
+	{ "system", &screen_system, &fixture_mains, NULL },
+	{ "screensaver", &screen_screensaver, &fixture_mains, NULL },
+	{ "on_battery", &screen_on_battery, &fixture_battery, NULL },
+#ifndef GUI_HARNESS_REFERENCE
+	{ "list_top", &screen_list, &fixture_mains, list_top },
+	{ "list_scrolled", &screen_list, &fixture_mains, list_scrolled },
+	{ "list_shrunk", &screen_list, &fixture_mains, list_shrunk },
+	{ "list_deselected", &screen_list, &fixture_mains, list_deselected },
+#endif
+};
+
+// Current data source values, benchmark mode modifies a copy
+static fixture_t fixture;
+static int64_t now_us = FRAME_TIME_US;
+static uint32_t random_state = 1;
+
+// Screens given on the command line, all if empty
+static char **selected_screens;
+static int num_selected_screens = 0;
+
+static event_bus_handler_t *event_handlers[MAX_EVENT_HANDLERS];
+static unsigned int num_event_handlers = 0;
+
+static gui_t gui;
+static gui_label_t title_label;
+#ifdef GUI_HARNESS_REFERENCE
+// Reference renderer draws one byte per pixel
+static gui_pixel_t render_fb[64 * 48];
+#else
+static const char *pending_title;
+static gui_update_t title_update;
+#endif
+static fb_t display_fb;
+
+#ifndef GUI_HARNESS_REFERENCE
+static gui_virtual_list_t list;
+static gui_virtual_list_row_t list_rows[LIST_NUM_ROWS];
+static unsigned int list_provider_calls;
+#endif
+
+/*
+ * Stubbed data sources
+ */
+int64_t esp_timer_get_time(void) {
+	return now_us;
+}
+
+uint32_t esp_random(void) {
+	random_state = random_state * 1103515245 + 12345;
+	return random_state >> 8;
+}
+
+void event_bus_subscribe(event_bus_handler_t *handler, const char *topic, eventbus_notify_cb_f notify_cb, void *priv) {
+	if (num_event_handlers >= ARRAY_SIZE(event_handlers)) {
+		fprintf(stderr, "Too many event handlers\n");
+		exit(2);
+	}
+
+	handler->topic = topic;
+	handler->notify_cb = notify_cb;
+	handler->priv = priv;
+	event_handlers[num_event_handlers++] = handler;
+}
+
+void event_bus_notify(const char *topic, void *data) {
+	unsigned int i;
+
+	for (i = 0; i < num_event_handlers; i++) {
+		if (!strcmp(event_handlers[i]->topic, topic)) {
+			event_handlers[i]->notify_cb(event_handlers[i]->priv, data);
+		}
+	}
+}
+
+// Periodic screen tasks never run, screens are driven by events only
+void scheduler_task_init(scheduler_task_t *task) { }
+void scheduler_schedule_task_relative(scheduler_task_t *task, scheduler_cb_f cb, void *ctx, int64_t timeout_us) { }
+
+unsigned int battery_gauge_get_soc_percent(void) { return fixture.soc_percent; }
+unsigned int battery_gauge_get_soh_percent(void) { return fixture.soh_percent; }
+long battery_gauge_get_temperature_mdegc(void) { return fixture.temperature_mdegc; }
+unsigned int battery_gauge_get_cell1_voltage_mv(void) { return fixture.cell1_mv; }
+unsigned int battery_gauge_get_cell2_voltage_mv(void) { return fixture.cell2_mv; }
+long battery_gauge_get_current_ma(void) { return fixture.current_ma; }
+unsigned int battery_gauge_get_full_charge_capacity_mah(void) { return fixture.full_charge_capacity_mah; }
+
+#ifdef GUI_HARNESS_REFERENCE
+// Gauge runtime, replaced by the runtime estimate later on
+unsigned int battery_gauge_get_time_to_empty_min(void) { return fixture.runtime_min; }
+unsigned int battery_gauge_get_at_rate_time_to_empty_min(void) { return fixture.runtime_min; }
+void scheduler_abort_task(scheduler_task_t *task) { }
+#else
+void battery_gauge_get_runtime_estimate(runtime_estimate_t *estimate) {
+	memset(estimate, 0, sizeof(*estimate));
+	estimate->valid = fixture.runtime_valid;
+	estimate->runtime_min = fixture.runtime_min;
+	estimate->runtime_low_min = fixture.runtime_low_min;
+	estimate->runtime_high_min = fixture.runtime_high_min;
+}
+#endif
+
+void power_path_get_group_data(power_path_group_t group, power_path_group_data_t *data) {
+	*data = fixture.groups[group];
+}
+
+unsigned long power_path_get_output_power_consumption_mw(void) {
+	return fixture.groups[POWER_PATH_GROUP_DC].power_mw + fixture.groups[POWER_PATH_GROUP_USB].power_mw;
+}
+
+unsigned int power_path_get_input_current_limit_ma(void) {
+	return fixture.input_current_limit_ma;
+}
+
+bool ethernet_is_link_up(void) {
+	return fixture.link_up;
+}
+
+eth_speed_t ethernet_get_link_speed(void) {
+	return fixture.link_speed;
+}
+
+esp_err_t ethernet_get_ipv4_address(esp_netif_ip_info_t *ip_info) {
+	memset(ip_info, 0, sizeof(*ip_info));
+	memcpy(&ip_info->ip.addr, fixture.ipv4, sizeof(fixture.ipv4));
+	return ESP_OK;
+}
+
+void vendor_lock(void) { }
+void vendor_unlock(void) { }
+
+const char *vendor_get_serial_number_(void) {
+	return fixture.serial_number;
+}
+
+/*
+ * Display, mirrors the setup and screen switching in display.c
+ */
+static const gui_ops_t gui_ops = { 0 };
+
+static void set_title(const char *title) {
+	if (title) {
+		gui_label_set_text(&title_label, title);
+		gui_element_set_hidden(&title_label.element, false);
+		gui_element_show(&title_label.element);
+	} else {
+		gui_element_set_hidden(&title_label.element, true);
+	}
+}
+
+#ifndef GUI_HARNESS_REFERENCE
+static void apply_title_update(gui_update_t *update) {
+	set_title(pending_title);
+}
+#endif
+
+static unsigned int render_frame(void);
+
+#ifndef GUI_HARNESS_REFERENCE
+/*
+ * Virtual list
+ */
+static void list_provider(void *priv, unsigned int index, char *text, size_t text_size) {
+	list_provider_calls++;
+	snprintf(text, text_size, "EVENT %u", index);
+}
+
+static void list_show(void) {
+	gui_lock(&gui);
+	gui_element_set_hidden(&list.container.element, false);
+	gui_element_show(&list.container.element);
+	gui_unlock(&gui);
+}
+
+static void list_hide(void) {
+	gui_lock(&gui);
+	gui_element_set_hidden(&list.container.element, true);
+	gui_unlock(&gui);
+}
+
+static const display_screen_t list_screen = {
+	.name = "LIST",
+	.show = list_show,
+	.hide = list_hide
+};
+
+static const display_screen_t *list_init(void) {
+	gui_virtual_list_init(&list, list_rows, ARRAY_SIZE(list_rows), LIST_ROW_HEIGHT, list_provider, NULL);
+	gui_element_set_size(&list.container.element, 64, 48 - 8);
+	gui_element_set_position(&list.container.element, 0, 8);
+	gui_element_set_hidden(&list.container.element, true);
+	gui_element_add_child(&gui.container.element, &list.container.element);
+	return &list_screen;
+}
+
+static unsigned int count_inverted_rows(void) {
+	unsigned int i, inverted = 0;
+
+	for (i = 0; i < ARRAY_SIZE(list_rows); i++) {
+		inverted += !list_rows[i].label.element.hidden && list_rows[i].label.element.inverted;
+	}
+
+	return inverted;
+}
+
+// Each shot starts from the top of a long list
+static void list_reset(unsigned int selected_index) {
+	gui_lock(&gui);
+	gui_virtual_list_set_num_entries(&list, 100);
+	gui_virtual_list_set_selected_index(&list, 0);
+	gui_virtual_list_set_selected_index(&list, selected_index);
+	gui_unlock(&gui);
+}
+
+static unsigned int list_top(void) {
+	unsigned int failures = 0;
+
+	list_reset(0);
+
+	CHECK_EQ(list.first_visible_index, 0);
+	CHECK_EQ(list.selected_index, 0);
+	CHECK_EQ(count_inverted_rows(), 1);
+	return failures;
+}
+
+static unsigned int list_scrolled(void) {
+	unsigned int failures = 0;
+
+	// Selection below the visible rows scrolls it to the last full row
+	list_reset(57);
+	CHECK_EQ(list.first_visible_index, 57 - LIST_FULL_ROWS + 1);
+	CHECK_EQ(list.selected_index, 57);
+	CHECK_EQ(list_rows[LIST_FULL_ROWS - 1].label.element.inverted, true);
+
+	// Rebinding unchanged entries must not damage anything
+	render_frame();
+	list_provider_calls = 0;
+	gui_lock(&gui);
+	gui_virtual_list_refresh(&list);
+	gui_unlock(&gui);
+	CHECK_EQ(list_provider_calls, LIST_NUM_ROWS);
+	CHECK_EQ(render_frame(), 0);
+
+	// Selection above the visible rows scrolls it to the first row
+	gui_lock(&gui);
+	gui_virtual_list_set_selected_index(&list, 40);
+	gui_unlock(&gui);
+	CHECK_EQ(list.first_visible_index, 40);
+	CHECK_EQ(list_rows[0].label.element.inverted, true);
+	return failures;
+}
+
+static unsigned int list_shrunk(void) {
+	unsigned int failures = 0;
+
+	// Selection moves to the last entry and no empty rows are left below it
+	list_reset(57);
+	gui_lock(&gui);
+	gui_virtual_list_set_num_entries(&list, 10);
+	gui_unlock(&gui);
+	CHECK_EQ(list.selected_index, 9);
+	CHECK_EQ(list.first_visible_index, 10 - LIST_FULL_ROWS);
+	CHECK_EQ(count_inverted_rows(), 1);
+	return failures;
+}
+
+static unsigned int list_deselected(void) {
+	unsigned int failures = 0;
+
+	list_reset(57);
+	gui_lock(&gui);
+	gui_virtual_list_set_num_entries(&list, 10);
+	gui_virtual_list_set_selected_index(&list, -1);
+	gui_unlock(&gui);
+	CHECK_EQ(list.selected_index, -1);
+	CHECK_EQ(list.first_visible_index, 10 - LIST_FULL_ROWS);
+	CHECK_EQ(count_inverted_rows(), 0);
+
+	// Entries beyond the end are not bound
+	gui_lock(&gui);
+	gui_virtual_list_set_num_entries(&list, 3);
+	gui_unlock(&gui);
+	CHECK_EQ(list.first_visible_index, 0);
+	CHECK_EQ(list_rows[3].label.element.hidden, true);
+	return failures;
+}
+#endif
+
+static void display_setup(void) {
+	fb_init(&display_fb);
+	gui_init(&gui, NULL, &gui_ops);
+
+	gui_label_init(&title_label, "<TITLE>");
+	gui_label_set_text_alignment(&title_label, GUI_TEXT_ALIGN_CENTER);
+	gui_element_set_size(&title_label.element, 64, 5);
+	gui_element_set_hidden(&title_label.element, true);
+	gui_element_add_child(&gui.container.element, &title_label.element);
+#ifndef GUI_HARNESS_REFERENCE
+	gui_update_init(&title_update, apply_title_update);
+#endif
+
+	screen_screensaver = display_screensaver_init(&gui);
+	screen_on_battery = display_on_battery_init(&gui);
+	screen_bms = display_bms_init(&gui);
+	screen_power = display_power_init(&gui);
+	screen_network = display_network_init(&gui);
+	screen_system = display_system_init(&gui);
+#ifndef GUI_HARNESS_REFERENCE
+	screen_list = list_init();
+#endif
+}
+
+static void show_screen(const display_screen_t *screen) {
+#ifdef GUI_HARNESS_REFERENCE
+	set_title(screen->name);
+#else
+	gui_update_lock(&gui);
+	pending_title = screen->name;
+	gui_update_queue(&gui, &title_update);
+	gui_update_unlock(&gui);
+#endif
+	screen->show();
+}
+
+static void notify_all(void) {
+	event_bus_notify("battery_gauge", NULL);
+	event_bus_notify("power_path", NULL);
+	event_bus_notify("network", NULL);
+	event_bus_notify("vendor", NULL);
+}
+
+// Returns the number of damaged areas rendered, always 0 for the reference
+static unsigned int render_frame(void) {
+	const gui_point_t render_size = { 64, 48 };
+#ifdef GUI_HARNESS_REFERENCE
+	unsigned int x, y;
+
+	gui_lock(&gui);
+	gui_render(&gui, render_fb, 64, &render_size);
+	gui_unlock(&gui);
+
+	for (y = 0; y < 48; y++) {
+		for (x = 0; x < 64; x++) {
+			fb_set_pixel(&display_fb, x, y, !!render_fb[y * 64 + x]);
+		}
+	}
+
+	return 0;
+#else
+	gui_damage_t damage;
+
+	gui_lock(&gui);
+	gui_render(&gui, display_fb.data, fb_width(&display_fb), &render_size, &damage);
+	gui_unlock(&gui);
+
+	return damage.num_areas;
+#endif
+}
+
+/*
+ * Golden images
+ */
+static bool is_lit(const fb_t *fb, unsigned int x, unsigned int y) {
+	return fb->data[(y / 8) * 64 + x] & (1 << (y % 8));
+}
+
+// Same encoding as the screenshot endpoint, PBM 1 is black, lit pixels are 0
+static int write_pbm(const char *path, const fb_t *fb) {
+	uint8_t row[DIV_ROUND_UP(64, 8)];
+	unsigned int x, y;
+	FILE *f = fopen(path, "wb");
+
+	if (!f) {
+		fprintf(stderr, "Failed to open %s: %s\n", path, strerror(errno));
+		return -1;
+	}
+
+	fprintf(f, "P4\n%u %u\n", 64, 48);
+	for (y = 0; y < 48; y++) {
+		memset(row, 0, sizeof(row));
+		for (x = 0; x < 64; x++) {
+			if (!is_lit(fb, x, y)) {
+				row[x / 8] |= 0x80 >> (x % 8);
+			}
+		}
+		fwrite(row, 1, sizeof(row), f);
+	}
+
+	return fclose(f) ? -1 : 0;
+}
+
+static int read_pbm(const char *path, fb_t *fb) {
+	uint8_t row[DIV_ROUND_UP(64, 8)];
+	unsigned int width, height, x, y;
+	FILE *f = fopen(path, "rb");
+
+	if (!f) {
+		fprintf(stderr, "Failed to open %s: %s\n", path, strerror(errno));
+		return -1;
+	}
+
+	if (fscanf(f, "P4 %u %u", &width, &height) != 2 || fgetc(f) == EOF || width != 64 || height != 48) {
+		fprintf(stderr, "%s is not a 64x48 binary PBM\n", path);
+		fclose(f);
+		return -1;
+	}
+
+	fb_init(fb);
+	for (y = 0; y < height; y++) {
+		if (fread(row, 1, sizeof(row), f) != sizeof(row)) {
+			fprintf(stderr, "%s is truncated\n", path);
+			fclose(f);
+			return -1;
+		}
+		for (x = 0; x < width; x++) {
+			fb_set_pixel(fb, x, y, !(row[x / 8] & (0x80 >> (x % 8))));
+		}
+	}
+
+	fclose(f);
+	return 0;
+}
+
+static unsigned int count_differences(const fb_t *a, const fb_t *b) {
+	unsigned int x, y, differences = 0;
+
+	for (y = 0; y < 48; y++) {
+		for (x = 0; x < 64; x++) {
+			differences += is_lit(a, x, y) != is_lit(b, x, y);
+		}
+	}
+
+	return differences;
+}
+
+static bool is_selected(const shot_t *shot) {
+	int i;
+
+	if (!num_selected_screens) {
+		return true;
+	}
+	for (i = 0; i < num_selected_screens; i++) {
+		if (!strcmp(selected_screens[i], shot->name)) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+// Returns the number of failed checks
+static unsigned int render_shot(const shot_t *shot) {
+	unsigned int failures = 0;
+
+	fixture = *shot->fixture;
+	notify_all();
+	show_screen(*shot->screen);
+	if (shot->prepare) {
+		failures = shot->prepare();
+	}
+	render_frame();
+
+	return failures;
+}
+
+static int run_golden(const char *golden_dir, bool write) {
+	unsigned int i, failures = 0;
+	char path[256];
+
+	display_setup();
+	for (i = 0; i < ARRAY_SIZE(shots); i++) {
+		const shot_t *shot = &shots[i];
+		fb_t golden;
+		unsigned int differences;
+
+		if (!is_selected(shot)) {
+			continue;
+		}
+		if (render_shot(shot)) {
+			printf("%-16s FAIL, checks failed\n", shot->name);
+			failures++;
+		}
+		snprintf(path, sizeof(path), "%s/%s.pbm", golden_dir, shot->name);
+		if (write) {
+			if (write_pbm(path, &display_fb)) {
+				return 1;
+			}
+			printf("wrote %s\n", path);
+		} else {
+			if (read_pbm(path, &golden)) {
+				return 1;
+			}
+			differences = count_differences(&golden, &display_fb);
+			if (differences) {
+				snprintf(path, sizeof(path), "%s.actual.pbm", shot->name);
+				write_pbm(path, &display_fb);
+				printf("%-16s FAIL, %u pixels differ, see %s\n", shot->name, differences, path);
+				failures++;
+			} else {
+				printf("%-16s OK\n", shot->name);
+			}
+		}
+		(*shot->screen)->hide();
+	}
+
+	return failures ? 1 : 0;
+}
+
+/*
+ * Benchmark
+ */
+static int64_t monotonic_ns(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void print_rate(const char *screen, const char *mode, unsigned int frames, int64_t elapsed_ns) {
+	printf("%-16s %-8s %10.0f fps %8.2f us/frame\n", screen, mode,
+	       frames * 1e9 / MAX(elapsed_ns, 1), elapsed_ns / 1e3 / frames);
+}
+
+static int run_benchmark(unsigned int frames) {
+	unsigned int i, frame;
+
+	display_setup();
+	printf("Host render rate, compare between revisions rather than against the device\n");
+	for (i = 0; i < ARRAY_SIZE(shots); i++) {
+		const shot_t *shot = &shots[i];
+		const display_screen_t *screen = *shot->screen;
+		int64_t start_ns;
+
+		if (!is_selected(shot)) {
+			continue;
+		}
+		render_shot(shot);
+
+		// Clear and full redraw, what a screen switch costs
+		start_ns = monotonic_ns();
+		for (frame = 0; frame < frames; frame++) {
+			screen->hide();
+			render_frame();
+			screen->show();
+			render_frame();
+		}
+		print_rate(shot->name, "switch", frames, monotonic_ns() - start_ns);
+
+		// Changing values, what steady state costs
+		start_ns = monotonic_ns();
+		for (frame = 0; frame < frames; frame++) {
+			fixture.current_ma = shot->fixture->current_ma + frame % 100;
+			fixture.groups[POWER_PATH_GROUP_DC].power_mw = shot->fixture->groups[POWER_PATH_GROUP_DC].power_mw + frame % 100;
+			fixture.runtime_min = shot->fixture->runtime_min + frame % 10;
+			notify_all();
+			render_frame();
+		}
+		print_rate(shot->name, "update", frames, monotonic_ns() - start_ns);
+
+		screen->hide();
+		render_frame();
+	}
+
+	return 0;
+}
+
+int main(int argc, char **argv) {
+	const char *golden_dir = DEFAULT_GOLDEN_DIR;
+	unsigned int bench_frames = 0;
+	bool write = false;
+	unsigned int j;
+	int opt, i;
+
+	while ((opt = getopt(argc, argv, "c:w:b:")) != -1) {
+		switch (opt) {
+		case 'c':
+			golden_dir = optarg;
+			break;
+		case 'w':
+			golden_dir = optarg;
+			write = true;
+			break;
+		case 'b':
+			bench_frames = MAX(atoi(optarg), 1);
+			break;
+		default:
+			fprintf(stderr, "Usage: %s [-c golden_dir | -w golden_dir | -b frames] [screen...]\n", argv[0]);
+			return 2;
+		}
+	}
+	selected_screens = &argv[optind];
+	num_selected_screens = argc - optind;
+	for (i = 0; i < num_selected_screens; i++) {
+		for (j = 0; j < ARRAY_SIZE(shots); j++) {
+			if (!strcmp(selected_screens[i], shots[j].name)) {
+				break;
+			}
+		}
+		if (j == ARRAY_SIZE(shots)) {
+			fprintf(stderr, "Unknown screen %s\n", selected_screens[i]);
+			return 2;
+		}
+	}
+
+	if (bench_frames) {
+		return run_benchmark(bench_frames);
+	}
+	return run_golden(golden_dir, write);
+}
@@ -0,0 +1,6 @@
+#pragma once
+
+typedef int i2c_port_t;
+typedef void *i2c_cmd_handle_t;
+
+#define I2C_LINK_RECOMMENDED_SIZE(max_transactions)	(2 * (max_transactions) * 32)
@@ -0,0 +1,4 @@
+#pragma once
+
+typedef int spi_host_device_t;
+typedef void *spi_device_handle_t;
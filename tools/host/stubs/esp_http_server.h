@@ -0,0 +1,30 @@
+#pragma once
+
+#include <stdbool.h>
+#include <sys/types.h>
+
+#include "esp_err.h"
+
+typedef void *httpd_handle_t;
+
+typedef enum {
+	HTTP_GET,
+	HTTP_POST,
+} httpd_method_t;
+
+typedef struct httpd_req {
+	void *user_ctx;
+	const char *uri;
+} httpd_req_t;
+
+typedef struct httpd_uri {
+	const char *uri;
+	httpd_method_t method;
+	esp_err_t (*handler)(httpd_req_t *req);
+	void *user_ctx;
+	bool is_websocket;
+} httpd_uri_t;
+
+esp_err_t httpd_resp_send_chunk(httpd_req_t *req, const char *buf, ssize_t len);
+esp_err_t httpd_resp_set_status(httpd_req_t *req, const char *status);
+esp_err_t httpd_resp_set_type(httpd_req_t *req, const char *type);
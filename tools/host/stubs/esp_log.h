@@ -0,0 +1,7 @@
+#pragma once
+
+#define ESP_LOGE(tag, fmt, ...)	do { (void)(tag); } while (0)
+#define ESP_LOGW(tag, fmt, ...)	do { (void)(tag); } while (0)
+#define ESP_LOGI(tag, fmt, ...)	do { (void)(tag); } while (0)
+#define ESP_LOGD(tag, fmt, ...)	do { (void)(tag); } while (0)
+#define ESP_LOGV(tag, fmt, ...)	do { (void)(tag); } while (0)
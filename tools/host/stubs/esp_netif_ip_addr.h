@@ -0,0 +1,14 @@
+#pragma once
+
+#include <stdint.h>
+
+typedef struct esp_ip4_addr {
+	uint32_t addr;
+} esp_ip4_addr_t;
+
+#define IPSTR		"%d.%d.%d.%d"
+#define esp_ip4_addr1(ipaddr)	(((const uint8_t *)(&(ipaddr)->addr))[0])
+#define esp_ip4_addr2(ipaddr)	(((const uint8_t *)(&(ipaddr)->addr))[1])
+#define esp_ip4_addr3(ipaddr)	(((const uint8_t *)(&(ipaddr)->addr))[2])
+#define esp_ip4_addr4(ipaddr)	(((const uint8_t *)(&(ipaddr)->addr))[3])
+#define IP2STR(ipaddr)	esp_ip4_addr1(ipaddr), esp_ip4_addr2(ipaddr), esp_ip4_addr3(ipaddr), esp_ip4_addr4(ipaddr)
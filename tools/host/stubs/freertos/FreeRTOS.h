@@ -0,0 +1,11 @@
+#pragma once
+
+#include <stdint.h>
+
+typedef int BaseType_t;
+typedef uint32_t TickType_t;
+
+#define pdTRUE		1
+#define pdFALSE		0
+#define pdPASS		pdTRUE
+#define portMAX_DELAY	UINT32_MAX
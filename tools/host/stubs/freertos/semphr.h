@@ -0,0 +1,32 @@
+#pragma once
+
+#include "FreeRTOS.h"
+
+// Host builds are single threaded, semaphores only count takes and gives
+typedef struct StaticSemaphore {
+	int count;
+} StaticSemaphore_t;
+
+typedef StaticSemaphore_t *SemaphoreHandle_t;
+
+static inline SemaphoreHandle_t xSemaphoreCreateMutexStatic(StaticSemaphore_t *buffer) {
+	buffer->count = 0;
+	return buffer;
+}
+
+static inline SemaphoreHandle_t xSemaphoreCreateRecursiveMutexStatic(StaticSemaphore_t *buffer) {
+	return xSemaphoreCreateMutexStatic(buffer);
+}
+
+static inline BaseType_t xSemaphoreTake(SemaphoreHandle_t sem, TickType_t timeout) {
+	sem->count++;
+	return pdTRUE;
+}
+
+static inline BaseType_t xSemaphoreGive(SemaphoreHandle_t sem) {
+	sem->count--;
+	return pdTRUE;
+}
+
+#define xSemaphoreTakeRecursive(sem, timeout)	xSemaphoreTake(sem, timeout)
+#define xSemaphoreGiveRecursive(sem)		xSemaphoreGive(sem)
@@ -0,0 +1,7 @@
+#pragma once
+
+typedef enum {
+	ETH_SPEED_10M,
+	ETH_SPEED_100M,
+	ETH_SPEED_MAX,
+} eth_speed_t;